@@ -0,0 +1,60 @@
+#pragma once
+/*
+ * Allocation counting
+ * Author: Roman Romop5 Dobias
+ * Purpose: let loaders report how many heap allocations a load took
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace Allocations {
+
+inline std::atomic<uint64_t>& getCounter()
+{
+  static std::atomic<uint64_t> counter(0);
+  return counter;
+}
+
+/// Count of allocations so far, stays 0 unless COUNT_ALLOCATIONS() is used
+inline uint64_t getCount()
+{
+  return getCounter().load(std::memory_order_relaxed);
+}
+
+} // namespace Allocations
+
+/* GCC pairs the builtin operator new with free() of the inlined replacement
+ * delete and reports them as mismatched, although both are replaced here.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#define ALLOCATIONS_DIAGNOSTIC_PUSH                                            \
+  _Pragma("GCC diagnostic push")                                               \
+    _Pragma("GCC diagnostic ignored \"-Wmismatched-new-delete\"")
+#define ALLOCATIONS_DIAGNOSTIC_POP _Pragma("GCC diagnostic pop")
+#else
+#define ALLOCATIONS_DIAGNOSTIC_PUSH
+#define ALLOCATIONS_DIAGNOSTIC_POP
+#endif
+
+/* \brief Replaces global operator new / delete of executable by counting ones
+ *
+ * Use once at file scope of a single translation unit (e.g. main.cpp).
+ */
+#define COUNT_ALLOCATIONS()                                                    \
+  ALLOCATIONS_DIAGNOSTIC_PUSH                                                  \
+  void* operator new(std::size_t size)                                         \
+  {                                                                            \
+    Allocations::getCounter().fetch_add(1, std::memory_order_relaxed);         \
+    if (void* memory = std::malloc(size > 0 ? size : 1))                       \
+      return memory;                                                           \
+    throw std::bad_alloc();                                                    \
+  }                                                                            \
+  void operator delete(void* memory) noexcept { std::free(memory); }           \
+  void operator delete(void* memory, std::size_t) noexcept                     \
+  {                                                                            \
+    std::free(memory);                                                         \
+  }                                                                            \
+  ALLOCATIONS_DIAGNOSTIC_POP
@@ -0,0 +1,253 @@
+#pragma once
+/*
+ * Compact encoding primitives
+ * Author: Roman Romop5 Dobias
+ * Purpose: varints, fixed-point quantization and quaternion packing shared by
+ * compact encodings of all formats
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string.h>
+#include <vector>
+
+namespace Packing {
+
+/* \brief Appends values to a byte buffer
+ */
+class Writer
+{
+private:
+  std::vector<unsigned char>& output;
+
+public:
+  explicit Writer(std::vector<unsigned char>& buffer)
+    : output(buffer)
+  {}
+
+  void putRaw(const void* data, size_t size)
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    output.insert(output.end(), bytes, bytes + size);
+  }
+
+  template<typename T>
+  void put(const T& value)
+  {
+    putRaw(&value, sizeof(T));
+  }
+
+  /// LEB128: 7 bits per byte, small values take a single byte
+  void putVarint(uint64_t value)
+  {
+    while (value >= 0x80) {
+      output.push_back(static_cast<unsigned char>(value | 0x80));
+      value >>= 7;
+    }
+    output.push_back(static_cast<unsigned char>(value));
+  }
+
+  /// Maps small negative numbers to small varints
+  void putSignedVarint(int64_t value)
+  {
+    putVarint((static_cast<uint64_t>(value) << 1) ^
+              static_cast<uint64_t>(value >> 63));
+  }
+
+  size_t size() const { return output.size(); }
+};
+
+/* \brief Reads values written by Writer, any overrun marks reader as failed
+ */
+class Reader
+{
+private:
+  const unsigned char* data;
+  size_t size;
+  size_t position;
+  bool failed;
+
+public:
+  Reader(const void* buffer, size_t bufferSize)
+    : data(static_cast<const unsigned char*>(buffer))
+    , size(bufferSize)
+    , position(0)
+    , failed(false)
+  {}
+
+  bool hasFailed() const { return failed; }
+  size_t remaining() const { return size - position; }
+
+  bool getRaw(void* destination, size_t count)
+  {
+    if (failed || count > size - position) {
+      failed = true;
+      return false;
+    }
+    // empty vectors pass nullptr, which memcpy() doesn't accept
+    if (count == 0)
+      return true;
+    memcpy(destination, data + position, count);
+    position += count;
+    return true;
+  }
+
+  template<typename T>
+  bool get(T& value)
+  {
+    return getRaw(&value, sizeof(T));
+  }
+
+  uint64_t getVarint()
+  {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (position >= size) {
+        failed = true;
+        return 0;
+      }
+      unsigned char byte = data[position++];
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if (!(byte & 0x80))
+        return value;
+    }
+    failed = true;
+    return 0;
+  }
+
+  int64_t getSignedVarint()
+  {
+    uint64_t value = getVarint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+};
+
+/* \brief Maps floats from [minimum, maximum] to unsigned integers of N bits
+ *
+ * The reconstruction error is at most (maximum - minimum) / (2^N - 1) / 2.
+ */
+class Quantizer
+{
+private:
+  float minimum;
+  float step;
+  uint32_t maximumValue;
+
+public:
+  Quantizer(float rangeMinimum, float rangeMaximum, unsigned bits)
+    : minimum(rangeMinimum)
+    , maximumValue((1u << bits) - 1)
+  {
+    float range = rangeMaximum - rangeMinimum;
+    step = range > 0.0f ? range / maximumValue : 1.0f;
+  }
+
+  uint32_t quantize(float value) const
+  {
+    float normalized = std::round((value - minimum) / step);
+    return static_cast<uint32_t>(
+      std::min(std::max(normalized, 0.0f), float(maximumValue)));
+  }
+
+  float dequantize(uint32_t value) const { return minimum + value * step; }
+  float getMaximumError() const { return step * 0.5f; }
+};
+
+/* \brief Predicts the next sample of a smooth sequence from the last two
+ *
+ * Encoder and decoder run the same predictor and only the residual is stored,
+ * which stays small for trajectories moving with almost constant velocity.
+ */
+class LinearPredictor
+{
+private:
+  int64_t last = 0;
+  int64_t beforeLast = 0;
+  size_t count = 0;
+
+public:
+  int64_t predict() const
+  {
+    if (count < 2)
+      return last;
+    return 2 * last - beforeLast;
+  }
+
+  void push(int64_t value)
+  {
+    beforeLast = last;
+    last = value;
+    count++;
+  }
+};
+
+/* \brief Smallest-three quaternion packing into 32 bits
+ *
+ * The largest component is dropped (its index takes 2 bits) and the rest lie
+ * in [-1/sqrt(2), 1/sqrt(2)], quantized to 10 bits each. q and -q represent
+ * the same rotation, thus the sign is chosen so that the dropped component
+ * is positive. The three stored components are reconstructed within 0.0007,
+ * the dropped one is rebuilt as sqrt(1 - sum of their squares), thus it
+ * gathers their errors: within 0.0021 (up to 3x, as it's at least 1/2).
+ */
+const float quaternionComponentBound = 0.70710678f;
+const unsigned quaternionComponentBits = 10;
+
+inline uint32_t packQuaternion(const float rotation[4])
+{
+  size_t largest = 0;
+  for (size_t i = 1; i < 4; i++) {
+    if (std::fabs(rotation[i]) > std::fabs(rotation[largest]))
+      largest = i;
+  }
+  float sign = rotation[largest] < 0.0f ? -1.0f : 1.0f;
+  Quantizer quantizer(-quaternionComponentBound, quaternionComponentBound,
+                      quaternionComponentBits);
+  uint32_t packed = static_cast<uint32_t>(largest);
+  unsigned shift = 2;
+  for (size_t i = 0; i < 4; i++) {
+    if (i == largest)
+      continue;
+    packed |= quantizer.quantize(rotation[i] * sign) << shift;
+    shift += quaternionComponentBits;
+  }
+  return packed;
+}
+
+inline void unpackQuaternion(uint32_t packed, float rotation[4])
+{
+  Quantizer quantizer(-quaternionComponentBound, quaternionComponentBound,
+                      quaternionComponentBits);
+  size_t largest = packed & 0x3;
+  unsigned shift = 2;
+  float sum = 0.0f;
+  for (size_t i = 0; i < 4; i++) {
+    if (i == largest)
+      continue;
+    uint32_t mask = (1u << quaternionComponentBits) - 1;
+    rotation[i] = quantizer.dequantize((packed >> shift) & mask);
+    sum += rotation[i] * rotation[i];
+    shift += quaternionComponentBits;
+  }
+  rotation[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+}
+
+/// Axis-aligned bounding box of float triples
+struct Bounds
+{
+  float minimum[3] = { 0.0f, 0.0f, 0.0f };
+  float maximum[3] = { 0.0f, 0.0f, 0.0f };
+  bool isEmpty = true;
+
+  void extend(const float* point)
+  {
+    for (size_t c = 0; c < 3; c++) {
+      minimum[c] = isEmpty ? point[c] : std::min(minimum[c], point[c]);
+      maximum[c] = isEmpty ? point[c] : std::max(maximum[c], point[c]);
+    }
+    isEmpty = false;
+  }
+};
+
+} // namespace Packing
@@ -0,0 +1,128 @@
+#pragma once
+/*
+ * Corpus processing
+ * Author: Roman Romop5 Dobias
+ * Purpose: validate / index whole game directories in parallel
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "threadpool.hpp"
+
+namespace Corpus {
+
+struct FileResult
+{
+  std::string path;
+  uint64_t size;
+  bool success;
+  double seconds;      // time spent on parsing this file
+  std::string message; // error description if !success
+};
+
+struct Report
+{
+  std::vector<FileResult> files;
+  double seconds; // wall-clock time of whole run
+  uint64_t totalBytes;
+  size_t countOfFailures;
+
+  double getFilesPerSecond() const
+  {
+    return seconds > 0.0 ? files.size() / seconds : 0.0;
+  }
+  double getMegabytesPerSecond() const
+  {
+    return seconds > 0.0 ? totalBytes / seconds / (1024.0 * 1024.0) : 0.0;
+  }
+};
+
+/// Recursively lists files with given extension (case-insensitive, ".rep")
+inline std::vector<std::string> findFiles(const std::string& directory,
+                                          const std::string& extension)
+{
+  auto toLower = [](std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return text;
+  };
+  std::string wantedExtension = toLower(extension);
+  std::vector<std::string> files;
+  std::error_code error;
+  std::filesystem::recursive_directory_iterator iterator(
+    directory, std::filesystem::directory_options::skip_permission_denied,
+    error);
+  for (; !error && iterator != std::filesystem::recursive_directory_iterator();
+       iterator.increment(error)) {
+    if (iterator->is_regular_file(error) &&
+        toLower(iterator->path().extension().string()) == wantedExtension)
+      files.push_back(iterator->path().string());
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+/* \brief Parses files on the pool, one task per file
+ *
+ * load(path, message) must be callable concurrently, i.e. it has to use its
+ * own loader instance for each call. Results keep the order of files.
+ */
+template<typename LoadFunction>
+Report processFiles(const std::vector<std::string>& files,
+                    LoadFunction load,
+                    ThreadPool& pool)
+{
+  using Clock = std::chrono::steady_clock;
+  Report report;
+  report.files.resize(files.size());
+  auto start = Clock::now();
+  pool.parallelFor(files.size(), [&](size_t i) {
+    FileResult& result = report.files[i];
+    result.path = files[i];
+    std::error_code error;
+    result.size = std::filesystem::file_size(files[i], error);
+    if (error)
+      result.size = 0;
+    auto fileStart = Clock::now();
+    result.success = load(files[i], result.message);
+    result.seconds =
+      std::chrono::duration<double>(Clock::now() - fileStart).count();
+  });
+  report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  report.totalBytes = 0;
+  report.countOfFailures = 0;
+  for (const auto& result : report.files) {
+    report.totalBytes += result.size;
+    report.countOfFailures += result.success ? 0 : 1;
+  }
+  return report;
+}
+
+inline void printReport(const Report& report, std::ostream& output)
+{
+  for (const auto& result : report.files) {
+    output << (result.success ? "[OK]   " : "[FAIL] ") << result.path << " ("
+           << result.size << " B, " << std::fixed << std::setprecision(3)
+           << result.seconds * 1e3 << " ms)";
+    if (!result.success)
+      output << ": " << result.message;
+    output << std::endl;
+  }
+  output << "Files: " << report.files.size()
+         << " Failed: " << report.countOfFailures << " Bytes: "
+         << report.totalBytes << " Time: " << std::setprecision(3)
+         << report.seconds << " s" << std::endl;
+  output << "Throughput: " << std::setprecision(1)
+         << report.getFilesPerSecond() << " files/s, " << std::setprecision(2)
+         << report.getMegabytesPerSecond() << " MB/s" << std::endl;
+  output << std::defaultfloat;
+}
+
+} // namespace Corpus
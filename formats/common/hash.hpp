@@ -0,0 +1,107 @@
+#pragma once
+/*
+ * Content hashing
+ * Author: Roman Romop5 Dobias
+ * Purpose: fast 64-bit hash of file contents (cache keys, change detection)
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Hash {
+
+/* \brief XXH64 of data
+ *
+ * Non-cryptographic, runs at memory bandwidth, thus hashing a file costs
+ * about as much as reading it once.
+ */
+class Hasher
+{
+private:
+  static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+  static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+  static constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+  static constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+  static constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+  static uint64_t rotate(uint64_t value, int bits)
+  {
+    return (value << bits) | (value >> (64 - bits));
+  }
+
+  static uint64_t read64(const unsigned char* data)
+  {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  static uint32_t read32(const unsigned char* data)
+  {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  static uint64_t round(uint64_t accumulator, uint64_t input)
+  {
+    accumulator += input * prime2;
+    return rotate(accumulator, 31) * prime1;
+  }
+
+  static uint64_t merge(uint64_t hash, uint64_t accumulator)
+  {
+    hash ^= round(0, accumulator);
+    return hash * prime1 + prime4;
+  }
+
+public:
+  static uint64_t hash(const void* input, size_t size, uint64_t seed = 0)
+  {
+    const unsigned char* data = static_cast<const unsigned char*>(input);
+    const unsigned char* end = data + size;
+    uint64_t hash;
+    if (size >= 32) {
+      uint64_t lanes[4] = { seed + prime1 + prime2, seed + prime2, seed,
+                            seed - prime1 };
+      for (; end - data >= 32; data += 32) {
+        for (size_t i = 0; i < 4; i++)
+          lanes[i] = round(lanes[i], read64(data + i * 8));
+      }
+      hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) +
+             rotate(lanes[2], 12) + rotate(lanes[3], 18);
+      for (size_t i = 0; i < 4; i++)
+        hash = merge(hash, lanes[i]);
+    } else {
+      hash = seed + prime5;
+    }
+    hash += size;
+    for (; end - data >= 8; data += 8) {
+      hash ^= round(0, read64(data));
+      hash = rotate(hash, 27) * prime1 + prime4;
+    }
+    if (end - data >= 4) {
+      hash ^= uint64_t(read32(data)) * prime1;
+      hash = rotate(hash, 23) * prime2 + prime3;
+      data += 4;
+    }
+    for (; data < end; data++) {
+      hash ^= *data * prime5;
+      hash = rotate(hash, 11) * prime1;
+    }
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+};
+
+inline uint64_t hash64(const void* data, size_t size, uint64_t seed = 0)
+{
+  return Hasher::hash(data, size, seed);
+}
+
+} // namespace Hash
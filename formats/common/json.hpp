@@ -0,0 +1,65 @@
+#pragma once
+/*
+ * JSON output helpers
+ * Author: Roman Romop5 Dobias
+ * Purpose: shared escaping and load statistics output of all tools
+ */
+
+#include <cstdio>
+#include <ostream>
+#include <string>
+
+namespace Json {
+
+/// Escapes text for a JSON string, control characters become \uXXXX
+inline std::string escape(const std::string& text)
+{
+  std::string result;
+  result.reserve(text.size());
+  for (char c : text) {
+    unsigned char byte = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (byte < 0x20 || byte == 0x7F) {
+      char code[7];
+      snprintf(code, sizeof(code), "\\u%04x", unsigned(byte));
+      result += code;
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+/* \brief Prints LoadStats of any format as an opened JSON object
+ *
+ * Prints file, totals and the array of sections (getSectionName(i) names
+ * i-th section). The object is left open after the array, thus the caller
+ * can append format-specific fields and then closes it with "\n}".
+ */
+template<typename Stats, typename SectionNames>
+void printLoadStats(std::ostream& output,
+                    const std::string& fileName,
+                    const Stats& stats,
+                    size_t countOfSections,
+                    SectionNames getSectionName)
+{
+  output << "{\n  \"file\": \"" << escape(fileName) << "\",\n"
+         << "  \"fileSize\": " << stats.fileSize << ",\n"
+         << "  \"totalMs\": " << stats.seconds * 1e3 << ",\n"
+         << "  \"allocations\": " << stats.countOfAllocations << ",\n"
+         << "  \"sections\": [\n";
+  for (size_t i = 0; i < countOfSections; i++) {
+    const auto& section = stats.sections[i];
+    output << "    { \"name\": \"" << escape(getSectionName(i)) << "\""
+           << ", \"ms\": " << section.seconds * 1e3
+           << ", \"bytes\": " << section.bytes
+           << ", \"chunks\": " << section.countOfChunks
+           << ", \"allocations\": " << section.countOfAllocations << " }"
+           << (i + 1 < countOfSections ? "," : "") << "\n";
+  }
+  output << "  ]";
+}
+
+} // namespace Json
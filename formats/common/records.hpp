@@ -0,0 +1,71 @@
+#pragma once
+/*
+ * Record reader
+ * Author: Roman Romop5 Dobias
+ * Purpose: cut arbitrary fragments of a byte stream into fixed-size records
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Records {
+
+/* \brief Assembles records of requested length from fragments of a stream
+ *
+ * Records, which lie in a single fragment, are returned in place (no copy).
+ * Only records split between fragments are gathered into the internal
+ * buffer, thus the reader never holds more than a single record.
+ */
+class RecordReader
+{
+private:
+  std::vector<unsigned char> pending;
+  size_t length = 0;
+  bool isComplete = false;
+
+public:
+  /// Length of the following records, must be greater than 0
+  void expect(size_t recordLength)
+  {
+    length = recordLength;
+    pending.clear();
+    isComplete = false;
+  }
+
+  size_t getLength() const { return length; }
+
+  /// Count of bytes of the current record received so far
+  size_t getCountOfPending() const { return isComplete ? 0 : pending.size(); }
+
+  /* \brief Takes the next record from fragment
+   *
+   * Advances data / size past the consumed bytes. Returns the record, which
+   * stays valid until the next call (or until the fragment is released), or
+   * nullptr if the fragment ended before the record.
+   */
+  const unsigned char* next(const unsigned char*& data, size_t& size)
+  {
+    if (isComplete) {
+      pending.clear();
+      isComplete = false;
+    }
+    if (pending.empty() && size >= length) {
+      const unsigned char* record = data;
+      data += length;
+      size -= length;
+      return record;
+    }
+    size_t count = std::min(length - pending.size(), size);
+    pending.insert(pending.end(), data, data + count);
+    data += count;
+    size -= count;
+    if (pending.size() < length)
+      return nullptr;
+    isComplete = true;
+    return pending.data();
+  }
+};
+
+} // namespace Records
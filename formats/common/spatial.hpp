@@ -0,0 +1,267 @@
+#pragma once
+/*
+ * Spatio-temporal index
+ * Author: Roman Romop5 Dobias
+ * Purpose: find trajectories passing a region / point without sampling all
+ * tracks, shared by indices of all formats
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace Spatial {
+
+/* \brief Axis-aligned box
+ */
+struct Box
+{
+  float min[3];
+  float max[3];
+
+  /// Box containing nothing, extend() it
+  static Box createEmpty()
+  {
+    return Box{ { HUGE_VALF, HUGE_VALF, HUGE_VALF },
+                { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF } };
+  }
+
+  /// Box around sphere
+  static Box createAround(const float center[3], float radius)
+  {
+    return Box{ { center[0] - radius, center[1] - radius, center[2] - radius },
+                { center[0] + radius, center[1] + radius, center[2] + radius } };
+  }
+
+  void extend(const float point[3])
+  {
+    for (size_t c = 0; c < 3; c++) {
+      min[c] = std::min(min[c], point[c]);
+      max[c] = std::max(max[c], point[c]);
+    }
+  }
+
+  void extend(const Box& box)
+  {
+    extend(box.min);
+    extend(box.max);
+  }
+
+  bool intersects(const Box& box) const
+  {
+    for (size_t c = 0; c < 3; c++) {
+      if (box.max[c] < min[c] || box.min[c] > max[c])
+        return false;
+    }
+    return true;
+  }
+
+  bool contains(const float point[3]) const
+  {
+    for (size_t c = 0; c < 3; c++) {
+      if (point[c] < min[c] || point[c] > max[c])
+        return false;
+    }
+    return true;
+  }
+
+  float getDistanceSquared(const float point[3]) const
+  {
+    float result = 0.0f;
+    for (size_t c = 0; c < 3; c++) {
+      float delta = std::max(std::max(min[c] - point[c], point[c] - max[c]), 0.0f);
+      result += delta * delta;
+    }
+    return result;
+  }
+
+  float getCenter(size_t axis) const { return (min[axis] + max[axis]) * 0.5f; }
+};
+
+/// True if line segment from a to b touches box (slab test)
+inline bool intersectsSegment(const Box& box, const float a[3], const float b[3])
+{
+  float start = 0.0f, end = 1.0f;
+  for (size_t c = 0; c < 3; c++) {
+    float direction = b[c] - a[c];
+    if (direction == 0.0f) {
+      if (a[c] < box.min[c] || a[c] > box.max[c])
+        return false;
+      continue;
+    }
+    float first = (box.min[c] - a[c]) / direction;
+    float second = (box.max[c] - a[c]) / direction;
+    if (first > second)
+      std::swap(first, second);
+    start = std::max(start, first);
+    end = std::min(end, second);
+    if (start > end)
+      return false;
+  }
+  return true;
+}
+
+/* \brief Part of a trajectory: its bounds within time interval
+ *
+ * group, object and first / last key are up to the builder (e.g. file in
+ * corpus, object in file and keys covered by the box).
+ */
+struct Item
+{
+  Box box;
+  uint32_t startTime; // inclusive
+  uint32_t endTime;   // inclusive
+  uint32_t group;
+  uint32_t object;
+  uint32_t firstKey;
+  uint32_t lastKey;
+};
+
+/* \brief Bounding volume hierarchy over items in space and time
+ *
+ * Built top-down by median split along the axis (x, y, z or time) with the
+ * largest extent of item centers relative to the whole index, thus the tree
+ * is balanced and its depth is O(log n). Nodes are stored depth-first, the
+ * left child follows its parent.
+ *
+ * query() visits items, whose box intersects region and whose time interval
+ * overlaps [startTime, endTime], in O(log n + k) for small regions.
+ */
+class Bvh
+{
+private:
+  struct Node
+  {
+    Box box;
+    uint32_t startTime;
+    uint32_t endTime;
+    uint32_t first; // item (leaf) or right child (inner node)
+    uint32_t count; // of items, 0 for inner nodes
+  };
+
+  static const size_t maxDepth = 64;
+
+  std::vector<Node> nodes;
+  std::vector<Item> items;
+  size_t itemsPerLeaf;
+  float rootExtents[4];
+
+  static float getCenter(const Item& item, size_t axis)
+  {
+    if (axis < 3)
+      return item.box.getCenter(axis);
+    return float(item.startTime) * 0.5f + float(item.endTime) * 0.5f;
+  }
+
+  size_t buildNode(size_t first, size_t count)
+  {
+    size_t index = nodes.size();
+    nodes.push_back(Node());
+    Node node;
+    node.box = Box::createEmpty();
+    node.startTime = UINT32_MAX;
+    node.endTime = 0;
+    float minimum[4] = { HUGE_VALF, HUGE_VALF, HUGE_VALF, HUGE_VALF };
+    float maximum[4] = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+    for (size_t i = first; i < first + count; i++) {
+      node.box.extend(items[i].box);
+      node.startTime = std::min(node.startTime, items[i].startTime);
+      node.endTime = std::max(node.endTime, items[i].endTime);
+      for (size_t axis = 0; axis < 4; axis++) {
+        minimum[axis] = std::min(minimum[axis], getCenter(items[i], axis));
+        maximum[axis] = std::max(maximum[axis], getCenter(items[i], axis));
+      }
+    }
+    if (index == 0) {
+      for (size_t axis = 0; axis < 4; axis++)
+        rootExtents[axis] = std::max(maximum[axis] - minimum[axis], 1e-6f);
+    }
+
+    if (count <= itemsPerLeaf) {
+      node.first = uint32_t(first);
+      node.count = uint32_t(count);
+      nodes[index] = node;
+      return index;
+    }
+    size_t splitAxis = 0;
+    float largestExtent = -1.0f;
+    for (size_t axis = 0; axis < 4; axis++) {
+      float extent = (maximum[axis] - minimum[axis]) / rootExtents[axis];
+      if (extent > largestExtent) {
+        largestExtent = extent;
+        splitAxis = axis;
+      }
+    }
+    size_t half = count / 2;
+    std::nth_element(items.begin() + first, items.begin() + first + half,
+                     items.begin() + first + count,
+                     [splitAxis](const Item& a, const Item& b) {
+                       return getCenter(a, splitAxis) < getCenter(b, splitAxis);
+                     });
+    buildNode(first, half);
+    node.first = uint32_t(buildNode(first + half, count - half));
+    node.count = 0;
+    nodes[index] = node;
+    return index;
+  }
+
+  bool overlaps(const Node& node, const Box& region, uint32_t startTime,
+                uint32_t endTime) const
+  {
+    return node.startTime <= endTime && node.endTime >= startTime &&
+           node.box.intersects(region);
+  }
+
+public:
+  Bvh()
+    : itemsPerLeaf(4)
+  {}
+
+  explicit Bvh(std::vector<Item> indexedItems, size_t countOfItemsPerLeaf = 4)
+    : items(std::move(indexedItems))
+    , itemsPerLeaf(std::max<size_t>(countOfItemsPerLeaf, 1))
+  {
+    if (items.empty())
+      return;
+    nodes.reserve(2 * items.size() / itemsPerLeaf + 1);
+    buildNode(0, items.size());
+  }
+
+  size_t size() const { return items.size(); }
+  size_t getCountOfNodes() const { return nodes.size(); }
+  const std::vector<Item>& getItems() const { return items; }
+
+  /// Calls visit(const Item&) for each item overlapping region and time
+  template<typename Visit>
+  void query(const Box& region,
+             uint32_t startTime,
+             uint32_t endTime,
+             Visit visit) const
+  {
+    if (nodes.empty())
+      return;
+    uint32_t stack[maxDepth];
+    size_t depth = 0;
+    stack[depth++] = 0;
+    while (depth > 0) {
+      const Node& node = nodes[stack[--depth]];
+      if (!overlaps(node, region, startTime, endTime))
+        continue;
+      if (node.count > 0) {
+        for (size_t i = node.first; i < node.first + node.count; i++) {
+          const Item& item = items[i];
+          if (item.startTime <= endTime && item.endTime >= startTime &&
+              item.box.intersects(region))
+            visit(item);
+        }
+        continue;
+      }
+      // the left child follows its parent
+      stack[depth++] = node.first;
+      stack[depth++] = uint32_t(&node - nodes.data()) + 1;
+    }
+  }
+};
+
+} // namespace Spatial
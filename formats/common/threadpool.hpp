@@ -0,0 +1,225 @@
+#pragma once
+/*
+ * Work-stealing thread pool
+ * Author: Roman Romop5 Dobias
+ * Purpose: run independent parsing tasks on all cores
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* \brief Fixed-size pool of workers with per-worker task queues
+ *
+ * Each worker owns a deque: it pops its own tasks from the back (LIFO, hot in
+ * cache) and, when it runs dry, steals from the front of other workers'
+ * deques (FIFO, the oldest and usually the biggest pieces of work). Tasks
+ * submitted from a worker go to that worker's deque, tasks from other
+ * threads are distributed round-robin.
+ *
+ * wait() and parallelFor() run queued tasks on the calling thread while
+ * waiting, therefore they can be called from within a task too.
+ */
+class ThreadPool
+{
+private:
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> countOfPendingTasks;
+  std::atomic<size_t> nextQueue;
+  std::atomic<bool> shouldStop;
+  std::mutex stateMutex;
+  std::condition_variable workAvailable;
+  std::condition_variable workFinished;
+
+  static size_t& currentWorker()
+  {
+    static thread_local size_t index = SIZE_MAX;
+    return index;
+  }
+
+  bool popOwn(size_t index, std::function<void()>& task)
+  {
+    Queue& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+      return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(size_t thief, std::function<void()>& task)
+  {
+    for (size_t i = 1; i <= queues.size(); i++) {
+      Queue& queue = *queues[(thief + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool findTask(size_t index, std::function<void()>& task)
+  {
+    if (index < queues.size() && popOwn(index, task))
+      return true;
+    return steal(index < queues.size() ? index : 0, task);
+  }
+
+  void run(std::function<void()>& task)
+  {
+    task();
+    task = nullptr;
+    if (countOfPendingTasks.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      workFinished.notify_all();
+    }
+  }
+
+  void workerLoop(size_t index)
+  {
+    currentWorker() = index;
+    std::function<void()> task;
+    while (true) {
+      if (findTask(index, task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(stateMutex);
+      if (shouldStop)
+        return;
+      // recheck under the lock, submit() notifies while holding it
+      workAvailable.wait(lock, [this]() {
+        return shouldStop || hasQueuedTasks();
+      });
+    }
+  }
+
+  bool hasQueuedTasks()
+  {
+    for (auto& queue : queues) {
+      std::lock_guard<std::mutex> lock(queue->mutex);
+      if (!queue->tasks.empty())
+        return true;
+    }
+    return false;
+  }
+
+public:
+  explicit ThreadPool(size_t countOfThreads = std::thread::hardware_concurrency())
+    : countOfPendingTasks(0)
+    , nextQueue(0)
+    , shouldStop(false)
+  {
+    if (countOfThreads == 0)
+      countOfThreads = 1;
+    for (size_t i = 0; i < countOfThreads; i++)
+      queues.emplace_back(new Queue());
+    for (size_t i = 0; i < countOfThreads; i++)
+      workers.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+
+  ~ThreadPool()
+  {
+    wait();
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      shouldStop = true;
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers)
+      worker.join();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t size() const { return workers.size(); }
+
+  void submit(std::function<void()> task)
+  {
+    countOfPendingTasks++;
+    size_t index = currentWorker();
+    if (index >= queues.size())
+      index = nextQueue++ % queues.size();
+    {
+      std::lock_guard<std::mutex> lock(queues[index]->mutex);
+      queues[index]->tasks.push_back(std::move(task));
+    }
+    std::lock_guard<std::mutex> lock(stateMutex);
+    workAvailable.notify_one();
+  }
+
+  /// Helps with queued tasks until all submitted tasks are finished
+  void wait()
+  {
+    std::function<void()> task;
+    while (countOfPendingTasks > 0) {
+      if (findTask(currentWorker(), task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(stateMutex);
+      workFinished.wait_for(lock, std::chrono::milliseconds(1), [this]() {
+        return countOfPendingTasks == 0;
+      });
+    }
+  }
+
+  /* \brief Runs function(i) for i in [0, count) and waits for these tasks only
+   *
+   * The calling thread helps with queued tasks, once there are none, it
+   * blocks until the last task of this call finishes, thus it doesn't take a
+   * core from workers.
+   */
+  template<typename Function>
+  void parallelFor(size_t count, Function function)
+  {
+    size_t countOfRemaining = count;
+    std::mutex remainingMutex;
+    std::condition_variable allFinished;
+    for (size_t i = 0; i < count; i++)
+      submit([&function, &countOfRemaining, &remainingMutex, &allFinished, i]() {
+        function(i);
+        // notified under the lock, thus the waiting call can't return (and
+        // destroy the condition variable) before notify_all() is done
+        std::lock_guard<std::mutex> lock(remainingMutex);
+        if (--countOfRemaining == 0)
+          allFinished.notify_all();
+      });
+    std::function<void()> task;
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(remainingMutex);
+        if (countOfRemaining == 0)
+          return;
+      }
+      if (findTask(currentWorker(), task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(remainingMutex);
+      allFinished.wait(lock, [&countOfRemaining]() {
+        return countOfRemaining == 0;
+      });
+      return;
+    }
+  }
+};
@@ -0,0 +1,521 @@
+#pragma once
+/*
+ * .rep arena
+ * Author: Roman Romop5 Dobias
+ * Purpose: load whole .rep file into a single allocation
+ */
+
+#include <memory>
+
+#include "sampler.hpp"
+#include "view.hpp"
+
+namespace RepFile {
+
+/* \brief Location of an array inside of arena (relative to its start)
+ */
+struct ArenaRange
+{
+  uint64_t offset;
+  uint64_t count;
+};
+
+/* \brief Channels of a single transformation track inside of arena
+ *
+ * All channels except of extraPayload have the same count of elements.
+ */
+struct ArenaTrack
+{
+  TransformationHeader streamHeader;
+  ArenaRange timestamps;
+  ArenaRange types;
+  ArenaRange positions;
+  ArenaRange rotations;
+  ArenaRange auxiliary;
+  ArenaRange animationStartOffsets;
+  ArenaRange extraPayload;
+};
+
+/* \brief Directory of arena, stored at its beginning
+ *
+ * Only offsets are stored, thus the whole arena image can be copied, written
+ * to disk or mapped at any address and used as it is.
+ */
+struct ArenaDirectory
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t imageSize;
+  Header header;
+  ScriptsAndSoundsHeader eventsHeader;
+  DialogHeader dialogHeader;
+  ArenaRange animationBlocks;
+  ArenaRange animatedObjects;
+  ArenaRange tracks; // of ArenaTrack, one per animated object
+  ArenaRange cameraPositionChunks;
+  ArenaRange cameraFocusChunks;
+  ArenaRange eventsPostheaderData;
+  ArenaRange fadeChunks;
+  ArenaRange scriptChunks;
+  ArenaRange soundChunks;
+  ArenaRange dialogChunks;
+  ArenaRange narratorChunks;
+  ArenaRange morphChunks;
+};
+
+const uint32_t arenaMagicConstant = 0x41504552; // "REPA"
+const uint32_t arenaVersion = 1;
+/// Each array starts at this alignment (enough for SSE loads)
+const size_t arenaAlignment = 16;
+
+/* \brief Content of .rep file in one contiguous block of memory
+ *
+ * Loading validates header sizes against the length of file (using View),
+ * counts keys of each transformation stream and only then allocates the
+ * arena with the exact size. Sections are copied, transformation streams
+ * are decoded into struct-of-arrays channels (same rules as TransformTrack).
+ * Thus, loading costs one allocation and freeing one deallocation.
+ *
+ * All getters return spans into the arena, which are valid as long as the
+ * Arena lives and isn't reloaded.
+ */
+class Arena
+{
+private:
+  std::unique_ptr<unsigned char[]> storage;
+  const unsigned char* image;
+  size_t imageSize;
+  AnimationTable animationTable;
+
+  static size_t align(size_t size)
+  {
+    return (size + arenaAlignment - 1) & ~(arenaAlignment - 1);
+  }
+
+  template<typename T>
+  Span<const T> get(const ArenaRange& range) const
+  {
+    return Span<const T>(reinterpret_cast<const T*>(image + range.offset),
+                         static_cast<size_t>(range.count));
+  }
+
+  const ArenaDirectory& getDirectory() const
+  {
+    return *reinterpret_cast<const ArenaDirectory*>(image);
+  }
+
+  template<typename T>
+  bool isInside(const ArenaRange& range) const
+  {
+    return range.offset <= imageSize &&
+           range.count <= (imageSize - range.offset) / sizeof(T) &&
+           range.offset % alignof(T) == 0;
+  }
+
+  bool clear()
+  {
+    storage.reset();
+    image = nullptr;
+    imageSize = 0;
+    return false;
+  }
+
+  bool fail(const char* message)
+  {
+    std::cerr << "[Err] " << message << std::endl;
+    return clear();
+  }
+
+  static size_t getTrackSize(size_t countOfKeys, size_t extraSize)
+  {
+    return 4 * align(countOfKeys * sizeof(uint32_t)) +
+           align(countOfKeys * sizeof(Position)) +
+           align(countOfKeys * sizeof(Rotation)) + align(extraSize);
+  }
+
+  /// Reserves space for count elements of T at the end of arena
+  template<typename T>
+  static ArenaRange allocate(size_t& offset, size_t count)
+  {
+    ArenaRange range{ offset, count };
+    offset += align(count * sizeof(T));
+    return range;
+  }
+
+  template<typename T>
+  ArenaRange copy(unsigned char* base, size_t& offset, Span<const T> source)
+  {
+    ArenaRange range = allocate<T>(offset, source.size());
+    if (!source.empty())
+      memcpy(base + range.offset, source.data(), source.size() * sizeof(T));
+    return range;
+  }
+
+  void decodeStream(unsigned char* base,
+                    size_t& offset,
+                    Span<const unsigned char> stream,
+                    const AnimatedObjectDefinitions& object,
+                    ArenaTrack& track)
+  {
+    size_t countOfKeys = 0, extraSize = 0;
+    scanObjectStream(stream, object, countOfKeys, extraSize);
+    memcpy(&track.streamHeader, stream.data(), sizeof(track.streamHeader));
+    track.timestamps = allocate<uint32_t>(offset, countOfKeys);
+    track.types = allocate<uint32_t>(offset, countOfKeys);
+    track.positions = allocate<Position>(offset, countOfKeys);
+    track.rotations = allocate<Rotation>(offset, countOfKeys);
+    track.auxiliary = allocate<uint32_t>(offset, countOfKeys);
+    track.animationStartOffsets = allocate<uint32_t>(offset, countOfKeys);
+    track.extraPayload = allocate<unsigned char>(offset, extraSize);
+
+    auto* timestamps = reinterpret_cast<uint32_t*>(base + track.timestamps.offset);
+    auto* types = reinterpret_cast<uint32_t*>(base + track.types.offset);
+    auto* positions = reinterpret_cast<Position*>(base + track.positions.offset);
+    auto* rotations = reinterpret_cast<Rotation*>(base + track.rotations.offset);
+    auto* auxiliary = reinterpret_cast<uint32_t*>(base + track.auxiliary.offset);
+    auto* offsets =
+      reinterpret_cast<uint32_t*>(base + track.animationStartOffsets.offset);
+    unsigned char* extra = base + track.extraPayload.offset;
+
+    TransformPayload body;
+    memset(&body, 0, sizeof(body));
+    size_t key = 0;
+    ChunkDecoders::decodeStream(
+      stream.data(), stream.size(), object.sizeOfBlocks,
+      [&](size_t, const TransformationHeader& header,
+          const unsigned char* payload, auto payloadLength) {
+        size_t bodyLength =
+          std::min<size_t>(payloadLength, sizeof(TransformPayload));
+        // short chunks inherit position / rotation of the previous key
+        body.auxiliary = 0;
+        body.animationStartOffset = 0;
+        memcpy(&body, payload, bodyLength);
+        memcpy(extra, payload + bodyLength, payloadLength - bodyLength);
+        extra += payloadLength - bodyLength;
+
+        timestamps[key] = header.timestamp;
+        types[key] = header.type;
+        memcpy(positions[key].data(), body.position, sizeof(body.position));
+        memcpy(rotations[key].data(), body.rotation, sizeof(body.rotation));
+        auxiliary[key] = body.auxiliary;
+        offsets[key] = body.animationStartOffset;
+        key++;
+      });
+  }
+
+  bool build(const View& view)
+  {
+    auto objects = view.getAnimatedObjects();
+    size_t size = align(sizeof(ArenaDirectory)) +
+                  align(objects.size() * sizeof(ArenaTrack));
+    size += align(view.getAnimationBlocks().size() * sizeof(AnimationBlock));
+    size += align(objects.size() * sizeof(AnimatedObjectDefinitions));
+    for (size_t i = 0; i < objects.size(); i++) {
+      size_t countOfKeys = 0, extraSize = 0;
+      if (!scanObjectStream(view.getObjectStream(i), objects[i], countOfKeys,
+                            extraSize))
+        return fail("Invalid chunk in transformation stream");
+      size += getTrackSize(countOfKeys, extraSize);
+    }
+    size += align(view.getCameraPositionChunks().size() *
+                  sizeof(CameraTransformationChunk));
+    size += align(view.getCameraFocusChunks().size() * sizeof(CameraFocusChunk));
+    size += align(view.getEventsHeader().sizeOfPostheaderData);
+    size += align(view.getFadeChunks().size() * sizeof(FadeChunk));
+    size += align(view.getScriptChunks().size() * sizeof(ScriptChunk));
+    size += align(view.getSoundChunks().size() * sizeof(SoundChunk));
+    size += align(view.getDialogChunks().size() * sizeof(DialogChunk));
+    size += align(view.getNarratorChunks().size() * sizeof(NarratorChunk));
+    size += align(view.getMorphChunks().size() * sizeof(MorphChunk));
+
+    // value-initialized, thus alignment gaps are zeroed
+    storage.reset(new unsigned char[size]());
+    unsigned char* base = storage.get();
+    image = base;
+    imageSize = size;
+
+    ArenaDirectory directory;
+    memset(&directory, 0, sizeof(directory));
+    directory.magic = arenaMagicConstant;
+    directory.version = arenaVersion;
+    directory.imageSize = size;
+    directory.header = view.getHeader();
+    directory.eventsHeader = view.getEventsHeader();
+    directory.dialogHeader = view.getDialogHeader();
+
+    size_t offset = align(sizeof(ArenaDirectory));
+    directory.tracks = allocate<ArenaTrack>(offset, objects.size());
+    directory.animationBlocks = copy(base, offset, view.getAnimationBlocks());
+    directory.animatedObjects = copy(base, offset, objects);
+    auto* tracks = reinterpret_cast<ArenaTrack*>(base + directory.tracks.offset);
+    for (size_t i = 0; i < objects.size(); i++)
+      decodeStream(base, offset, view.getObjectStream(i), objects[i], tracks[i]);
+    directory.cameraPositionChunks =
+      copy(base, offset, view.getCameraPositionChunks());
+    directory.cameraFocusChunks = copy(base, offset, view.getCameraFocusChunks());
+    directory.eventsPostheaderData =
+      copy(base, offset, view.getEventsPostheaderData());
+    directory.fadeChunks = copy(base, offset, view.getFadeChunks());
+    directory.scriptChunks = copy(base, offset, view.getScriptChunks());
+    directory.soundChunks = copy(base, offset, view.getSoundChunks());
+    directory.dialogChunks = copy(base, offset, view.getDialogChunks());
+    directory.narratorChunks = copy(base, offset, view.getNarratorChunks());
+    directory.morphChunks = copy(base, offset, view.getMorphChunks());
+    memcpy(base, &directory, sizeof(directory));
+    updateAnimationTable();
+    return true;
+  }
+
+  bool validate()
+  {
+    if (imageSize < sizeof(ArenaDirectory))
+      return fail("Arena image is too short");
+    const ArenaDirectory& directory = getDirectory();
+    if (directory.magic != arenaMagicConstant ||
+        directory.version != arenaVersion || directory.imageSize != imageSize)
+      return fail("Arena image has incompatible version");
+    if (!isInside<AnimationBlock>(directory.animationBlocks) ||
+        !isInside<AnimatedObjectDefinitions>(directory.animatedObjects) ||
+        !isInside<ArenaTrack>(directory.tracks) ||
+        directory.tracks.count != directory.animatedObjects.count ||
+        !isInside<CameraTransformationChunk>(directory.cameraPositionChunks) ||
+        !isInside<CameraFocusChunk>(directory.cameraFocusChunks) ||
+        !isInside<unsigned char>(directory.eventsPostheaderData) ||
+        !isInside<FadeChunk>(directory.fadeChunks) ||
+        !isInside<ScriptChunk>(directory.scriptChunks) ||
+        !isInside<SoundChunk>(directory.soundChunks) ||
+        !isInside<DialogChunk>(directory.dialogChunks) ||
+        !isInside<NarratorChunk>(directory.narratorChunks) ||
+        !isInside<MorphChunk>(directory.morphChunks))
+      return fail("Arena section exceeds image");
+    for (const auto& track : get<ArenaTrack>(directory.tracks)) {
+      uint64_t count = track.timestamps.count;
+      if (!isInside<uint32_t>(track.timestamps) ||
+          !isInside<uint32_t>(track.types) ||
+          !isInside<Position>(track.positions) ||
+          !isInside<Rotation>(track.rotations) ||
+          !isInside<uint32_t>(track.auxiliary) ||
+          !isInside<uint32_t>(track.animationStartOffsets) ||
+          !isInside<unsigned char>(track.extraPayload) ||
+          track.types.count != count || track.positions.count != count ||
+          track.rotations.count != count || track.auxiliary.count != count ||
+          track.animationStartOffsets.count != count)
+        return fail("Arena track exceeds image");
+    }
+    updateAnimationTable();
+    return true;
+  }
+
+  void updateAnimationTable()
+  {
+    auto blocks = getAnimationBlocks();
+    animationTable = AnimationTable(blocks.data(), blocks.size());
+  }
+
+public:
+  Arena()
+    : image(nullptr)
+    , imageSize(0)
+  {}
+
+  /// The source is left empty (isValid() is false)
+  Arena(Arena&& other)
+    : storage(std::move(other.storage))
+    , image(other.image)
+    , imageSize(other.imageSize)
+    , animationTable(std::move(other.animationTable))
+  {
+    other.image = nullptr;
+    other.imageSize = 0;
+    other.animationTable = AnimationTable();
+  }
+
+  Arena& operator=(Arena&& other)
+  {
+    if (this != &other) {
+      storage = std::move(other.storage);
+      image = other.image;
+      imageSize = other.imageSize;
+      animationTable = std::move(other.animationTable);
+      other.image = nullptr;
+      other.imageSize = 0;
+      other.animationTable = AnimationTable();
+    }
+    return *this;
+  }
+
+  /// Loads .rep file, returns false (and reports an error) for invalid files
+  bool loadFile(const std::string& fileName)
+  {
+    View view;
+    if (!view.open(fileName))
+      return clear();
+    return build(view);
+  }
+
+  /// Loads .rep file already stored in memory
+  bool load(const void* data, size_t size)
+  {
+    View view;
+    if (!view.open(data, size))
+      return clear();
+    return build(view);
+  }
+
+  /* \brief Uses arena image (see getImage()) stored elsewhere
+   *
+   * The image is validated, but not copied, thus it must outlive the Arena
+   * and be aligned to arenaAlignment (as is e.g. memory mapping).
+   */
+  bool openImage(const void* data, size_t size)
+  {
+    storage.reset();
+    image = static_cast<const unsigned char*>(data);
+    imageSize = size;
+    if (reinterpret_cast<uintptr_t>(data) % arenaAlignment != 0)
+      return fail("Arena image is not aligned");
+    return validate();
+  }
+
+  bool isValid() const { return image != nullptr; }
+
+  /// Relocatable image of arena, which can be stored and opened later
+  Span<const unsigned char> getImage() const
+  {
+    return Span<const unsigned char>(image, imageSize);
+  }
+
+  const Header& getHeader() const { return getDirectory().header; }
+  Span<const AnimationBlock> getAnimationBlocks() const
+  {
+    return get<AnimationBlock>(getDirectory().animationBlocks);
+  }
+  Span<const AnimatedObjectDefinitions> getAnimatedObjects() const
+  {
+    return get<AnimatedObjectDefinitions>(getDirectory().animatedObjects);
+  }
+  const AnimationTable& getAnimationTable() const { return animationTable; }
+
+  size_t getCountOfObjects() const
+  {
+    return static_cast<size_t>(getDirectory().tracks.count);
+  }
+  const TransformationHeader& getStreamHeader(size_t objectIndex) const
+  {
+    return get<ArenaTrack>(getDirectory().tracks)[objectIndex].streamHeader;
+  }
+  Span<const uint32_t> getTypes(size_t objectIndex) const
+  {
+    return get<uint32_t>(get<ArenaTrack>(getDirectory().tracks)[objectIndex].types);
+  }
+  Span<const unsigned char> getExtraPayload(size_t objectIndex) const
+  {
+    return get<unsigned char>(
+      get<ArenaTrack>(getDirectory().tracks)[objectIndex].extraPayload);
+  }
+  TrackView getTrack(size_t objectIndex) const
+  {
+    const ArenaTrack& track = get<ArenaTrack>(getDirectory().tracks)[objectIndex];
+    TrackView view;
+    view.timestamps = get<uint32_t>(track.timestamps);
+    view.positions = get<Position>(track.positions);
+    view.rotations = get<Rotation>(track.rotations);
+    view.auxiliary = get<uint32_t>(track.auxiliary);
+    view.animationStartOffsets = get<uint32_t>(track.animationStartOffsets);
+    return view;
+  }
+  /// Views of all tracks, e.g. for Sampler
+  std::vector<TrackView> getTracks() const
+  {
+    std::vector<TrackView> views;
+    views.reserve(getCountOfObjects());
+    for (size_t i = 0; i < getCountOfObjects(); i++)
+      views.push_back(getTrack(i));
+    return views;
+  }
+
+  Span<const CameraTransformationChunk> getCameraPositionChunks() const
+  {
+    return get<CameraTransformationChunk>(getDirectory().cameraPositionChunks);
+  }
+  Span<const CameraFocusChunk> getCameraFocusChunks() const
+  {
+    return get<CameraFocusChunk>(getDirectory().cameraFocusChunks);
+  }
+  const ScriptsAndSoundsHeader& getEventsHeader() const
+  {
+    return getDirectory().eventsHeader;
+  }
+  Span<const unsigned char> getEventsPostheaderData() const
+  {
+    return get<unsigned char>(getDirectory().eventsPostheaderData);
+  }
+  Span<const FadeChunk> getFadeChunks() const
+  {
+    return get<FadeChunk>(getDirectory().fadeChunks);
+  }
+  Span<const ScriptChunk> getScriptChunks() const
+  {
+    return get<ScriptChunk>(getDirectory().scriptChunks);
+  }
+  Span<const SoundChunk> getSoundChunks() const
+  {
+    return get<SoundChunk>(getDirectory().soundChunks);
+  }
+  const DialogHeader& getDialogHeader() const
+  {
+    return getDirectory().dialogHeader;
+  }
+  Span<const DialogChunk> getDialogChunks() const
+  {
+    return get<DialogChunk>(getDirectory().dialogChunks);
+  }
+  Span<const NarratorChunk> getNarratorChunks() const
+  {
+    return get<NarratorChunk>(getDirectory().narratorChunks);
+  }
+  Span<const MorphChunk> getMorphChunks() const
+  {
+    return get<MorphChunk>(getDirectory().morphChunks);
+  }
+
+  /// Copies content into File (e.g. to modify and store it)
+  File createFile() const
+  {
+    File file;
+    file.header = getHeader();
+    auto assign = [](auto& vector, auto span) {
+      vector.assign(span.begin(), span.end());
+    };
+    assign(file.animationBlocks, getAnimationBlocks());
+    assign(file.animatedObjects, getAnimatedObjects());
+    file.transformTracks.resize(getCountOfObjects());
+    for (size_t i = 0; i < getCountOfObjects(); i++) {
+      auto& track = file.transformTracks[i];
+      TrackView view = getTrack(i);
+      track.streamHeader = getStreamHeader(i);
+      assign(track.timestamps, view.timestamps);
+      assign(track.types, getTypes(i));
+      assign(track.positions, view.positions);
+      assign(track.rotations, view.rotations);
+      assign(track.auxiliary, view.auxiliary);
+      assign(track.animationStartOffsets, view.animationStartOffsets);
+      assign(track.extraPayload, getExtraPayload(i));
+    }
+    assign(file.cameraPositionChunks, getCameraPositionChunks());
+    assign(file.camerafocusChunks, getCameraFocusChunks());
+    file.eventsHeader = getEventsHeader();
+    assign(file.eventsPostheaderData, getEventsPostheaderData());
+    assign(file.fadeChunks, getFadeChunks());
+    assign(file.scriptChunks, getScriptChunks());
+    assign(file.soundChunks, getSoundChunks());
+    file.dialogHeader = getDialogHeader();
+    assign(file.dialogChunks, getDialogChunks());
+    assign(file.narratorChunks, getNarratorChunks());
+    assign(file.morphChunks, getMorphChunks());
+    file.animationTable = animationTable;
+    return file;
+  }
+};
+
+} // namespace RepFile
@@ -0,0 +1,453 @@
+#pragma once
+/*
+ * .rep batch pose evaluator
+ * Author: Roman Romop5 Dobias
+ * Purpose: evaluate all animated objects at once using SIMD
+ */
+
+#include "sampler.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace RepFile {
+
+enum RotationInterpolation
+{
+  ROTATION_NLERP = 0, // normalized lerp, cheap and vectorized completely
+  ROTATION_SLERP = 1  // exact, weights use vectorized acos / sin
+};
+
+/* \brief SIMD kernels working over lanes of struct-of-arrays
+ *
+ * Each kernel processes as many lanes as possible with the widest available
+ * instruction set (AVX2, SSE2) and the rest with scalar code.
+ */
+namespace Kernels {
+
+/// out = a + (b - a) * alpha
+inline void lerp(const float* a,
+                 const float* b,
+                 const float* alpha,
+                 float* out,
+                 size_t count)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= count; i += 8) {
+    __m256 va = _mm256_loadu_ps(a + i);
+    __m256 delta = _mm256_sub_ps(_mm256_loadu_ps(b + i), va);
+    __m256 result =
+      _mm256_add_ps(va, _mm256_mul_ps(delta, _mm256_loadu_ps(alpha + i)));
+    _mm256_storeu_ps(out + i, result);
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 4 <= count; i += 4) {
+    __m128 va = _mm_loadu_ps(a + i);
+    __m128 delta = _mm_sub_ps(_mm_loadu_ps(b + i), va);
+    __m128 result = _mm_add_ps(va, _mm_mul_ps(delta, _mm_loadu_ps(alpha + i)));
+    _mm_storeu_ps(out + i, result);
+  }
+#endif
+  for (; i < count; i++)
+    out[i] = a[i] + (b[i] - a[i]) * alpha[i];
+}
+
+/// Weights of normalized lerp along the shortest arc
+inline void nlerpWeights(const float* const a[4],
+                         const float* const b[4],
+                         const float* alpha,
+                         float* weightA,
+                         float* weightB,
+                         size_t count)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256 one8 = _mm256_set1_ps(1.0f);
+  const __m256 signMask8 = _mm256_set1_ps(-0.0f);
+  for (; i + 8 <= count; i += 8) {
+    __m256 dot = _mm256_setzero_ps();
+    for (size_t c = 0; c < 4; c++)
+      dot = _mm256_add_ps(
+        dot, _mm256_mul_ps(_mm256_loadu_ps(a[c] + i), _mm256_loadu_ps(b[c] + i)));
+    __m256 va = _mm256_loadu_ps(alpha + i);
+    // move sign of dot to weightB
+    __m256 sign = _mm256_and_ps(dot, signMask8);
+    _mm256_storeu_ps(weightA + i, _mm256_sub_ps(one8, va));
+    _mm256_storeu_ps(weightB + i, _mm256_xor_ps(va, sign));
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128 one4 = _mm_set1_ps(1.0f);
+  const __m128 signMask4 = _mm_set1_ps(-0.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 dot = _mm_setzero_ps();
+    for (size_t c = 0; c < 4; c++)
+      dot = _mm_add_ps(dot,
+                       _mm_mul_ps(_mm_loadu_ps(a[c] + i), _mm_loadu_ps(b[c] + i)));
+    __m128 va = _mm_loadu_ps(alpha + i);
+    __m128 sign = _mm_and_ps(dot, signMask4);
+    _mm_storeu_ps(weightA + i, _mm_sub_ps(one4, va));
+    _mm_storeu_ps(weightB + i, _mm_xor_ps(va, sign));
+  }
+#endif
+  for (; i < count; i++) {
+    float dot = a[0][i] * b[0][i] + a[1][i] * b[1][i] + a[2][i] * b[2][i] +
+                a[3][i] * b[3][i];
+    weightA[i] = 1.0f - alpha[i];
+    weightB[i] = dot < 0.0f ? -alpha[i] : alpha[i];
+  }
+}
+
+/* \brief Polynomial approximations used by slerpWeights()
+ *
+ * acos() is Abramowitz & Stegun 4.4.46 (absolute error below 2e-8 on
+ * [0, 1]), sin() is Taylor series up to x^11 (error below 6e-8 on
+ * [0, pi / 2]). Scalar versions are used for the remaining lanes, thus all
+ * lanes get the same results.
+ */
+namespace Approximation {
+
+const float acosCoefficients[8] = { 1.5707963050f,  -0.2145988016f,
+                                    0.0889789874f,  -0.0501743046f,
+                                    0.0308918810f,  -0.0170881256f,
+                                    0.0066700901f,  -0.0012624911f };
+const float sinCoefficients[5] = { -1.0f / 6.0f, 1.0f / 120.0f,
+                                   -1.0f / 5040.0f, 1.0f / 362880.0f,
+                                   -1.0f / 39916800.0f };
+
+/// acos(x) for x in [0, 1]
+inline float acos(float x)
+{
+  float result = acosCoefficients[7];
+  for (int i = 6; i >= 0; i--)
+    result = result * x + acosCoefficients[i];
+  return std::sqrt(1.0f - x) * result;
+}
+
+/// sin(x) for x in [0, pi / 2]
+inline float sin(float x)
+{
+  float x2 = x * x;
+  float result = sinCoefficients[4];
+  for (int i = 3; i >= 0; i--)
+    result = result * x2 + sinCoefficients[i];
+  return x + x * x2 * result;
+}
+
+#if defined(__AVX2__)
+inline __m256 acos(__m256 x)
+{
+  __m256 result = _mm256_set1_ps(acosCoefficients[7]);
+  for (int i = 6; i >= 0; i--)
+    result = _mm256_add_ps(_mm256_mul_ps(result, x),
+                           _mm256_set1_ps(acosCoefficients[i]));
+  return _mm256_mul_ps(_mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), x)),
+                       result);
+}
+
+inline __m256 sin(__m256 x)
+{
+  __m256 x2 = _mm256_mul_ps(x, x);
+  __m256 result = _mm256_set1_ps(sinCoefficients[4]);
+  for (int i = 3; i >= 0; i--)
+    result = _mm256_add_ps(_mm256_mul_ps(result, x2),
+                           _mm256_set1_ps(sinCoefficients[i]));
+  return _mm256_add_ps(x, _mm256_mul_ps(_mm256_mul_ps(x, x2), result));
+}
+#endif
+
+#if defined(__SSE2__)
+inline __m128 acos(__m128 x)
+{
+  __m128 result = _mm_set1_ps(acosCoefficients[7]);
+  for (int i = 6; i >= 0; i--)
+    result =
+      _mm_add_ps(_mm_mul_ps(result, x), _mm_set1_ps(acosCoefficients[i]));
+  return _mm_mul_ps(_mm_sqrt_ps(_mm_sub_ps(_mm_set1_ps(1.0f), x)), result);
+}
+
+inline __m128 sin(__m128 x)
+{
+  __m128 x2 = _mm_mul_ps(x, x);
+  __m128 result = _mm_set1_ps(sinCoefficients[4]);
+  for (int i = 3; i >= 0; i--)
+    result = _mm_add_ps(_mm_mul_ps(result, x2), _mm_set1_ps(sinCoefficients[i]));
+  return _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(x, x2), result));
+}
+#endif
+
+} // namespace Approximation
+
+/* \brief Weights of slerp along the shortest arc, as slerp() of Sampler
+ *
+ * Almost identical rotations (|dot| >= 0.9995) fall back to linear weights.
+ * As dot is made non-negative, the angle is within [0, pi / 2] and so are the
+ * arguments of sin().
+ */
+inline void slerpWeights(const float* const a[4],
+                         const float* const b[4],
+                         const float* alpha,
+                         float* weightA,
+                         float* weightB,
+                         size_t count)
+{
+  const float threshold = 0.9995f;
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256 one8 = _mm256_set1_ps(1.0f);
+  const __m256 signMask8 = _mm256_set1_ps(-0.0f);
+  for (; i + 8 <= count; i += 8) {
+    __m256 dot = _mm256_setzero_ps();
+    for (size_t c = 0; c < 4; c++)
+      dot = _mm256_add_ps(
+        dot, _mm256_mul_ps(_mm256_loadu_ps(a[c] + i), _mm256_loadu_ps(b[c] + i)));
+    __m256 sign = _mm256_and_ps(dot, signMask8);
+    dot = _mm256_min_ps(_mm256_andnot_ps(signMask8, dot), one8);
+    __m256 vb = _mm256_loadu_ps(alpha + i);
+    __m256 va = _mm256_sub_ps(one8, vb);
+    __m256 angle = Approximation::acos(dot);
+    // lanes with tiny angle divide by ~0 here, but they take linear weights
+    __m256 inverseSin = _mm256_div_ps(one8, Approximation::sin(angle));
+    __m256 sa = _mm256_mul_ps(Approximation::sin(_mm256_mul_ps(va, angle)), inverseSin);
+    __m256 sb = _mm256_mul_ps(Approximation::sin(_mm256_mul_ps(vb, angle)), inverseSin);
+    __m256 isLinear = _mm256_cmp_ps(dot, _mm256_set1_ps(threshold), _CMP_GE_OQ);
+    _mm256_storeu_ps(weightA + i, _mm256_blendv_ps(sa, va, isLinear));
+    _mm256_storeu_ps(weightB + i,
+                     _mm256_xor_ps(_mm256_blendv_ps(sb, vb, isLinear), sign));
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128 one4 = _mm_set1_ps(1.0f);
+  const __m128 signMask4 = _mm_set1_ps(-0.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 dot = _mm_setzero_ps();
+    for (size_t c = 0; c < 4; c++)
+      dot = _mm_add_ps(dot,
+                       _mm_mul_ps(_mm_loadu_ps(a[c] + i), _mm_loadu_ps(b[c] + i)));
+    __m128 sign = _mm_and_ps(dot, signMask4);
+    dot = _mm_min_ps(_mm_andnot_ps(signMask4, dot), one4);
+    __m128 vb = _mm_loadu_ps(alpha + i);
+    __m128 va = _mm_sub_ps(one4, vb);
+    __m128 angle = Approximation::acos(dot);
+    __m128 inverseSin = _mm_div_ps(one4, Approximation::sin(angle));
+    __m128 sa = _mm_mul_ps(Approximation::sin(_mm_mul_ps(va, angle)), inverseSin);
+    __m128 sb = _mm_mul_ps(Approximation::sin(_mm_mul_ps(vb, angle)), inverseSin);
+    __m128 isLinear = _mm_cmpge_ps(dot, _mm_set1_ps(threshold));
+    // SSE2 has no blend, select by masks
+    __m128 resultA = _mm_or_ps(_mm_and_ps(isLinear, va), _mm_andnot_ps(isLinear, sa));
+    __m128 resultB = _mm_or_ps(_mm_and_ps(isLinear, vb), _mm_andnot_ps(isLinear, sb));
+    _mm_storeu_ps(weightA + i, resultA);
+    _mm_storeu_ps(weightB + i, _mm_xor_ps(resultB, sign));
+  }
+#endif
+  for (; i < count; i++) {
+    float dot = a[0][i] * b[0][i] + a[1][i] * b[1][i] + a[2][i] * b[2][i] +
+                a[3][i] * b[3][i];
+    float sign = dot < 0.0f ? -1.0f : 1.0f;
+    dot = std::min(dot * sign, 1.0f);
+    float wa = 1.0f - alpha[i];
+    float wb = alpha[i];
+    if (dot < threshold) {
+      float angle = Approximation::acos(dot);
+      float inverseSin = 1.0f / Approximation::sin(angle);
+      wa = Approximation::sin(wa * angle) * inverseSin;
+      wb = Approximation::sin(wb * angle) * inverseSin;
+    }
+    weightA[i] = wa;
+    weightB[i] = wb * sign;
+  }
+}
+
+/// out = normalize(a * weightA + b * weightB) for 4-component lanes
+inline void blendNormalized(const float* const a[4],
+                            const float* const b[4],
+                            const float* weightA,
+                            const float* weightB,
+                            float* const out[4],
+                            size_t count)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= count; i += 8) {
+    __m256 wa = _mm256_loadu_ps(weightA + i);
+    __m256 wb = _mm256_loadu_ps(weightB + i);
+    __m256 r[4];
+    __m256 length = _mm256_setzero_ps();
+    for (size_t c = 0; c < 4; c++) {
+      r[c] = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(a[c] + i), wa),
+                           _mm256_mul_ps(_mm256_loadu_ps(b[c] + i), wb));
+      length = _mm256_add_ps(length, _mm256_mul_ps(r[c], r[c]));
+    }
+    // zero-length blends stay zero as in slerp() of Sampler
+    __m256 scale = _mm256_and_ps(
+      _mm256_cmp_ps(length, _mm256_setzero_ps(), _CMP_GT_OQ),
+      _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(length)));
+    for (size_t c = 0; c < 4; c++)
+      _mm256_storeu_ps(out[c] + i, _mm256_mul_ps(r[c], scale));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 4 <= count; i += 4) {
+    __m128 wa = _mm_loadu_ps(weightA + i);
+    __m128 wb = _mm_loadu_ps(weightB + i);
+    __m128 r[4];
+    __m128 length = _mm_setzero_ps();
+    for (size_t c = 0; c < 4; c++) {
+      r[c] = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a[c] + i), wa),
+                        _mm_mul_ps(_mm_loadu_ps(b[c] + i), wb));
+      length = _mm_add_ps(length, _mm_mul_ps(r[c], r[c]));
+    }
+    __m128 scale =
+      _mm_and_ps(_mm_cmpgt_ps(length, _mm_setzero_ps()),
+                 _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(length)));
+    for (size_t c = 0; c < 4; c++)
+      _mm_storeu_ps(out[c] + i, _mm_mul_ps(r[c], scale));
+  }
+#endif
+  for (; i < count; i++) {
+    float r[4];
+    float length = 0.0f;
+    for (size_t c = 0; c < 4; c++) {
+      r[c] = a[c][i] * weightA[i] + b[c][i] * weightB[i];
+      length += r[c] * r[c];
+    }
+    float scale = length > 0.0f ? 1.0f / std::sqrt(length) : 0.0f;
+    for (size_t c = 0; c < 4; c++)
+      out[c][i] = r[c] * scale;
+  }
+}
+
+} // namespace Kernels
+
+/* \brief Evaluates positions and rotations of all objects in one pass
+ *
+ * Surrounding keys of each object are found with Sampler::Cursor and
+ * gathered into struct-of-arrays lanes (one lane per object). The
+ * interpolation itself then runs over all lanes with SIMD kernels and results
+ * are scattered into caller's buffers.
+ *
+ * Objects without keys get zero position and identity rotation.
+ */
+class BatchEvaluator
+{
+private:
+  enum Lane
+  {
+    POSITION_A = 0, // x, y, z
+    POSITION_B = 3,
+    ROTATION_A = 6, // 4 components
+    ROTATION_B = 10,
+    ALPHA = 14,
+    WEIGHT_A = 15,
+    WEIGHT_B = 16,
+    RESULT_POSITION = 17,
+    RESULT_ROTATION = 20,
+    COUNT_OF_LANES = 24
+  };
+
+  Sampler::Cursor cursor;
+  RotationInterpolation rotationInterpolation;
+  size_t countOfObjects;
+  std::vector<float> lanes;
+
+  float* lane(size_t index) { return lanes.data() + index * countOfObjects; }
+
+  void gather(uint32_t timeMs)
+  {
+    const Sampler& sampler = cursor.getSampler();
+    for (size_t i = 0; i < countOfObjects; i++) {
+      const TrackView& track = sampler.getTrack(i);
+      if (track.size() == 0) {
+        for (size_t c = 0; c < 3; c++) {
+          lane(POSITION_A + c)[i] = 0.0f;
+          lane(POSITION_B + c)[i] = 0.0f;
+        }
+        for (size_t c = 0; c < 4; c++) {
+          lane(ROTATION_A + c)[i] = c == 0 ? 1.0f : 0.0f;
+          lane(ROTATION_B + c)[i] = c == 0 ? 1.0f : 0.0f;
+        }
+        lane(ALPHA)[i] = 0.0f;
+        continue;
+      }
+
+      size_t key = cursor.findKey(i, timeMs);
+      size_t next = key;
+      float alpha = 0.0f;
+      uint32_t keyTime = track.timestamps[key];
+      if ((track.auxiliary[key] & ANIMATION_SHOULD_INTERPOLATE) &&
+          key + 1 < track.size() && timeMs > keyTime) {
+        next = key + 1;
+        uint32_t duration = track.timestamps[next] - keyTime;
+        alpha = duration > 0
+                  ? std::min(1.0f, float(timeMs - keyTime) / duration)
+                  : 1.0f;
+      }
+      const Position& positionA = track.positions[key];
+      const Position& positionB = track.positions[next];
+      for (size_t c = 0; c < 3; c++) {
+        lane(POSITION_A + c)[i] = positionA[c];
+        lane(POSITION_B + c)[i] = positionB[c];
+      }
+      const Rotation& rotationA = track.rotations[key];
+      const Rotation& rotationB = track.rotations[next];
+      for (size_t c = 0; c < 4; c++) {
+        lane(ROTATION_A + c)[i] = rotationA[c];
+        lane(ROTATION_B + c)[i] = rotationB[c];
+      }
+      lane(ALPHA)[i] = alpha;
+    }
+  }
+
+public:
+  explicit BatchEvaluator(const Sampler& sampler,
+                          RotationInterpolation interpolation = ROTATION_NLERP)
+    : cursor(sampler)
+    , rotationInterpolation(interpolation)
+    , countOfObjects(sampler.getCountOfObjects())
+    , lanes(COUNT_OF_LANES * sampler.getCountOfObjects())
+  {}
+
+  size_t getCountOfObjects() const { return countOfObjects; }
+
+  /// Writes pose of i-th object into positions[i] and rotations[i]
+  void evaluate(uint32_t timeMs, Position* positions, Rotation* rotations)
+  {
+    gather(timeMs);
+
+    const float* alpha = lane(ALPHA);
+    for (size_t c = 0; c < 3; c++)
+      Kernels::lerp(lane(POSITION_A + c), lane(POSITION_B + c), alpha,
+                    lane(RESULT_POSITION + c), countOfObjects);
+
+    const float* const rotationA[4] = { lane(ROTATION_A), lane(ROTATION_A + 1),
+                                        lane(ROTATION_A + 2),
+                                        lane(ROTATION_A + 3) };
+    const float* const rotationB[4] = { lane(ROTATION_B), lane(ROTATION_B + 1),
+                                        lane(ROTATION_B + 2),
+                                        lane(ROTATION_B + 3) };
+    float* const result[4] = { lane(RESULT_ROTATION), lane(RESULT_ROTATION + 1),
+                               lane(RESULT_ROTATION + 2),
+                               lane(RESULT_ROTATION + 3) };
+    if (rotationInterpolation == ROTATION_SLERP)
+      Kernels::slerpWeights(rotationA, rotationB, alpha, lane(WEIGHT_A),
+                            lane(WEIGHT_B), countOfObjects);
+    else
+      Kernels::nlerpWeights(rotationA, rotationB, alpha, lane(WEIGHT_A),
+                            lane(WEIGHT_B), countOfObjects);
+    Kernels::blendNormalized(rotationA, rotationB, lane(WEIGHT_A),
+                             lane(WEIGHT_B), result, countOfObjects);
+
+    for (size_t i = 0; i < countOfObjects; i++) {
+      for (size_t c = 0; c < 3; c++)
+        positions[i][c] = lane(RESULT_POSITION + c)[i];
+      for (size_t c = 0; c < 4; c++)
+        rotations[i][c] = result[c][i];
+    }
+  }
+};
+} // namespace RepFile
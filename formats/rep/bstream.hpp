@@ -1,14 +1,331 @@
+#pragma once
+/*
+ * Binary stream abstraction
+ * Author: Roman Romop5 Dobias
+ * Purpose: read-only access to binary data without copying it
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fstream>
+#include <mutex>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* \brief Non-owning view of contiguous elements
+ *
+ * Used to hand out typed arrays stored inside of a BStream (or any other
+ * buffer) without copying them.
+ */
+template<typename T>
+class Span
+{
+  T* elements;
+  size_t count;
+
+public:
+  Span()
+    : elements(nullptr)
+    , count(0)
+  {}
+  Span(T* data, size_t size)
+    : elements(data)
+    , count(size)
+  {}
+
+  T* data() const { return elements; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  T* begin() const { return elements; }
+  T* end() const { return elements + count; }
+  T& operator[](size_t i) const { return elements[i]; }
+  T& front() const { return elements[0]; }
+  T& back() const { return elements[count - 1]; }
+};
+
 /**
  * An abstraction level over binary streams
  *
- * This class provides a unified access to binary streams and can be used for 
+ * This class provides a unified access to binary streams and can be used for
  * reading binary files / binary data from RAM / whatever.
+ *
+ * Files are memory-mapped, thus opening a file costs no copy and only the
+ * pages, which are really touched, are read from the disk.
  */
 class BStream
 {
-	private:
+private:
+  const unsigned char* buffer;
+  size_t bufferSize;
+  size_t position;
+  bool isMapped;
+#if defined(_WIN32)
+  std::vector<unsigned char> fileContent;
+#endif
+
+  void release()
+  {
+#if !defined(_WIN32)
+    if (isMapped && bufferSize > 0)
+      munmap(const_cast<unsigned char*>(buffer), bufferSize);
+#else
+    fileContent.clear();
+#endif
+    buffer = nullptr;
+    bufferSize = 0;
+    position = 0;
+    isMapped = false;
+  }
+
+public:
+  BStream()
+    : buffer(nullptr)
+    , bufferSize(0)
+    , position(0)
+    , isMapped(false)
+  {}
+  BStream(const void* data, size_t size)
+    : BStream()
+  {
+    open(data, size);
+  }
+  ~BStream() { release(); }
+
+  BStream(const BStream&) = delete;
+  BStream& operator=(const BStream&) = delete;
+  BStream(BStream&& other) noexcept
+    : BStream()
+  {
+    *this = std::move(other);
+  }
+  BStream& operator=(BStream&& other) noexcept
+  {
+    if (this != &other) {
+      release();
+      buffer = other.buffer;
+      bufferSize = other.bufferSize;
+      position = other.position;
+      isMapped = other.isMapped;
+#if defined(_WIN32)
+      fileContent = std::move(other.fileContent);
+#endif
+      other.buffer = nullptr;
+      other.bufferSize = 0;
+      other.position = 0;
+      other.isMapped = false;
+    }
+    return *this;
+  }
+
+  /// Maps whole file into memory
+  bool open(const std::string& fileName)
+  {
+    release();
+#if !defined(_WIN32)
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0) {
+      ::close(fd);
+      return false;
+    }
+    bufferSize = static_cast<size_t>(fileInfo.st_size);
+    if (bufferSize > 0) {
+      void* mapping =
+        mmap(nullptr, bufferSize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping == MAP_FAILED) {
+        ::close(fd);
+        bufferSize = 0;
+        return false;
+      }
+      buffer = static_cast<const unsigned char*>(mapping);
+      isMapped = true;
+    }
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    return true;
+#else
+    std::ifstream inputFile(fileName, std::ifstream::binary);
+    if (!inputFile.is_open())
+      return false;
+    inputFile.seekg(0, std::ifstream::end);
+    fileContent.resize(static_cast<size_t>(inputFile.tellg()));
+    inputFile.seekg(0, std::ifstream::beg);
+    inputFile.read(reinterpret_cast<char*>(fileContent.data()),
+                   fileContent.size());
+    buffer = fileContent.data();
+    bufferSize = fileContent.size();
+    return true;
+#endif
+  }
+
+  /// Wraps existing memory, the memory must outlive the stream
+  void open(const void* data, size_t size)
+  {
+    release();
+    buffer = static_cast<const unsigned char*>(data);
+    bufferSize = size;
+  }
+
+  void close() { release(); }
+
+  bool isOpen() const { return buffer != nullptr; }
+  const unsigned char* data() const { return buffer; }
+  size_t size() const { return bufferSize; }
+  size_t tell() const { return position; }
+  size_t remaining() const { return bufferSize - position; }
+  bool eof() const { return position >= bufferSize; }
+
+  bool seek(size_t offset)
+  {
+    if (offset > bufferSize)
+      return false;
+    position = offset;
+    return true;
+  }
+  bool skip(size_t count) { return seek(position + count); }
+
+  /// Copies count bytes from current position
+  bool read(void* destination, size_t count)
+  {
+    if (count > remaining())
+      return false;
+    memcpy(destination, buffer + position, count);
+    position += count;
+    return true;
+  }
+
+  template<typename T>
+  bool read(T& value)
+  {
+    return read(&value, sizeof(T));
+  }
+
+  /// Returns count of T stored at offset without copying them
+  template<typename T>
+  Span<const T> getSpan(size_t offset, size_t count) const
+  {
+    if (offset > bufferSize || count > (bufferSize - offset) / sizeof(T))
+      return Span<const T>();
+    return Span<const T>(reinterpret_cast<const T*>(buffer + offset), count);
+  }
+
+  /// Returns pointer to T stored at offset (or nullptr when out of range)
+  template<typename T>
+  const T* getPointer(size_t offset) const
+  {
+    if (offset > bufferSize || sizeof(T) > bufferSize - offset)
+      return nullptr;
+    return reinterpret_cast<const T*>(buffer + offset);
+  }
+};
+
+/* \brief File, which is read at explicit offsets instead of being mapped
+ *
+ * Only the bytes, which were asked for, are copied, thus reading a huge file
+ * piece by piece keeps neither the file nor its page cache mapping in the
+ * resident memory of process. Reads don't share a file position (pread), so
+ * more threads can read at once.
+ */
+class FileReader
+{
+private:
+  size_t fileSize;
+#if !defined(_WIN32)
+  int descriptor;
+#else
+  mutable std::ifstream inputFile;
+  mutable std::mutex lock;
+#endif
+
+public:
+  FileReader()
+    : fileSize(0)
+#if !defined(_WIN32)
+    , descriptor(-1)
+#endif
+  {}
+  ~FileReader() { close(); }
+
+  FileReader(const FileReader&) = delete;
+  FileReader& operator=(const FileReader&) = delete;
+
+  bool open(const std::string& fileName)
+  {
+    close();
+#if !defined(_WIN32)
+    descriptor = ::open(fileName.c_str(), O_RDONLY);
+    if (descriptor < 0)
+      return false;
+    struct stat fileInfo;
+    if (fstat(descriptor, &fileInfo) != 0) {
+      close();
+      return false;
+    }
+    fileSize = static_cast<size_t>(fileInfo.st_size);
+#else
+    inputFile.open(fileName, std::ifstream::binary | std::ifstream::ate);
+    if (!inputFile.is_open())
+      return false;
+    fileSize = static_cast<size_t>(inputFile.tellg());
+#endif
+    return true;
+  }
+
+  void close()
+  {
+#if !defined(_WIN32)
+    if (descriptor >= 0)
+      ::close(descriptor);
+    descriptor = -1;
+#else
+    if (inputFile.is_open())
+      inputFile.close();
+#endif
+    fileSize = 0;
+  }
+
+  size_t size() const { return fileSize; }
+
+  /// Copies count bytes at offset, fails if they exceed the file
+  bool read(size_t offset, void* destination, size_t count) const
+  {
+    if (offset > fileSize || count > fileSize - offset)
+      return false;
+#if !defined(_WIN32)
+    unsigned char* bytes = static_cast<unsigned char*>(destination);
+    while (count > 0) {
+      ssize_t result = pread(descriptor, bytes, count, off_t(offset));
+      if (result <= 0)
+        return false;
+      bytes += result;
+      offset += size_t(result);
+      count -= size_t(result);
+    }
+    return true;
+#else
+    std::lock_guard<std::mutex> guard(lock);
+    inputFile.clear();
+    inputFile.seekg(offset);
+    inputFile.read(static_cast<char*>(destination), count);
+    return static_cast<bool>(inputFile);
+#endif
+  }
 
-	public:
-		bool read()
-			
+  template<typename T>
+  bool read(size_t offset, T& value) const
+  {
+    return read(offset, &value, sizeof(T));
+  }
 };
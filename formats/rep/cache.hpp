@@ -0,0 +1,251 @@
+#pragma once
+/*
+ * .rep parse cache
+ * Author: Roman Romop5 Dobias
+ * Purpose: reuse decoded cutscenes between runs instead of parsing them
+ */
+
+#include <chrono>
+#include <filesystem>
+#include <sstream>
+
+#include "hash.hpp"
+#include "timeline.hpp"
+
+namespace RepFile {
+
+const uint32_t cacheMagicConstant = 0x4B504552; // "REPK"
+/// Bump when decoding rules change without changing any structure
+const uint32_t cacheVersion = 1;
+
+/* \brief Header of cache blob
+ *
+ * The blob is followed by the arena image (see Arena::getImage()) and by
+ * sorted events of Timeline. Offsets are relative to the start of the blob.
+ */
+struct CacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t layoutSignature; // getCacheLayoutSignature() of the writer
+  uint64_t sourceHash;
+  uint64_t sourceSize;
+  uint64_t imageOffset;
+  uint64_t imageSize;
+  uint64_t eventsOffset;
+  uint64_t countOfEvents;
+};
+
+/* \brief Hash of everything the layout of blob depends on
+ *
+ * Any change of size of stored structure (or of arena / cache version) gives
+ * another signature, thus blobs of older builds are never used.
+ */
+inline uint64_t getCacheLayoutSignature()
+{
+  const uint64_t values[] = { cacheVersion,
+                              arenaVersion,
+                              arenaAlignment,
+                              sizeof(Header),
+                              sizeof(AnimationBlock),
+                              sizeof(AnimatedObjectDefinitions),
+                              sizeof(TransformationHeader),
+                              sizeof(TransformPayload),
+                              sizeof(CameraTransformationChunk),
+                              sizeof(CameraFocusChunk),
+                              sizeof(ScriptsAndSoundsHeader),
+                              sizeof(FadeChunk),
+                              sizeof(ScriptChunk),
+                              sizeof(SoundChunk),
+                              sizeof(DialogHeader),
+                              sizeof(DialogChunk),
+                              sizeof(NarratorChunk),
+                              sizeof(MorphChunk),
+                              sizeof(Position),
+                              sizeof(Rotation),
+                              sizeof(ArenaRange),
+                              sizeof(ArenaTrack),
+                              sizeof(ArenaDirectory),
+                              sizeof(Event),
+                              sizeof(CacheHeader) };
+  return Hash::hash64(values, sizeof(values));
+}
+
+/* \brief Cutscene obtained through Cache
+ *
+ * On a hit, the arena and events live in the mapped blob. On a miss, the
+ * file was parsed (and stored into the cache).
+ */
+class CachedFile
+{
+private:
+  friend class Cache;
+  BStream blob;
+  Arena arena;
+  Timeline timeline;
+  bool isHit;
+
+public:
+  CachedFile()
+    : isHit(false)
+  {}
+  CachedFile(const CachedFile&) = delete;
+  CachedFile& operator=(const CachedFile&) = delete;
+
+  const Arena& getArena() const { return arena; }
+  const Timeline& getTimeline() const { return timeline; }
+  /// True if nothing was parsed
+  bool wasCached() const { return isHit; }
+};
+
+/* \brief Content-addressed cache of parsed .rep files
+ *
+ * Blobs are named by XXH64 of the source file, thus renamed or copied files
+ * share the blob and modified ones never get a stale one. Hashing maps the
+ * source and reads it once, which is much cheaper than parsing it. A hit
+ * maps the blob and uses the arena image directly (Arena::openImage()).
+ *
+ * Blobs are written to a temporary file and renamed, thus more processes can
+ * share the cache directory. Blobs with another layout signature or failing
+ * validation are treated as misses and overwritten.
+ */
+class Cache
+{
+private:
+  std::filesystem::path directory;
+
+  static size_t align(size_t size)
+  {
+    return (size + arenaAlignment - 1) & ~(arenaAlignment - 1);
+  }
+
+  bool openBlob(const std::string& blobName,
+                uint64_t sourceHash,
+                uint64_t sourceSize,
+                CachedFile& result) const
+  {
+    std::error_code error;
+    if (!std::filesystem::exists(blobName, error) || !result.blob.open(blobName))
+      return false;
+    const CacheHeader* header = result.blob.getPointer<CacheHeader>(0);
+    if (!header || header->magic != cacheMagicConstant ||
+        header->version != cacheVersion ||
+        header->layoutSignature != getCacheLayoutSignature() ||
+        header->sourceHash != sourceHash || header->sourceSize != sourceSize ||
+        header->imageOffset % arenaAlignment != 0 ||
+        header->imageOffset > result.blob.size() ||
+        header->imageSize > result.blob.size() - header->imageOffset)
+      return false;
+    auto events =
+      result.blob.getSpan<Event>(header->eventsOffset, header->countOfEvents);
+    if (events.size() != header->countOfEvents)
+      return false;
+    if (!result.arena.openImage(result.blob.data() + header->imageOffset,
+                                header->imageSize))
+      return false;
+    result.timeline = Timeline(result.arena, events);
+    return result.timeline.isValid();
+  }
+
+  bool storeBlob(const std::string& blobName,
+                 uint64_t sourceHash,
+                 uint64_t sourceSize,
+                 const CachedFile& file) const
+  {
+    auto image = file.arena.getImage();
+    auto events = file.timeline.getEvents();
+    CacheHeader header = CacheHeader();
+    header.magic = cacheMagicConstant;
+    header.version = cacheVersion;
+    header.layoutSignature = getCacheLayoutSignature();
+    header.sourceHash = sourceHash;
+    header.sourceSize = sourceSize;
+    header.imageOffset = align(sizeof(CacheHeader));
+    header.imageSize = image.size();
+    header.eventsOffset = align(header.imageOffset + header.imageSize);
+    header.countOfEvents = events.size();
+
+    std::vector<char> buffer(header.eventsOffset +
+                             events.size() * sizeof(Event));
+    memcpy(buffer.data(), &header, sizeof(header));
+    memcpy(buffer.data() + header.imageOffset, image.data(), image.size());
+    if (!events.empty())
+      memcpy(buffer.data() + header.eventsOffset, events.data(),
+             events.size() * sizeof(Event));
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::string temporaryName =
+      blobName + "." +
+      std::to_string(
+        std::chrono::steady_clock::now().time_since_epoch().count()) +
+      ".tmp";
+    std::ofstream outputFile;
+    outputFile.open(temporaryName, std::ofstream::binary | std::ofstream::trunc);
+    if (!outputFile.is_open())
+      return false;
+    outputFile.write(buffer.data(), buffer.size());
+    outputFile.close();
+    if (!outputFile) {
+      std::filesystem::remove(temporaryName, error);
+      return false;
+    }
+    std::filesystem::rename(temporaryName, blobName, error);
+    if (error) {
+      std::filesystem::remove(temporaryName, error);
+      return false;
+    }
+    return true;
+  }
+
+public:
+  explicit Cache(const std::string& cacheDirectory)
+    : directory(cacheDirectory)
+  {}
+
+  /// Path of blob for source with given hash
+  std::string getBlobName(uint64_t sourceHash) const
+  {
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << sourceHash
+         << ".repcache";
+    return (directory / name.str()).string();
+  }
+
+  /* \brief Loads file from cache, parsing (and caching) it on a miss
+   *
+   * Returns false (and reports an error) only if the file itself can't be
+   * loaded, failing to write the cache is reported as a warning.
+   */
+  bool load(const std::string& fileName, CachedFile& result) const
+  {
+    result.timeline = Timeline();
+    result.arena = Arena();
+    result.blob.close();
+    result.isHit = false;
+
+    BStream source;
+    if (!source.open(fileName)) {
+      std::cerr << "[Err] Failed to open file " << fileName << std::endl;
+      return false;
+    }
+    uint64_t sourceHash = Hash::hash64(source.data(), source.size());
+    std::string blobName = getBlobName(sourceHash);
+    if (openBlob(blobName, sourceHash, source.size(), result)) {
+      result.isHit = true;
+      return true;
+    }
+
+    // the arena may refer to the rejected blob until it's reloaded
+    result.timeline = Timeline();
+    if (!result.arena.load(source.data(), source.size()))
+      return false;
+    result.blob.close();
+    result.timeline = Timeline(result.arena);
+    if (!storeBlob(blobName, sourceHash, source.size(), result))
+      std::cerr << "[Warn] Failed to store cache " << blobName << std::endl;
+    return true;
+  }
+};
+
+} // namespace RepFile
@@ -0,0 +1,333 @@
+#pragma once
+/*
+ * .rep camera evaluator
+ * Author: Roman Romop5 Dobias
+ * Purpose: evaluate camera position, focus and FOV at arbitrary time
+ */
+
+#include "bstream.hpp"
+#include "rep.hpp"
+
+namespace RepFile {
+
+/* \brief Camera at given time
+ */
+struct CameraState
+{
+  Position position;
+  Position lookAt;
+  float fov;
+};
+
+/// Chunks of this type terminate camera track (seen as the last chunk)
+const uint32_t cameraTerminatorType = 0xCCCCCCCC;
+
+enum CameraTangents
+{
+  /// Tangents stored in chunks (unkVector = incoming, unkVectorSecond =
+  /// outgoing), used as they are, i.e. per segment. Their meaning isn't
+  /// known for sure: in record01c.rep, key 1 stores a half of the
+  /// difference of its neighbours (as uniform Catmull-Rom would), but key 2
+  /// stores zero and so do the boundary keys.
+  TANGENTS_STORED,
+  /// Catmull-Rom tangents computed from neighbouring keys, scaled by the
+  /// length of each segment, thus uneven key spacing doesn't overshoot
+  TANGENTS_CATMULL_ROM,
+};
+
+/* \brief Cubic segments of a single key-framed track
+ *
+ * Each segment stores polynomial a + b*s + c*s^2 + d*s^3 for 4 channels
+ * (x, y, z and a linearly interpolated scalar) with s = (t - start) / length,
+ * thus evaluation is a search plus 3 multiply-adds per channel.
+ */
+class SplineTrack
+{
+public:
+  struct Key
+  {
+    uint32_t timestamp;
+    float value[4];
+    float incoming[3];
+    float outgoing[3];
+  };
+
+private:
+  struct Segment
+  {
+    float a[4], b[4], c[4], d[4];
+    float inverseLength;
+  };
+
+  std::vector<uint32_t> timestamps; // start of each segment
+  std::vector<Segment> segments;
+
+  static Segment createSegment(const Key& start,
+                               const Key& end,
+                               const float startTangent[3],
+                               const float endTangent[3])
+  {
+    Segment segment;
+    uint32_t length = end.timestamp - start.timestamp;
+    segment.inverseLength = length > 0 ? 1.0f / length : 0.0f;
+    // Hermite basis expanded into power basis
+    for (size_t c = 0; c < 3; c++) {
+      float p0 = start.value[c], p1 = end.value[c];
+      float m0 = startTangent[c], m1 = endTangent[c];
+      segment.a[c] = p0;
+      segment.b[c] = m0;
+      segment.c[c] = 3.0f * (p1 - p0) - 2.0f * m0 - m1;
+      segment.d[c] = 2.0f * (p0 - p1) + m0 + m1;
+    }
+    segment.a[3] = start.value[3];
+    segment.b[3] = end.value[3] - start.value[3];
+    segment.c[3] = segment.d[3] = 0.0f;
+    return segment;
+  }
+
+public:
+  SplineTrack() {}
+
+  /// Builds segments of keys sorted by time
+  SplineTrack(const std::vector<Key>& keys, CameraTangents tangents)
+  {
+    if (keys.empty())
+      return;
+    timestamps.reserve(keys.size());
+    segments.reserve(keys.size());
+    // Catmull-Rom velocity per ms, (p[i+1] - p[i-1]) / (t[i+1] - t[i-1]),
+    // segments scale it by their length (for even spacing, it's the usual
+    // half of the difference)
+    std::vector<float> velocities(keys.size() * 3, 0.0f);
+    for (size_t i = 1; i + 1 < keys.size(); i++) {
+      uint32_t span = keys[i + 1].timestamp - keys[i - 1].timestamp;
+      if (span == 0)
+        continue;
+      for (size_t c = 0; c < 3; c++)
+        velocities[i * 3 + c] =
+          (keys[i + 1].value[c] - keys[i - 1].value[c]) / float(span);
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+      const Key& start = keys[i];
+      // the last key is held
+      const Key& end = i + 1 < keys.size() ? keys[i + 1] : keys[i];
+      const float* startTangent = start.outgoing;
+      const float* endTangent = end.incoming;
+      float catmullRom[2][3];
+      if (tangents == TANGENTS_CATMULL_ROM) {
+        float length = float(end.timestamp - start.timestamp);
+        size_t endIndex = i + 1 < keys.size() ? i + 1 : i;
+        for (size_t c = 0; c < 3; c++) {
+          catmullRom[0][c] = velocities[i * 3 + c] * length;
+          catmullRom[1][c] = velocities[endIndex * 3 + c] * length;
+        }
+        startTangent = catmullRom[0];
+        endTangent = catmullRom[1];
+      }
+      Segment segment = createSegment(start, end, startTangent, endTangent);
+      if (i + 1 == keys.size()) {
+        for (size_t c = 0; c < 4; c++)
+          segment.b[c] = segment.c[c] = segment.d[c] = 0.0f;
+      }
+      timestamps.push_back(start.timestamp);
+      segments.push_back(segment);
+    }
+  }
+
+  size_t size() const { return segments.size(); }
+  bool empty() const { return segments.empty(); }
+  uint32_t getEndTime() const { return empty() ? 0 : timestamps.back(); }
+
+  /// Returns index of segment containing timeMs
+  size_t findSegment(uint32_t timeMs) const
+  {
+    auto upper = std::upper_bound(timestamps.begin(), timestamps.end(), timeMs);
+    return upper == timestamps.begin() ? 0 : upper - timestamps.begin() - 1;
+  }
+
+  /// Moves index forward to the segment containing timeMs
+  size_t advanceSegment(size_t index, uint32_t timeMs) const
+  {
+    if (index >= timestamps.size() || timestamps[index] > timeMs)
+      return findSegment(timeMs);
+    while (index + 1 < timestamps.size() && timestamps[index + 1] <= timeMs)
+      index++;
+    return index;
+  }
+
+  void evaluate(size_t index, uint32_t timeMs, float value[4]) const
+  {
+    if (empty()) {
+      value[0] = value[1] = value[2] = value[3] = 0.0f;
+      return;
+    }
+    const Segment& segment = segments[index];
+    float s = timeMs > timestamps[index]
+                ? (timeMs - timestamps[index]) * segment.inverseLength
+                : 0.0f;
+    s = std::min(s, 1.0f);
+    for (size_t c = 0; c < 4; c++)
+      value[c] =
+        ((segment.d[c] * s + segment.c[c]) * s + segment.b[c]) * s + segment.a[c];
+  }
+};
+
+/* \brief Evaluates camera tracks of cutscene
+ *
+ * Position and FOV come from camera chunks, look-at from focus chunks. Both
+ * tracks are turned into cubic Hermite segments when constructed, the
+ * terminating chunk (cameraTerminatorType) is skipped. Before the first key
+ * and after the last one, the boundary key is held.
+ *
+ * cameraAt() costs a binary search, Cursor is amortized O(1) for playback and
+ * bake() creates a fixed-rate table with O(1) lookup.
+ */
+class CameraTrack
+{
+private:
+  SplineTrack positionTrack;
+  SplineTrack focusTrack;
+
+  template<typename Chunk>
+  static std::vector<SplineTrack::Key> createKeys(Span<const Chunk> chunks,
+                                                  const float* fovs)
+  {
+    std::vector<SplineTrack::Key> keys;
+    keys.reserve(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++) {
+      const Chunk& chunk = chunks[i];
+      if (chunk.type == cameraTerminatorType)
+        break;
+      // keep keys sorted even for broken files
+      if (!keys.empty() && chunk.timestamp < keys.back().timestamp)
+        continue;
+      SplineTrack::Key key;
+      key.timestamp = chunk.timestamp;
+      memcpy(key.value, chunk.position, sizeof(chunk.position));
+      key.value[3] = fovs ? fovs[i] : 0.0f;
+      memcpy(key.incoming, chunk.unkVector, sizeof(key.incoming));
+      memcpy(key.outgoing, chunk.unkVectorSecond, sizeof(key.outgoing));
+      keys.push_back(key);
+    }
+    return keys;
+  }
+
+  static CameraState toState(const float position[4], const float focus[4])
+  {
+    CameraState state;
+    state.position = Position{ position[0], position[1], position[2] };
+    state.lookAt = Position{ focus[0], focus[1], focus[2] };
+    state.fov = position[3];
+    return state;
+  }
+
+public:
+  CameraTrack() {}
+
+  CameraTrack(Span<const CameraTransformationChunk> cameraChunks,
+              Span<const CameraFocusChunk> focusChunks,
+              CameraTangents tangents = TANGENTS_STORED)
+  {
+    std::vector<float> fovs(cameraChunks.size());
+    for (size_t i = 0; i < cameraChunks.size(); i++)
+      fovs[i] = cameraChunks[i].fov;
+    positionTrack = SplineTrack(createKeys(cameraChunks, fovs.data()), tangents);
+    focusTrack = SplineTrack(createKeys(focusChunks, nullptr), tangents);
+  }
+
+  explicit CameraTrack(const File& file, CameraTangents tangents = TANGENTS_STORED)
+    : CameraTrack(Span<const CameraTransformationChunk>(
+                    file.cameraPositionChunks.data(),
+                    file.cameraPositionChunks.size()),
+                  Span<const CameraFocusChunk>(file.camerafocusChunks.data(),
+                                               file.camerafocusChunks.size()),
+                  tangents)
+  {}
+
+  bool isValid() const { return !positionTrack.empty(); }
+  uint32_t getEndTime() const
+  {
+    return std::max(positionTrack.getEndTime(), focusTrack.getEndTime());
+  }
+
+  CameraState cameraAt(uint32_t timeMs) const
+  {
+    float position[4], focus[4];
+    positionTrack.evaluate(positionTrack.findSegment(timeMs), timeMs, position);
+    focusTrack.evaluate(focusTrack.findSegment(timeMs), timeMs, focus);
+    return toState(position, focus);
+  }
+
+  /* \brief Remembers the current segments, thus moving forward in time
+   * costs amortized O(1)
+   */
+  class Cursor
+  {
+  private:
+    const CameraTrack* track;
+    size_t positionSegment;
+    size_t focusSegment;
+
+  public:
+    explicit Cursor(const CameraTrack& owner)
+      : track(&owner)
+      , positionSegment(0)
+      , focusSegment(0)
+    {}
+
+    CameraState cameraAt(uint32_t timeMs)
+    {
+      float position[4], focus[4];
+      positionSegment =
+        track->positionTrack.advanceSegment(positionSegment, timeMs);
+      focusSegment = track->focusTrack.advanceSegment(focusSegment, timeMs);
+      track->positionTrack.evaluate(positionSegment, timeMs, position);
+      track->focusTrack.evaluate(focusSegment, timeMs, focus);
+      return toState(position, focus);
+    }
+  };
+
+  Cursor createCursor() const { return Cursor(*this); }
+
+  /* \brief Camera sampled at fixed rate
+   *
+   * at() returns the nearest earlier sample, thus the error is bounded by
+   * the camera movement within one frame.
+   */
+  class Table
+  {
+  private:
+    std::vector<CameraState> frames;
+    uint32_t milisecondsPerFrame;
+
+  public:
+    Table(std::vector<CameraState> sampledFrames, uint32_t frameTime)
+      : frames(std::move(sampledFrames))
+      , milisecondsPerFrame(frameTime)
+    {}
+
+    size_t size() const { return frames.size(); }
+    uint32_t getMilisecondsPerFrame() const { return milisecondsPerFrame; }
+
+    const CameraState& at(uint32_t timeMs) const
+    {
+      size_t frame = std::min<size_t>(timeMs / milisecondsPerFrame,
+                                      frames.size() - 1);
+      return frames[frame];
+    }
+  };
+
+  /// Samples the whole track (up to its last key) every milisecondsPerFrame
+  Table bake(uint32_t milisecondsPerFrame) const
+  {
+    milisecondsPerFrame = std::max<uint32_t>(milisecondsPerFrame, 1);
+    std::vector<CameraState> frames;
+    frames.reserve(getEndTime() / milisecondsPerFrame + 1);
+    Cursor cursor(*this);
+    for (uint64_t time = 0; time <= getEndTime(); time += milisecondsPerFrame)
+      frames.push_back(cursor.cameraAt(uint32_t(time)));
+    return Table(std::move(frames), milisecondsPerFrame);
+  }
+};
+
+} // namespace RepFile
@@ -0,0 +1,280 @@
+#pragma once
+/*
+ * Compact .rep encoding
+ * Author: Roman Romop5 Dobias
+ * Purpose: keep many cutscenes resident in a fraction of their memory
+ */
+
+#include "bitpack.hpp"
+#include "rep.hpp"
+
+namespace RepFile {
+
+/* \brief Lossy compact sidecar encoding of File
+ *
+ * All sections except of transformation tracks are kept verbatim. Tracks are
+ * stored channel by channel:
+ *  - timestamps as varint deltas
+ *  - positions quantized to 16 bits per axis against the bounding box of
+ *    the object, stored as varint residuals of linear prediction
+ *  - rotations packed with smallest-three (3 x 10 bits + 2 bit index)
+ *  - animation ID/flags and offsets as varints of XOR with previous key
+ *
+ * Error bound: each position axis within extent / 131070 of the object's
+ * bounding box (i.e. 0.015 mm per metre of extent), each rotation
+ * component within 0.0021 (0.0007 for all but the largest one, see
+ * Packing::packQuaternion; up to sign, as q and -q are the same rotation).
+ * Everything else is restored exactly.
+ */
+namespace Compact {
+
+const uint32_t magicConstant = 0x43504552; // "REPC"
+const uint32_t version = 1;
+const unsigned positionBits = 16;
+
+struct Statistics
+{
+  size_t rawTrackSize;     // in-memory size of decoded tracks
+  size_t compactTrackSize; // encoded size of tracks
+  size_t compactSize;      // encoded size of whole file
+  float maxPositionError;  // measured on the encoded data
+  float maxRotationError;
+};
+
+namespace Detail {
+
+template<typename T>
+void putArray(Packing::Writer& writer, const std::vector<T>& values)
+{
+  writer.putVarint(values.size());
+  writer.putRaw(values.data(), values.size() * sizeof(T));
+}
+
+template<typename T>
+bool getArray(Packing::Reader& reader, std::vector<T>& values)
+{
+  uint64_t count = reader.getVarint();
+  if (reader.hasFailed() || count > reader.remaining() / sizeof(T))
+    return false;
+  values.resize(count);
+  return reader.getRaw(values.data(), count * sizeof(T));
+}
+
+inline void encodeTrack(Packing::Writer& writer,
+                        const TransformTrack& track,
+                        Statistics& statistics)
+{
+  writer.put(track.streamHeader);
+  writer.putVarint(track.size());
+
+  Packing::Bounds bounds;
+  for (const auto& position : track.positions)
+    bounds.extend(position.data());
+  for (size_t c = 0; c < 3; c++) {
+    writer.put(bounds.minimum[c]);
+    writer.put(bounds.maximum[c]);
+  }
+
+  uint32_t previousTime = 0;
+  for (uint32_t timestamp : track.timestamps) {
+    writer.putSignedVarint(int64_t(timestamp) - int64_t(previousTime));
+    previousTime = timestamp;
+  }
+  for (uint32_t type : track.types)
+    writer.putVarint(type);
+
+  for (size_t c = 0; c < 3; c++) {
+    Packing::Quantizer quantizer(bounds.minimum[c], bounds.maximum[c],
+                                 positionBits);
+    Packing::LinearPredictor predictor;
+    for (const auto& position : track.positions) {
+      int64_t value = quantizer.quantize(position[c]);
+      writer.putSignedVarint(value - predictor.predict());
+      predictor.push(value);
+      statistics.maxPositionError =
+        std::max(statistics.maxPositionError,
+                 std::fabs(quantizer.dequantize(uint32_t(value)) - position[c]));
+    }
+  }
+
+  for (const auto& rotation : track.rotations) {
+    uint32_t packed = Packing::packQuaternion(rotation.data());
+    writer.put(packed);
+    float restored[4];
+    Packing::unpackQuaternion(packed, restored);
+    float errorPositive = 0.0f, errorNegative = 0.0f;
+    for (size_t c = 0; c < 4; c++) {
+      errorPositive = std::max(errorPositive, std::fabs(restored[c] - rotation[c]));
+      errorNegative = std::max(errorNegative, std::fabs(restored[c] + rotation[c]));
+    }
+    statistics.maxRotationError = std::max(
+      statistics.maxRotationError, std::min(errorPositive, errorNegative));
+  }
+
+  uint32_t previous = 0;
+  for (uint32_t auxiliary : track.auxiliary) {
+    writer.putVarint(auxiliary ^ previous);
+    previous = auxiliary;
+  }
+  previous = 0;
+  for (uint32_t offset : track.animationStartOffsets) {
+    writer.putVarint(offset ^ previous);
+    previous = offset;
+  }
+  putArray(writer, track.extraPayload);
+  statistics.rawTrackSize +=
+    track.size() * (sizeof(uint32_t) * 4 + sizeof(Position) + sizeof(Rotation)) +
+    track.extraPayload.size();
+}
+
+inline bool decodeTrack(Packing::Reader& reader, TransformTrack& track)
+{
+  reader.get(track.streamHeader);
+  uint64_t countOfKeys = reader.getVarint();
+  // each key takes at least 9 bytes (4 B rotation + 5 one-byte varints)
+  if (reader.hasFailed() || countOfKeys > reader.remaining() / 9)
+    return false;
+  size_t count = static_cast<size_t>(countOfKeys);
+  Packing::Bounds bounds;
+  for (size_t c = 0; c < 3; c++) {
+    reader.get(bounds.minimum[c]);
+    reader.get(bounds.maximum[c]);
+  }
+
+  track.timestamps.resize(count);
+  track.types.resize(count);
+  track.positions.resize(count);
+  track.rotations.resize(count);
+  track.auxiliary.resize(count);
+  track.animationStartOffsets.resize(count);
+
+  int64_t time = 0;
+  for (size_t i = 0; i < count; i++) {
+    time += reader.getSignedVarint();
+    track.timestamps[i] = uint32_t(time);
+  }
+  for (size_t i = 0; i < count; i++)
+    track.types[i] = uint32_t(reader.getVarint());
+  for (size_t c = 0; c < 3; c++) {
+    Packing::Quantizer quantizer(bounds.minimum[c], bounds.maximum[c],
+                                 positionBits);
+    Packing::LinearPredictor predictor;
+    for (size_t i = 0; i < count; i++) {
+      int64_t value = predictor.predict() + reader.getSignedVarint();
+      predictor.push(value);
+      track.positions[i][c] = quantizer.dequantize(uint32_t(value));
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    uint32_t packed = 0;
+    reader.get(packed);
+    Packing::unpackQuaternion(packed, track.rotations[i].data());
+  }
+  uint32_t previous = 0;
+  for (size_t i = 0; i < count; i++) {
+    previous ^= uint32_t(reader.getVarint());
+    track.auxiliary[i] = previous;
+  }
+  previous = 0;
+  for (size_t i = 0; i < count; i++) {
+    previous ^= uint32_t(reader.getVarint());
+    track.animationStartOffsets[i] = previous;
+  }
+  return getArray(reader, track.extraPayload) && !reader.hasFailed();
+}
+
+} // namespace Detail
+
+inline bool encode(const File& file,
+                   std::vector<unsigned char>& output,
+                   Statistics* statistics = nullptr)
+{
+  if (file.transformTracks.size() != file.animatedObjects.size())
+    return false;
+  Statistics localStatistics = Statistics();
+  output.clear();
+  Packing::Writer writer(output);
+  writer.put(magicConstant);
+  writer.put(version);
+  writer.put(file.header);
+  Detail::putArray(writer, file.animationBlocks);
+  Detail::putArray(writer, file.animatedObjects);
+  Detail::putArray(writer, file.cameraPositionChunks);
+  Detail::putArray(writer, file.camerafocusChunks);
+  writer.put(file.eventsHeader);
+  Detail::putArray(writer, file.eventsPostheaderData);
+  Detail::putArray(writer, file.fadeChunks);
+  Detail::putArray(writer, file.scriptChunks);
+  Detail::putArray(writer, file.soundChunks);
+  writer.put(file.dialogHeader);
+  Detail::putArray(writer, file.dialogChunks);
+  Detail::putArray(writer, file.narratorChunks);
+  Detail::putArray(writer, file.morphChunks);
+  size_t tracksStart = writer.size();
+  for (const auto& track : file.transformTracks)
+    Detail::encodeTrack(writer, track, localStatistics);
+  localStatistics.compactTrackSize = writer.size() - tracksStart;
+  localStatistics.compactSize = writer.size();
+  if (statistics)
+    *statistics = localStatistics;
+  return true;
+}
+
+inline bool decode(const void* data, size_t size, File& file)
+{
+  Packing::Reader reader(data, size);
+  uint32_t magic = 0, fileVersion = 0;
+  reader.get(magic);
+  reader.get(fileVersion);
+  if (magic != magicConstant || fileVersion != version)
+    return false;
+  file = File();
+  reader.get(file.header);
+  if (!Detail::getArray(reader, file.animationBlocks) ||
+      !Detail::getArray(reader, file.animatedObjects) ||
+      !Detail::getArray(reader, file.cameraPositionChunks) ||
+      !Detail::getArray(reader, file.camerafocusChunks) ||
+      !reader.get(file.eventsHeader) ||
+      !Detail::getArray(reader, file.eventsPostheaderData) ||
+      !Detail::getArray(reader, file.fadeChunks) ||
+      !Detail::getArray(reader, file.scriptChunks) ||
+      !Detail::getArray(reader, file.soundChunks) ||
+      !reader.get(file.dialogHeader) ||
+      !Detail::getArray(reader, file.dialogChunks) ||
+      !Detail::getArray(reader, file.narratorChunks) ||
+      !Detail::getArray(reader, file.morphChunks))
+    return false;
+  file.transformTracks.resize(file.animatedObjects.size());
+  for (auto& track : file.transformTracks) {
+    if (!Detail::decodeTrack(reader, track))
+      return false;
+  }
+  file.updateAnimationTable();
+  return true;
+}
+
+inline bool storeFile(const File& file,
+                      const std::string& fileName,
+                      Statistics* statistics = nullptr)
+{
+  std::vector<unsigned char> buffer;
+  if (!encode(file, buffer, statistics))
+    return false;
+  std::ofstream outputFile(fileName, std::ofstream::binary);
+  outputFile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  return static_cast<bool>(outputFile);
+}
+
+inline bool loadFile(const std::string& fileName, File& file)
+{
+  std::ifstream inputFile(fileName, std::ifstream::binary | std::ifstream::ate);
+  if (!inputFile.is_open())
+    return false;
+  std::vector<unsigned char> buffer(static_cast<size_t>(inputFile.tellg()));
+  inputFile.seekg(0);
+  inputFile.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+  return inputFile && decode(buffer.data(), buffer.size(), file);
+}
+
+} // namespace Compact
+} // namespace RepFile
@@ -0,0 +1,292 @@
+#pragma once
+/*
+ * .rep keyframe decimation
+ * Author: Roman Romop5 Dobias
+ * Purpose: drop transformation keys, which are (almost) linearly redundant
+ */
+
+#include "sampler.hpp"
+
+namespace RepFile {
+
+/* \brief Error-bounded removal of transformation keys
+ *
+ * A key is removed only if sampling (see Sampler) without it stays within
+ * maxPositionError (distance) and maxRotationError (angle in radians) of the
+ * original at every removed key, using the interpolation mode of the key,
+ * which the segment starts at:
+ *  - ANIMATION_SHOULD_INTERPOLATE: lerp / slerp towards the next kept key,
+ *    the error is the largest at removed keys, as both tracks are linear
+ *    between them
+ *  - otherwise the key is held, thus the error is the distance to it
+ *
+ * Only keys with the same auxiliary (animation ID and flags) as the start of
+ * segment are removed, thus changes of animation or of the interpolation
+ * mode are kept. Keys with an animation are removed only if the animation
+ * time continues exactly (the offset grows with the elapsed time).
+ *
+ * Chunks shorter than TransformPayload inherit position / rotation from the
+ * previous key, thus a key is kept if the following one would inherit
+ * different values. The first and the last key are always kept.
+ */
+namespace Decimation {
+
+struct Settings
+{
+  float maxPositionError = 0.001f;
+  float maxRotationError = 0.001f; // radians
+  /// Longest run of keys replaced by a single segment
+  size_t maxSpan = 256;
+};
+
+struct Statistics
+{
+  size_t countOfKeys;
+  size_t countOfKeptKeys;
+  size_t streamSize; // transformation section, before / after
+  size_t decimatedStreamSize;
+  float maxPositionError; // of removed keys
+  float maxRotationError;
+};
+
+namespace Detail {
+
+/* \brief Angle between rotations in radians (q and -q are the same one)
+ *
+ * For unit quaternions, whose dot is cos(h), the rotation angle is 2h, and
+ * atan2(|a - b|, |a + b|) = h / 2, thus the angle is 4 * atan2(). Unlike
+ * 2 * acos(dot), it keeps its precision for small angles (dot near 1). b is
+ * negated if it's in the other hemisphere than a.
+ */
+inline float getAngle(const Rotation& a, const Rotation& b)
+{
+  float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+  float sign = dot < 0.0f ? -1.0f : 1.0f;
+  float difference = 0.0f, sum = 0.0f;
+  for (size_t c = 0; c < 4; c++) {
+    float d = a[c] - sign * b[c], s = a[c] + sign * b[c];
+    difference += d * d;
+    sum += s * s;
+  }
+  return 4.0f * std::atan2(std::sqrt(difference), std::sqrt(sum));
+}
+
+inline float getDistance(const Position& a, const Position& b)
+{
+  float x = a[0] - b[0], y = a[1] - b[1], z = a[2] - b[2];
+  return std::sqrt(x * x + y * y + z * z);
+}
+
+class TrackDecimator
+{
+private:
+  const TransformTrack& track;
+  const AnimatedObjectDefinitions& object;
+  const Settings& settings;
+  float maxPositionError = 0.0f;
+  float maxRotationError = 0.0f;
+
+  size_t getPayloadLength(size_t key) const
+  {
+    return object.sizeOfBlocks[track.types[key]] - sizeof(TransformationHeader);
+  }
+
+  /// True if key, stored right after start, decodes to the same values
+  bool canFollow(size_t start, size_t key) const
+  {
+    size_t payloadLength = getPayloadLength(key);
+    if (payloadLength < sizeof(TransformPayload::position) &&
+        track.positions[key] != track.positions[start])
+      return false;
+    if (payloadLength < offsetof(TransformPayload, auxiliary) &&
+        track.rotations[key] != track.rotations[start])
+      return false;
+    return true;
+  }
+
+  /// Checks key, which would lie inside of segment [start, end]
+  bool canRemove(size_t start, size_t end, size_t key, float& positionError,
+                 float& rotationError) const
+  {
+    uint32_t auxiliary = track.auxiliary[start];
+    if (track.auxiliary[key] != auxiliary)
+      return false;
+    uint32_t startOffset = track.animationStartOffsets[start];
+    uint32_t keyOffset = track.animationStartOffsets[key];
+    if ((startOffset & ~0xFFFu) != (keyOffset & ~0xFFFu))
+      return false;
+    if (auxiliary & ANIMATION_HAS_ID) {
+      uint64_t startTime = uint64_t(startOffset & 0xFFF) * animationOffsetUnit +
+                           (track.timestamps[key] - track.timestamps[start]);
+      if (startTime != uint64_t(keyOffset & 0xFFF) * animationOffsetUnit)
+        return false;
+    }
+
+    Position position = track.positions[start];
+    Rotation rotation = track.rotations[start];
+    uint32_t duration = track.timestamps[end] - track.timestamps[start];
+    if ((auxiliary & ANIMATION_SHOULD_INTERPOLATE) &&
+        track.timestamps[key] > track.timestamps[start]) {
+      float alpha =
+        duration > 0
+          ? std::min(1.0f, float(track.timestamps[key] - track.timestamps[start]) /
+                             duration)
+          : 1.0f;
+      position = lerp(track.positions[start], track.positions[end], alpha);
+      rotation = slerp(track.rotations[start], track.rotations[end], alpha);
+    }
+    positionError = getDistance(position, track.positions[key]);
+    rotationError = getAngle(rotation, track.rotations[key]);
+    return positionError <= settings.maxPositionError &&
+           rotationError <= settings.maxRotationError;
+  }
+
+  bool canReplace(size_t start, size_t end, float& positionError,
+                  float& rotationError) const
+  {
+    if (!canFollow(start, end))
+      return false;
+    positionError = rotationError = 0.0f;
+    for (size_t key = start + 1; key < end; key++) {
+      float keyPositionError, keyRotationError;
+      if (!canRemove(start, end, key, keyPositionError, keyRotationError))
+        return false;
+      positionError = std::max(positionError, keyPositionError);
+      rotationError = std::max(rotationError, keyRotationError);
+    }
+    return true;
+  }
+
+public:
+  TrackDecimator(const TransformTrack& source,
+                 const AnimatedObjectDefinitions& definition,
+                 const Settings& decimationSettings)
+    : track(source)
+    , object(definition)
+    , settings(decimationSettings)
+  {}
+
+  float getMaxPositionError() const { return maxPositionError; }
+  float getMaxRotationError() const { return maxRotationError; }
+
+  /// Returns indices of kept keys (greedy, each segment is made maximal)
+  std::vector<size_t> findKeptKeys()
+  {
+    std::vector<size_t> kept;
+    if (track.size() == 0)
+      return kept;
+    kept.push_back(0);
+    size_t start = 0;
+    while (start + 1 < track.size()) {
+      size_t end = start + 1;
+      float positionError = 0.0f, rotationError = 0.0f;
+      while (end + 1 < track.size() && end + 1 - start <= settings.maxSpan) {
+        float segmentPositionError, segmentRotationError;
+        if (!canReplace(start, end + 1, segmentPositionError,
+                        segmentRotationError))
+          break;
+        positionError = segmentPositionError;
+        rotationError = segmentRotationError;
+        end++;
+      }
+      maxPositionError = std::max(maxPositionError, positionError);
+      maxRotationError = std::max(maxRotationError, rotationError);
+      kept.push_back(end);
+      start = end;
+    }
+    return kept;
+  }
+};
+
+} // namespace Detail
+
+/// Size of object stream as storeFile() writes it
+inline size_t getStreamSize(const TransformTrack& track,
+                            const AnimatedObjectDefinitions& object)
+{
+  size_t size = sizeof(TransformationHeader);
+  for (uint32_t type : track.types)
+    size += object.sizeOfBlocks[type];
+  return size;
+}
+
+/// Decimates single track, object is its definition (for chunk sizes)
+inline bool decimateTrack(TransformTrack& track,
+                          const AnimatedObjectDefinitions& object,
+                          const Settings& settings,
+                          Statistics& statistics)
+{
+  for (uint32_t type : track.types) {
+    if (type >= 4 || object.sizeOfBlocks[type] < sizeof(TransformationHeader))
+      return false;
+  }
+  Detail::TrackDecimator decimator(track, object, settings);
+  std::vector<size_t> kept = decimator.findKeptKeys();
+
+  TransformTrack result;
+  result.streamHeader = track.streamHeader;
+  result.reserve(kept.size());
+  // offsets of extra payload of each key
+  std::vector<size_t> extraOffsets(track.size() + 1, 0);
+  for (size_t key = 0; key < track.size(); key++) {
+    size_t payloadLength =
+      object.sizeOfBlocks[track.types[key]] - sizeof(TransformationHeader);
+    size_t extraLength = payloadLength > sizeof(TransformPayload)
+                           ? payloadLength - sizeof(TransformPayload)
+                           : 0;
+    extraOffsets[key + 1] = extraOffsets[key] + extraLength;
+  }
+  if (extraOffsets.back() != track.extraPayload.size())
+    return false;
+  for (size_t key : kept) {
+    result.timestamps.push_back(track.timestamps[key]);
+    result.types.push_back(track.types[key]);
+    result.positions.push_back(track.positions[key]);
+    result.rotations.push_back(track.rotations[key]);
+    result.auxiliary.push_back(track.auxiliary[key]);
+    result.animationStartOffsets.push_back(track.animationStartOffsets[key]);
+    result.extraPayload.insert(result.extraPayload.end(),
+                               track.extraPayload.begin() + extraOffsets[key],
+                               track.extraPayload.begin() +
+                                 extraOffsets[key + 1]);
+  }
+
+  statistics.countOfKeys += track.size();
+  statistics.countOfKeptKeys += result.size();
+  statistics.streamSize += getStreamSize(track, object);
+  statistics.decimatedStreamSize += getStreamSize(result, object);
+  statistics.maxPositionError =
+    std::max(statistics.maxPositionError, decimator.getMaxPositionError());
+  statistics.maxRotationError =
+    std::max(statistics.maxRotationError, decimator.getMaxRotationError());
+  track = std::move(result);
+  return true;
+}
+
+/// Decimates all tracks of file, returns false (and keeps file) on failure
+inline bool decimate(File& file,
+                     const Settings& settings,
+                     Statistics* statistics = nullptr)
+{
+  if (file.transformTracks.size() != file.animatedObjects.size()) {
+    std::cerr << "[Err] Each animated object needs its transform track"
+              << std::endl;
+    return false;
+  }
+  Statistics result = Statistics();
+  std::vector<TransformTrack> tracks = file.transformTracks;
+  for (size_t i = 0; i < tracks.size(); i++) {
+    if (!decimateTrack(tracks[i], file.animatedObjects[i], settings, result)) {
+      std::cerr << "[Err] Invalid transform track of object "
+                << file.animatedObjects[i].frameName << std::endl;
+      return false;
+    }
+  }
+  file.transformTracks = std::move(tracks);
+  if (statistics)
+    *statistics = result;
+  return true;
+}
+
+} // namespace Decimation
+} // namespace RepFile
@@ -0,0 +1,261 @@
+#pragma once
+/*
+ * Synthetic .rep generator
+ * Author: Roman Romop5 Dobias
+ * Purpose: produce arbitrarily large, valid cutscenes for benchmarks
+ */
+
+#include <cmath>
+#include <cstdio>
+
+#include "rep.hpp"
+
+namespace RepFile {
+
+struct GeneratorSettings
+{
+  size_t countOfActors = 16;
+  uint32_t duration = 60000;    // in ms
+  uint32_t keyInterval = 40;    // ms between two transformation keys
+  size_t countOfAnimations = 32;
+  size_t countOfCameraChunks = 64;
+  size_t countOfFocusChunks = 64;
+  size_t countOfScripts = 16;
+  size_t countOfSounds = 32;    // start + end chunks
+  size_t countOfDialogs = 16;
+  size_t countOfNarrators = 4;
+  size_t countOfMorphs = 4;
+  uint32_t seed = 1;
+};
+
+/* \brief Builds a File which looks like a recorded cutscene
+ *
+ * Actors move along smooth random trajectories, switch animations every few
+ * seconds and use all three chunk types (type 3 carries extra payload).
+ * Names are NULL-terminated and padded with 0xCD as in the game files.
+ * The output is deterministic for given settings.
+ */
+class Generator
+{
+private:
+  GeneratorSettings settings;
+  uint32_t state;
+
+  float random()
+  {
+    state = state * 1103515245 + 12345;
+    return float((state >> 8) & 0xFFFF) / 65535.0f;
+  }
+
+  uint32_t randomTime()
+  {
+    return uint32_t(random() * settings.duration);
+  }
+
+  template<size_t N>
+  static void setName(char (&name)[N], const std::string& value)
+  {
+    memset(name, 0xCD, N);
+    size_t length = std::min(value.size(), N - 1);
+    memcpy(name, value.data(), length);
+    name[length] = '\0';
+  }
+
+  static std::string numbered(const char* prefix, size_t index)
+  {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%s%03zu", prefix, index);
+    return buffer;
+  }
+
+  void generateAnimations(File& file)
+  {
+    for (size_t i = 0; i < settings.countOfAnimations; i++) {
+      AnimationBlock block;
+      block.animationID = uint32_t(i);
+      setName(block.animationName, numbered("gen_anim", i) + ".i3d");
+      file.animationBlocks.push_back(block);
+    }
+    file.updateAnimationTable();
+  }
+
+  void generateObject(File& file, size_t index)
+  {
+    AnimatedObjectDefinitions object;
+    memset(&object, 0, sizeof(object));
+    setName(object.frameName, numbered("gen_frame", index));
+    setName(object.actorName, numbered("hum", index));
+    memcpy(object.sizeOfBlocks, defaultSizeOfBlocks, sizeof(object.sizeOfBlocks));
+    object.deactivationTime = settings.duration;
+    object.type = index % 2 ? OBJECT_FRAME : OBJECT_HUMAN;
+    file.animatedObjects.push_back(object);
+
+    TransformTrack track;
+    memset(&track.streamHeader, 0, sizeof(track.streamHeader));
+    size_t countOfKeys = settings.duration / settings.keyInterval + 1;
+    track.reserve(countOfKeys);
+    float position[3] = { random() * 200.0f, random() * 10.0f,
+                          random() * 200.0f };
+    float velocity[3] = { 0.0f, 0.0f, 0.0f };
+    float heading = random() * 6.2831853f;
+    uint32_t animationID = 0;
+    uint32_t nextAnimationChange = 0;
+    for (size_t key = 0; key < countOfKeys; key++) {
+      TransformationHeader header;
+      header.timestamp = uint32_t(key * settings.keyInterval);
+      // mostly full chunks, some without the animation offset and some
+      // with extra payload
+      header.type = key % 16 == 5 ? 1 : (key % 16 == 11 ? 3 : 2);
+
+      for (size_t c = 0; c < 3; c += 2) {
+        velocity[c] = velocity[c] * 0.95f + (random() - 0.5f) * 0.01f;
+        position[c] += velocity[c];
+      }
+      heading += (random() - 0.5f) * 0.05f;
+
+      unsigned char payload[48];
+      TransformPayload body;
+      memcpy(body.position, position, sizeof(body.position));
+      body.rotation[0] = std::cos(heading * 0.5f);
+      body.rotation[1] = 0.0f;
+      body.rotation[2] = std::sin(heading * 0.5f);
+      body.rotation[3] = 0.0f;
+      body.auxiliary = ANIMATION_SHOULD_INTERPOLATE;
+      body.animationStartOffset = 0;
+      if (header.timestamp >= nextAnimationChange &&
+          settings.countOfAnimations > 0) {
+        // random() may return 1.0
+        animationID = std::min(uint32_t(random() * settings.countOfAnimations),
+                               uint32_t(settings.countOfAnimations - 1));
+        body.auxiliary |= ANIMATION_HAS_ID | animationID;
+        nextAnimationChange = header.timestamp + 2000 + randomTime() % 3000;
+      }
+      memcpy(payload, &body, sizeof(body));
+      memset(payload + sizeof(body), 0xCC, sizeof(payload) - sizeof(body));
+      track.push(header, payload, defaultSizeOfBlocks[header.type] - 8);
+    }
+    file.transformTracks.push_back(std::move(track));
+  }
+
+  template<typename Chunk>
+  void generateCameraTrack(std::vector<Chunk>& chunks, size_t count)
+  {
+    float position[3] = { random() * 200.0f, 5.0f, random() * 200.0f };
+    for (size_t i = 0; i < count; i++) {
+      Chunk chunk;
+      memset(&chunk, 0, sizeof(chunk));
+      chunk.timestamp = uint32_t(uint64_t(i) * settings.duration /
+                                 std::max<size_t>(count, 1));
+      chunk.type = 1;
+      for (size_t c = 0; c < 3; c++) {
+        float step = (random() - 0.5f) * 2.0f;
+        position[c] += step;
+        chunk.position[c] = position[c];
+        chunk.unkVector[c] = step;
+        chunk.unkVectorSecond[c] = step;
+      }
+      chunks.push_back(chunk);
+    }
+  }
+
+  void generateEvents(File& file)
+  {
+    FadeChunk fade;
+    memset(&fade, 0xCC, sizeof(fade));
+    fade.compressedStartWithFlags = 0x80u << 24;
+    fade.timeAheadOfDarkening = 5000;
+    fade.timeOfDarkening = 5000.0f;
+    fade.unk = 0;
+    fade.fixedSequence = 0x00CCCCCC;
+    file.fadeChunks.push_back(fade);
+    // the start has only 24 bits, the top byte holds flags (see
+    // FadeChunk::getStartOfFadeEvent())
+    fade.compressedStartWithFlags =
+      (0x40u << 24) | std::min<uint32_t>(settings.duration, 0xFFFFFF);
+    fade.timeAheadOfDarkening = 3000;
+    fade.timeOfDarkening = 3000.0f;
+    file.fadeChunks.push_back(fade);
+
+    for (size_t i = 0; i < settings.countOfScripts; i++) {
+      ScriptChunk chunk;
+      chunk.timestamp = randomTime();
+      setName(chunk.scriptName, numbered("GenScript", i));
+      file.scriptChunks.push_back(chunk);
+    }
+    for (size_t i = 0; i < settings.countOfSounds / 2; i++) {
+      SoundChunk chunk;
+      chunk.timestamp = randomTime();
+      chunk.type = SOUND_START;
+      setName(chunk.soundName, numbered("gen_sound", i));
+      file.soundChunks.push_back(chunk);
+      chunk.timestamp += 300 + randomTime() % 2000;
+      chunk.type = SOUND_END;
+      file.soundChunks.push_back(chunk);
+    }
+    auto byTime = [](const auto& a, const auto& b) {
+      return a.timestamp < b.timestamp;
+    };
+    std::stable_sort(file.scriptChunks.begin(), file.scriptChunks.end(), byTime);
+    std::stable_sort(file.soundChunks.begin(), file.soundChunks.end(), byTime);
+  }
+
+  void generateDialogs(File& file)
+  {
+    for (size_t i = 0; i < settings.countOfDialogs; i++) {
+      DialogChunk chunk;
+      chunk.timestamp = uint32_t(uint64_t(i) * settings.duration /
+                                 std::max<size_t>(settings.countOfDialogs, 1));
+      chunk.channelID = uint32_t(i % 2);
+      // the first chunk of each channel binds the frame of speaker
+      chunk.dialogID = i < 2 ? 1 : uint32_t(0xfb77a + i * 10);
+      size_t speaker = i % std::max<size_t>(settings.countOfActors, 1);
+      setName(chunk.framename, i < 2 ? numbered("gen_frame", speaker) : "");
+      file.dialogChunks.push_back(chunk);
+    }
+    for (size_t i = 0; i < settings.countOfNarrators; i++) {
+      NarratorChunk chunk;
+      chunk.timestamp = randomTime();
+      chunk.unk2 = 2000;
+      chunk.speechID = uint32_t(1000 + i);
+      file.narratorChunks.push_back(chunk);
+    }
+    for (size_t i = 0; i < settings.countOfMorphs; i++) {
+      MorphChunk chunk;
+      chunk.timestamp = i == 0 ? 0 : randomTime();
+      chunk.unk1 = i == 0 ? randomTime() : 2000;
+      size_t object = i % std::max<size_t>(settings.countOfActors, 1);
+      setName(chunk.frameName, numbered("gen_frame", object) + ".Rhand");
+      chunk.unk2 = uint32_t(768 + i);
+      file.morphChunks.push_back(chunk);
+    }
+  }
+
+public:
+  explicit Generator(const GeneratorSettings& generatorSettings)
+    : settings(generatorSettings)
+    , state(generatorSettings.seed)
+  {
+    if (settings.keyInterval == 0)
+      settings.keyInterval = 1;
+  }
+
+  File generate()
+  {
+    state = settings.seed;
+    File file;
+    file.header.fixedCCSequence = 0xCCCCCCCC;
+    file.header.AlwaysContainsOne = 0x100;
+    generateAnimations(file);
+    for (size_t i = 0; i < settings.countOfActors; i++)
+      generateObject(file, i);
+    generateCameraTrack(file.cameraPositionChunks, settings.countOfCameraChunks);
+    for (auto& chunk : file.cameraPositionChunks)
+      chunk.fov = 0.698132f;
+    generateCameraTrack(file.camerafocusChunks, settings.countOfFocusChunks);
+    generateEvents(file);
+    generateDialogs(file);
+    return file;
+  }
+};
+
+} // namespace RepFile
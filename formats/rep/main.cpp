@@ -1,12 +1,313 @@
+#include <cstdlib>
+#include <deque>
+
+#include "cache.hpp"
+#include "compact.hpp"
+#include "corpus.hpp"
+#include "decimate.hpp"
+#include "json.hpp"
+#include "push.hpp"
 #include "rep.hpp"
+#include "symbols.hpp"
+#include "timeline.hpp"
+#include "trajectory.hpp"
 using namespace RepFile;
+
+COUNT_ALLOCATIONS()
+
+static int processDirectory(const std::string& directory, size_t countOfThreads)
+{
+    ThreadPool pool(countOfThreads);
+    auto files = Corpus::findFiles(directory, ".rep");
+    auto report = Corpus::processFiles(files, [](const std::string& path, std::string& message) {
+        // each task owns its loader, nothing is shared between files
+        Loader loader;
+        ErrorCollector errors;
+        File file;
+        bool success = loader.loadFile(path, file, errors);
+        message = errors.lastError;
+        return success;
+    }, pool);
+    Corpus::printReport(report, std::cout);
+    return report.countOfFailures == 0 ? 0 : 1;
+}
+
+static int compactFile(const std::string& inputName, const std::string& outputName)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(inputName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    Compact::Statistics statistics;
+    if(!Compact::storeFile(file, outputName, &statistics))
+    {
+        std::cerr << "[Err] Failed to store " << outputName << std::endl;
+        return 1;
+    }
+    std::cout << "Tracks: " << statistics.rawTrackSize << " B -> "
+              << statistics.compactTrackSize << " B ("
+              << double(statistics.rawTrackSize) / std::max<size_t>(statistics.compactTrackSize, 1)
+              << "x)" << std::endl;
+    std::cout << "Compact file: " << statistics.compactSize << " B" << std::endl;
+    std::cout << "Max position error: " << statistics.maxPositionError
+              << " Max rotation error: " << statistics.maxRotationError << std::endl;
+    return 0;
+}
+
+static const float degreesToRadians = 3.14159265f / 180.0f;
+
+static int decimateFile(const std::string& inputName, const std::string& outputName,
+                        float maxPositionError, float maxRotationDegrees)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(inputName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    Decimation::Settings settings;
+    settings.maxPositionError = maxPositionError;
+    settings.maxRotationError = maxRotationDegrees * degreesToRadians;
+    Decimation::Statistics statistics;
+    if(!Decimation::decimate(file, settings, &statistics))
+        return 1;
+    std::cout << "Keys: " << statistics.countOfKeys << " -> "
+              << statistics.countOfKeptKeys << std::endl;
+    std::cout << "Tracks: " << statistics.streamSize << " B -> "
+              << statistics.decimatedStreamSize << " B ("
+              << double(statistics.streamSize) / std::max<size_t>(statistics.decimatedStreamSize, 1)
+              << "x)" << std::endl;
+    std::cout << "Max position error: " << statistics.maxPositionError
+              << " Max rotation error: " << statistics.maxRotationError / degreesToRadians
+              << " deg" << std::endl;
+    return loader.storeFile(file, outputName) ? 0 : 1;
+}
+
+static int findNear(const std::string& fileName, const Position& point, float radius,
+                    uint32_t timeMs)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(fileName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    TrajectoryIndex index;
+    index.add(file);
+    index.build();
+    for(const auto& hit : index.findObjectsNear(point, radius, timeMs))
+    {
+        const auto& object = file.animatedObjects[hit.object];
+        std::cout << object.frameName << " (" << object.actorName << ") ["
+                  << hit.position[0] << ", " << hit.position[1] << ", "
+                  << hit.position[2] << "] distance " << hit.distance << std::endl;
+    }
+    return 0;
+}
+
+static int findInRegion(const std::string& directory, const Spatial::Box& region)
+{
+    auto fileNames = Corpus::findFiles(directory, ".rep");
+    // deque keeps files in place while they're added to the index
+    std::deque<File> files;
+    std::vector<std::string> indexedNames;
+    TrajectoryIndex index;
+    for(const auto& fileName : fileNames)
+    {
+        Loader loader;
+        ErrorCollector errors;
+        files.emplace_back();
+        if(!loader.loadFile(fileName, files.back(), errors))
+        {
+            std::cerr << "[Warn] Skipping " << fileName << ": " << errors.lastError << std::endl;
+            files.pop_back();
+            continue;
+        }
+        index.add(files.back());
+        indexedNames.push_back(fileName);
+    }
+    index.build();
+    for(uint32_t file : index.findFilesIn(region))
+        std::cout << indexedNames[file] << std::endl;
+    return 0;
+}
+
+static int printTimeline(const std::string& fileName)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(fileName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    Timeline timeline(file);
+    for(const auto& event : timeline.getEvents())
+    {
+        std::cout << event.timestamp << " " << getEventTypeName(event.type) << " ";
+        switch(event.type)
+        {
+            case EVENT_SCRIPT:
+                std::cout << timeline.getScript(event).scriptName;
+                break;
+            case EVENT_SOUND_START:
+            case EVENT_SOUND_END:
+                std::cout << timeline.getSound(event).soundName;
+                break;
+            case EVENT_MORPH:
+                std::cout << timeline.getMorph(event).frameName;
+                break;
+            case EVENT_DIALOG:
+                std::cout << std::hex << timeline.getDialog(event).dialogID << std::dec;
+                break;
+            case EVENT_NARRATOR:
+                std::cout << timeline.getNarrator(event).speechID;
+                break;
+            case EVENT_FADE:
+                std::cout << timeline.getFade(event).getFlagsAsString();
+                break;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+static int findName(const std::string& fileName, const std::string& name)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(fileName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    NameIndex index(file);
+    bool isFound = false;
+    auto print = [&](const char* kind, size_t i) {
+        if(i == NameIndex::notFound)
+            return;
+        std::cout << kind << " " << i << std::endl;
+        isFound = true;
+    };
+    print("actor", index.findObjectByActor(name));
+    print("frame", index.findObjectByFrame(name));
+    print("animation", index.findAnimationByName(name));
+    if(!isFound)
+        std::cerr << "[Err] Name " << name << " not found" << std::endl;
+    return isFound ? 0 : 1;
+}
+
+static int loadCached(const std::string& cacheDirectory, const std::string& fileName)
+{
+    Cache cache(cacheDirectory);
+    CachedFile file;
+    auto start = std::chrono::steady_clock::now();
+    if(!cache.load(fileName, file))
+        return 1;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << (file.wasCached() ? "Hit" : "Miss") << ": " << fileName << " in "
+              << seconds * 1e3 << " ms (" << file.getArena().getCountOfObjects() << " objects, "
+              << file.getTimeline().size() << " events)" << std::endl;
+    return 0;
+}
+
+static int printStats(const std::string& fileName)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(fileName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    const LoadStats& stats = loader.getStats();
+    Json::printLoadStats(std::cout, fileName, stats, COUNT_OF_SECTIONS,
+                         [](size_t i) { return std::string(getSectionName(Section(i))); });
+    std::cout << ",\n  \"transformationTypes\": [";
+    for(size_t i = 0; i < 4; i++)
+        std::cout << stats.transformationTypes[i] << (i + 1 < 4 ? ", " : "");
+    std::cout << "]\n}" << std::endl;
+    return 0;
+}
+
+static int loadStdin()
+{
+    // the file is decoded as it comes, only the current chunk is buffered
+    DumpVisitor dumpVisitor;
+    PushParser parser(dumpVisitor, "<stdin>", false);
+    std::vector<char> fragment(64 * 1024);
+    while(std::cin.read(fragment.data(), fragment.size()) || std::cin.gcount() > 0)
+    {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(fragment.data());
+        if(!parser.feed(data, std::cin.gcount()))
+            return 1;
+    }
+    return parser.finish() ? 0 : 1;
+}
+
 int main(int argc, char** argv)
 {
     Loader loader;
     if(argc < 2)
     {
 	    std::cerr << "USAGE: pathToRecordFile.rec" << std::endl;
+	    std::cerr << "       --dir pathToDirectory [countOfThreads]" << std::endl;
+	    std::cerr << "       --compact inputFile outputFile" << std::endl;
+	    std::cerr << "       --decimate inputFile outputFile maxPositionError maxRotationDegrees" << std::endl;
+	    std::cerr << "       --timeline pathToRecordFile.rep" << std::endl;
+	    std::cerr << "       --find pathToRecordFile.rep name" << std::endl;
+	    std::cerr << "       --stats pathToRecordFile.rep" << std::endl;
+	    std::cerr << "       --near pathToRecordFile.rep x y z radius timeMs" << std::endl;
+	    std::cerr << "       --region pathToDirectory minX minY minZ maxX maxY maxZ" << std::endl;
+	    std::cerr << "       --cached pathToCacheDirectory pathToRecordFile.rep" << std::endl;
+	    std::cerr << "       --stdin < pathToRecordFile.rep" << std::endl;
 	    return 0;
     }
-    auto rep = loader.loadFile(argv[1]);
+    if(std::string(argv[1]) == "--dir" && argc > 2)
+    {
+        size_t countOfThreads = argc > 3 ? std::atoi(argv[3]) : std::thread::hardware_concurrency();
+        return processDirectory(argv[2], countOfThreads);
+    }
+    if(std::string(argv[1]) == "--compact" && argc > 3)
+        return compactFile(argv[2], argv[3]);
+    if(std::string(argv[1]) == "--decimate" && argc > 5)
+        return decimateFile(argv[2], argv[3], std::atof(argv[4]), std::atof(argv[5]));
+    if(std::string(argv[1]) == "--timeline" && argc > 2)
+        return printTimeline(argv[2]);
+    if(std::string(argv[1]) == "--find" && argc > 3)
+        return findName(argv[2], argv[3]);
+    if(std::string(argv[1]) == "--stats" && argc > 2)
+        return printStats(argv[2]);
+    if(std::string(argv[1]) == "--near" && argc > 7)
+    {
+        Position point{ float(std::atof(argv[3])), float(std::atof(argv[4])), float(std::atof(argv[5])) };
+        return findNear(argv[2], point, std::atof(argv[6]), std::strtoul(argv[7], nullptr, 10));
+    }
+    if(std::string(argv[1]) == "--region" && argc > 8)
+    {
+        Spatial::Box region;
+        for(size_t c = 0; c < 3; c++)
+        {
+            region.min[c] = std::atof(argv[3 + c]);
+            region.max[c] = std::atof(argv[6 + c]);
+        }
+        return findInRegion(argv[2], region);
+    }
+    if(std::string(argv[1]) == "--cached" && argc > 3)
+        return loadCached(argv[2], argv[3]);
+    if(std::string(argv[1]) == "--stdin")
+        return loadStdin();
+    DumpVisitor dumpVisitor;
+    auto rep = loader.loadFile(argv[1], dumpVisitor);
 }
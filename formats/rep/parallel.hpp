@@ -0,0 +1,228 @@
+#pragma once
+/*
+ * .rep parallel loader
+ * Author: Roman Romop5 Dobias
+ * Purpose: decode transformation streams of large cutscenes on all cores
+ */
+
+#include <atomic>
+#include <numeric>
+
+#include "threadpool.hpp"
+#include "view.hpp"
+
+namespace RepFile {
+
+/* \brief Loads .rep into File using a thread pool
+ *
+ * The file is mapped (View), which locates every object stream by its
+ * positionOfTheBeginning / sizeOfStreamSection and every other section by
+ * header sizes. Then each object stream is decoded by its own task, the
+ * largest ones first, while camera, event and dialog sections are copied by
+ * other tasks. With a single worker, tasks run on the calling thread, as
+ * two threads would only compete for one core. The resulting File is the
+ * same as the one of Loader.
+ *
+ * Per-chunk callbacks would come from many threads, thus the Visitor only
+ * receives onBeginFile, onError and onWarning (from the calling thread).
+ * The pool can be shared with other work, loadFile() only waits for its own
+ * tasks.
+ */
+class ParallelLoader
+{
+private:
+  ThreadPool* pool;
+
+  /* \brief Decodes object stream (already checked by scanObjectStream)
+   *
+   * Counts are known from the scan, thus the track is sized once and keys
+   * are written in place, as Arena does, instead of TransformTrack::push().
+   */
+  static void decodeStream(Span<const unsigned char> stream,
+                           const AnimatedObjectDefinitions& object,
+                           size_t countOfKeys,
+                           size_t extraSize,
+                           TransformTrack& track)
+  {
+    memcpy(&track.streamHeader, stream.data(), sizeof(track.streamHeader));
+    track.timestamps.resize(countOfKeys);
+    track.types.resize(countOfKeys);
+    track.positions.resize(countOfKeys);
+    track.rotations.resize(countOfKeys);
+    track.auxiliary.resize(countOfKeys);
+    track.animationStartOffsets.resize(countOfKeys);
+    track.extraPayload.resize(extraSize);
+
+    TransformPayload body;
+    memset(&body, 0, sizeof(body));
+    unsigned char* extra = track.extraPayload.data();
+    size_t key = 0;
+    ChunkDecoders::decodeStream(
+      stream.data(), stream.size(), object.sizeOfBlocks,
+      [&](size_t, const TransformationHeader& header,
+          const unsigned char* payload, auto payloadLength) {
+        size_t bodyLength =
+          std::min<size_t>(payloadLength, sizeof(TransformPayload));
+        // short chunks inherit position / rotation of the previous key
+        body.auxiliary = 0;
+        body.animationStartOffset = 0;
+        memcpy(&body, payload, bodyLength);
+        if (payloadLength > bodyLength) {
+          memcpy(extra, payload + bodyLength, payloadLength - bodyLength);
+          extra += payloadLength - bodyLength;
+        }
+
+        track.timestamps[key] = header.timestamp;
+        track.types[key] = header.type;
+        memcpy(track.positions[key].data(), body.position,
+               sizeof(body.position));
+        memcpy(track.rotations[key].data(), body.rotation,
+               sizeof(body.rotation));
+        track.auxiliary[key] = body.auxiliary;
+        track.animationStartOffsets[key] = body.animationStartOffset;
+        key++;
+      });
+  }
+
+  /// Counts keys referring to animation IDs without animation block
+  static size_t countInvalidIDs(const TransformTrack& track,
+                                const AnimationTable& animations,
+                                size_t& firstInvalidID)
+  {
+    size_t count = 0;
+    for (uint32_t auxiliary : track.auxiliary) {
+      if ((auxiliary & ANIMATION_HAS_ID) &&
+          !animations.contains(auxiliary & 0x3FF)) {
+        if (count++ == 0)
+          firstInvalidID = auxiliary & 0x3FF;
+      }
+    }
+    return count;
+  }
+
+  template<typename T>
+  static void assign(std::vector<T>& vector, Span<const T> span)
+  {
+    vector.assign(span.begin(), span.end());
+  }
+
+  bool decode(const View& view, File& file, Visitor& visitor)
+  {
+    file = File();
+    file.header = view.getHeader();
+    assign(file.animationBlocks, view.getAnimationBlocks());
+    assign(file.animatedObjects, view.getAnimatedObjects());
+    file.updateAnimationTable();
+
+    const auto& objects = file.animatedObjects;
+    std::vector<size_t> countsOfKeys(objects.size());
+    std::vector<size_t> extraSizes(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) {
+      if (!scanObjectStream(view.getObjectStream(i), objects[i],
+                            countsOfKeys[i], extraSizes[i])) {
+        visitor.onError("Invalid chunk in transformation stream of object " +
+                        std::to_string(i));
+        return false;
+      }
+    }
+
+    // the biggest streams go first, thus they don't finish last
+    std::vector<size_t> order(objects.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return objects[a].sizeOfStreamSection > objects[b].sizeOfStreamSection;
+    });
+
+    const size_t countOfSectionTasks = 3;
+    file.transformTracks.resize(objects.size());
+    auto runTask = [&](size_t task) {
+      switch (task) {
+        case 0:
+          assign(file.cameraPositionChunks, view.getCameraPositionChunks());
+          assign(file.camerafocusChunks, view.getCameraFocusChunks());
+          return;
+        case 1:
+          file.eventsHeader = view.getEventsHeader();
+          assign(file.eventsPostheaderData, view.getEventsPostheaderData());
+          assign(file.fadeChunks, view.getFadeChunks());
+          assign(file.scriptChunks, view.getScriptChunks());
+          assign(file.soundChunks, view.getSoundChunks());
+          return;
+        case 2:
+          file.dialogHeader = view.getDialogHeader();
+          assign(file.dialogChunks, view.getDialogChunks());
+          assign(file.narratorChunks, view.getNarratorChunks());
+          assign(file.morphChunks, view.getMorphChunks());
+          return;
+        default:
+          break;
+      }
+      size_t i = order[task - countOfSectionTasks];
+      decodeStream(view.getObjectStream(i), objects[i], countsOfKeys[i],
+                   extraSizes[i], file.transformTracks[i]);
+    };
+    size_t countOfTasks = countOfSectionTasks + objects.size();
+    if (pool->size() > 1) {
+      pool->parallelFor(countOfTasks, runTask);
+    } else {
+      // a single worker would only compete with this thread for the core
+      for (size_t task = 0; task < countOfTasks; task++)
+        runTask(task);
+    }
+
+    size_t countOfInvalidIDs = 0, firstInvalidID = 0, firstInvalidObject = 0;
+    for (size_t i = 0; i < objects.size(); i++) {
+      size_t invalidID = 0;
+      size_t count =
+        countInvalidIDs(file.transformTracks[i], file.animationTable, invalidID);
+      if (count > 0 && countOfInvalidIDs == 0) {
+        firstInvalidID = invalidID;
+        firstInvalidObject = i;
+      }
+      countOfInvalidIDs += count;
+    }
+    if (countOfInvalidIDs > 0)
+      visitor.onWarning(std::to_string(countOfInvalidIDs) +
+                        " transformation chunks refer to missing animations"
+                        " (first: ID " + std::to_string(firstInvalidID) +
+                        " of object " + std::to_string(firstInvalidObject) +
+                        ")");
+    return true;
+  }
+
+public:
+  explicit ParallelLoader(ThreadPool& threadPool)
+    : pool(&threadPool)
+  {}
+
+  /// Parses file into file, returns false (and reports an error) on failure
+  bool loadFile(const std::string& fileName, File& file, Visitor& visitor)
+  {
+    visitor.onBeginFile(fileName);
+    View view;
+    if (!view.open(fileName)) {
+      visitor.onError("Failed to load file " + fileName);
+      return false;
+    }
+    return decode(view, file, visitor);
+  }
+
+  bool loadFile(const std::string& fileName, File& file)
+  {
+    Visitor silentVisitor;
+    return loadFile(fileName, file, silentVisitor);
+  }
+
+  /// Parses file already stored in memory
+  bool load(const void* data, size_t size, File& file, Visitor& visitor)
+  {
+    View view;
+    if (!view.open(data, size)) {
+      visitor.onError("Invalid .rep file");
+      return false;
+    }
+    return decode(view, file, visitor);
+  }
+};
+
+} // namespace RepFile
@@ -0,0 +1,122 @@
+/*
+ * Pose evaluation benchmark
+ * Author: Roman Romop5 Dobias
+ * Purpose: compares BatchEvaluator with per-object Sampler loop on a synthetic
+ * cutscene
+ */
+#include <chrono>
+#include <cstdlib>
+
+#include "batch.hpp"
+using namespace RepFile;
+
+static File createSyntheticCutscene(size_t countOfObjects, size_t countOfKeys)
+{
+  File file;
+  file.transformTracks.resize(countOfObjects);
+  uint32_t seed = 1;
+  auto random = [&seed]() {
+    seed = seed * 1103515245 + 12345;
+    return float((seed >> 8) & 0xFFFF) / 65535.0f;
+  };
+  for (size_t object = 0; object < countOfObjects; object++) {
+    auto& track = file.transformTracks[object];
+    track.reserve(countOfKeys);
+    for (size_t key = 0; key < countOfKeys; key++) {
+      TransformationHeader header;
+      // objects are recorded at slightly different rates
+      header.timestamp = uint32_t(key * (40 + object % 7));
+      header.type = 2;
+      TransformPayload body;
+      for (size_t c = 0; c < 3; c++)
+        body.position[c] = random() * 100.0f;
+      float length = 0.0f;
+      for (size_t c = 0; c < 4; c++) {
+        body.rotation[c] = random() - 0.5f;
+        length += body.rotation[c] * body.rotation[c];
+      }
+      for (size_t c = 0; c < 4; c++)
+        body.rotation[c] /= std::sqrt(length);
+      body.auxiliary = ANIMATION_SHOULD_INTERPOLATE | ANIMATION_HAS_ID;
+      body.animationStartOffset = 0;
+      track.push(header, reinterpret_cast<unsigned char*>(&body), sizeof(body));
+    }
+  }
+  return file;
+}
+
+int main(int argc, char** argv)
+{
+  size_t countOfObjects = argc > 1 ? std::atoi(argv[1]) : 500;
+  size_t countOfKeys = argc > 2 ? std::atoi(argv[2]) : 2000;
+  const uint32_t frameTime = 16;
+
+  File file = createSyntheticCutscene(countOfObjects, countOfKeys);
+  Sampler sampler(file);
+  uint32_t duration = uint32_t(countOfKeys * 40);
+  size_t countOfFrames = duration / frameTime;
+
+  std::vector<Position> positions(countOfObjects);
+  std::vector<Rotation> rotations(countOfObjects);
+  std::vector<Position> batchPositions(countOfObjects);
+  std::vector<Rotation> batchRotations(countOfObjects);
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  auto cursor = sampler.createCursor();
+  for (uint32_t time = 0; time < duration; time += frameTime) {
+    for (size_t i = 0; i < countOfObjects; i++) {
+      Pose pose = cursor.poseAt(i, time);
+      positions[i] = pose.position;
+      rotations[i] = pose.rotation;
+    }
+  }
+  double scalarTime =
+    std::chrono::duration<double>(Clock::now() - start).count();
+
+  double batchTimes[2];
+  float maxError[2] = { 0.0f, 0.0f };
+  RotationInterpolation modes[2] = { ROTATION_NLERP, ROTATION_SLERP };
+  for (size_t mode = 0; mode < 2; mode++) {
+    BatchEvaluator evaluator(sampler, modes[mode]);
+    start = Clock::now();
+    for (uint32_t time = 0; time < duration; time += frameTime)
+      evaluator.evaluate(time, batchPositions.data(), batchRotations.data());
+    batchTimes[mode] =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+    // compare the last frame with the scalar path
+    for (size_t i = 0; i < countOfObjects; i++) {
+      for (size_t c = 0; c < 3; c++)
+        maxError[mode] = std::max(
+          maxError[mode], std::fabs(positions[i][c] - batchPositions[i][c]));
+      for (size_t c = 0; c < 4; c++)
+        maxError[mode] = std::max(
+          maxError[mode], std::fabs(rotations[i][c] - batchRotations[i][c]));
+    }
+  }
+
+  const char* instructionSet =
+#if defined(__AVX2__)
+    "AVX2";
+#elif defined(__SSE2__)
+    "SSE2";
+#else
+    "scalar";
+#endif
+  double poses = double(countOfFrames) * countOfObjects;
+  std::cout << "Objects: " << countOfObjects << " Keys: " << countOfKeys
+            << " Frames: " << countOfFrames << " SIMD: " << instructionSet
+            << std::endl;
+  std::cout << "Scalar loop:   " << scalarTime * 1e3 << " ms ("
+            << poses / scalarTime / 1e6 << " Mposes/s)" << std::endl;
+  std::cout << "Batch (nlerp): " << batchTimes[0] * 1e3 << " ms ("
+            << poses / batchTimes[0] / 1e6 << " Mposes/s, speedup "
+            << scalarTime / batchTimes[0] << "x, max diff " << maxError[0]
+            << ")" << std::endl;
+  std::cout << "Batch (slerp): " << batchTimes[1] * 1e3 << " ms ("
+            << poses / batchTimes[1] / 1e6 << " Mposes/s, speedup "
+            << scalarTime / batchTimes[1] << "x, max diff " << maxError[1]
+            << ")" << std::endl;
+  return 0;
+}
@@ -0,0 +1,534 @@
+#pragma once
+/*
+ * .rep push parser
+ * Author: Roman Romop5 Dobias
+ * Purpose: decode .rep received in fragments (pipes, decompressors, archives)
+ */
+
+#include "records.hpp"
+#include "rep.hpp"
+
+namespace RepFile {
+
+/* \brief Resumable parser, which is fed with arbitrary fragments of .rep
+ *
+ * A state machine over the sections of file: each call of feed() decodes all
+ * records completed by the fragment and keeps only the incomplete one, thus
+ * the parser holds at most a single chunk (a transformation chunk, a header,
+ * ...) and never seeks. Visitor receives the same calls in the same order as
+ * from Loader::loadFile(), including onStreamPosition().
+ *
+ * Unless keepContent is false, the content is also gathered into File
+ * (getFile()), which is then the same as the one of Loader. Without it, only
+ * animation blocks and object definitions are kept (the layout of
+ * transformation streams depends on them).
+ *
+ * Bytes after the dialog section are ignored as Loader does.
+ */
+class PushParser
+{
+private:
+  enum State
+  {
+    STATE_HEADER,
+    STATE_ANIMATIONS,
+    STATE_OBJECTS,
+    STATE_STREAM_HEADER,
+    STATE_CHUNK_HEADER,
+    STATE_CHUNK_PAYLOAD,
+    STATE_CAMERA,
+    STATE_CAMERA_FOCUS,
+    STATE_EVENTS_HEADER,
+    STATE_POSTHEADER,
+    STATE_FADES,
+    STATE_SCRIPTS,
+    STATE_SOUNDS,
+    STATE_DIALOG_HEADER,
+    STATE_DIALOGS,
+    STATE_NARRATORS,
+    STATE_MORPHS,
+    STATE_DONE,
+    STATE_FAILED
+  };
+
+  Visitor& visitor;
+  bool keepContent;
+  std::string sourceName;
+  Records::RecordReader reader;
+  State state;
+  File currentFile;
+  size_t streamPosition;
+  // chunks of the current section
+  size_t chunkIndex;
+  size_t countOfChunks;
+  // transformation stream of the current object
+  size_t objectIndex;
+  size_t sectionOffset;
+  size_t streamOffset;
+  size_t streamSize;
+  TransformationHeader chunkHeader;
+  TransformPayload lastPayload;
+  size_t countOfInvalidIDs;
+  size_t firstInvalidID, firstInvalidObject;
+  size_t remainingPostheaderData;
+
+  void fail(const std::string& message)
+  {
+    visitor.onError(message);
+    state = STATE_FAILED;
+  }
+
+  /// Starts count chunks of given size, returns false if there are none
+  bool expectChunks(State chunkState, size_t count, size_t chunkSize)
+  {
+    chunkIndex = 0;
+    countOfChunks = count;
+    if (count == 0)
+      return false;
+    state = chunkState;
+    reader.expect(chunkSize);
+    return true;
+  }
+
+  /// Returns true after the last chunk of the current section
+  bool isLastChunk() { return ++chunkIndex == countOfChunks; }
+
+  template<typename T>
+  static T decode(const unsigned char* record)
+  {
+    T value;
+    memcpy(&value, record, sizeof(value));
+    return value;
+  }
+
+  void beginAnimations()
+  {
+    visitor.onSection(SECTION_ANIMATIONS);
+    if (!expectChunks(STATE_ANIMATIONS,
+                      currentFile.header.countOfAnimationBlocks,
+                      sizeof(AnimationBlock)))
+      beginObjects();
+  }
+
+  void beginObjects()
+  {
+    currentFile.updateAnimationTable();
+    visitor.onSection(SECTION_OBJECTS);
+    if (!expectChunks(STATE_OBJECTS,
+                      currentFile.header.countOfObjectDefinitionBlocks,
+                      sizeof(AnimatedObjectDefinitions)))
+      beginTransformation();
+  }
+
+  void beginTransformation()
+  {
+    visitor.onSection(SECTION_TRANSFORMATIONS);
+    if (keepContent)
+      currentFile.transformTracks.resize(currentFile.animatedObjects.size());
+    objectIndex = 0;
+    sectionOffset = 0;
+    countOfInvalidIDs = 0;
+    beginObjectStream();
+  }
+
+  void beginObjectStream()
+  {
+    if (objectIndex == currentFile.animatedObjects.size()) {
+      endTransformation();
+      return;
+    }
+    visitor.onStreamPosition(streamPosition);
+    const auto& object = currentFile.animatedObjects[objectIndex];
+    visitor.onObjectStream(objectIndex, object);
+    streamSize = object.sizeOfStreamSection;
+    if (streamSize < sizeof(TransformationHeader)) {
+      failStream();
+      return;
+    }
+    memset(&lastPayload, 0, sizeof(lastPayload));
+    state = STATE_STREAM_HEADER;
+    reader.expect(sizeof(TransformationHeader));
+  }
+
+  void failStream()
+  {
+    fail("Invalid chunk in transformation stream of object " +
+         std::to_string(objectIndex));
+  }
+
+  void beginChunk()
+  {
+    if (streamOffset == streamSize) {
+      sectionOffset += streamSize;
+      objectIndex++;
+      beginObjectStream();
+    } else if (streamSize - streamOffset < sizeof(TransformationHeader)) {
+      failStream();
+    } else {
+      state = STATE_CHUNK_HEADER;
+      reader.expect(sizeof(TransformationHeader));
+    }
+  }
+
+  void readChunkHeader(const unsigned char* record)
+  {
+    chunkHeader = decode<TransformationHeader>(record);
+    const auto& object = currentFile.animatedObjects[objectIndex];
+    if (chunkHeader.type >= 4 ||
+        object.sizeOfBlocks[chunkHeader.type] < sizeof(TransformationHeader) ||
+        object.sizeOfBlocks[chunkHeader.type] > streamSize - streamOffset) {
+      failStream();
+      return;
+    }
+    size_t payloadLength =
+      object.sizeOfBlocks[chunkHeader.type] - sizeof(TransformationHeader);
+    if (payloadLength > 0) {
+      state = STATE_CHUNK_PAYLOAD;
+      reader.expect(payloadLength);
+      return;
+    }
+    readKey(record, 0);
+  }
+
+  void readKey(const unsigned char* payload, size_t payloadLength)
+  {
+    TransformPayload body;
+    if (keepContent) {
+      auto& track = currentFile.transformTracks[objectIndex];
+      track.push(chunkHeader, payload, payloadLength);
+      body = track.getPayload(track.size() - 1);
+    } else {
+      // the same as TransformTrack::push() does
+      body = lastPayload;
+      body.auxiliary = 0;
+      body.animationStartOffset = 0;
+      memcpy(&body, payload, std::min(payloadLength, sizeof(TransformPayload)));
+      lastPayload = body;
+    }
+    visitor.onTransform(objectIndex, sectionOffset + streamOffset, chunkHeader,
+                        payloadLength, body);
+    if ((body.auxiliary & ANIMATION_HAS_ID) &&
+        !currentFile.animationTable.contains(body.auxiliary & 0x3FF)) {
+      if (countOfInvalidIDs++ == 0) {
+        firstInvalidID = body.auxiliary & 0x3FF;
+        firstInvalidObject = objectIndex;
+      }
+    }
+    streamOffset += sizeof(TransformationHeader) + payloadLength;
+    beginChunk();
+  }
+
+  /* \brief Decodes chunks lying completely in fragment without the reader
+   *
+   * Returns false if there was no such chunk.
+   */
+  bool readChunks(const unsigned char*& data, size_t& size)
+  {
+    bool hasProgress = false;
+    while (state == STATE_CHUNK_HEADER && size >= sizeof(TransformationHeader)) {
+      const auto& object = currentFile.animatedObjects[objectIndex];
+      chunkHeader = decode<TransformationHeader>(data);
+      if (chunkHeader.type >= 4 ||
+          object.sizeOfBlocks[chunkHeader.type] < sizeof(TransformationHeader) ||
+          object.sizeOfBlocks[chunkHeader.type] > streamSize - streamOffset) {
+        failStream();
+        return true;
+      }
+      size_t chunkSize = object.sizeOfBlocks[chunkHeader.type];
+      if (chunkSize > size)
+        break;
+      streamPosition += chunkSize;
+      readKey(data + sizeof(TransformationHeader),
+              chunkSize - sizeof(TransformationHeader));
+      data += chunkSize;
+      size -= chunkSize;
+      hasProgress = true;
+    }
+    return hasProgress;
+  }
+
+  void endTransformation()
+  {
+    if (countOfInvalidIDs > 0)
+      visitor.onWarning(std::to_string(countOfInvalidIDs) +
+                        " transformation chunks refer to missing animations"
+                        " (first: ID " + std::to_string(firstInvalidID) +
+                        " of object " + std::to_string(firstInvalidObject) +
+                        ")");
+    visitor.onStreamPosition(streamPosition);
+    visitor.onSection(SECTION_CAMERA);
+    if (!expectChunks(STATE_CAMERA, currentFile.header.countOfCameraChunks,
+                      sizeof(CameraTransformationChunk)))
+      beginCameraFocus();
+  }
+
+  void beginCameraFocus()
+  {
+    visitor.onStreamPosition(streamPosition);
+    if (!expectChunks(STATE_CAMERA_FOCUS,
+                      currentFile.header.countOfCameraFocusChunks,
+                      sizeof(CameraFocusChunk)))
+      beginEvents();
+  }
+
+  void beginEvents()
+  {
+    visitor.onStreamPosition(streamPosition);
+    visitor.onSection(SECTION_EVENTS);
+    state = STATE_EVENTS_HEADER;
+    reader.expect(sizeof(ScriptsAndSoundsHeader));
+  }
+
+  void readEventsHeader(const unsigned char* record)
+  {
+    auto header = decode<ScriptsAndSoundsHeader>(record);
+    visitor.onEventsHeader(header);
+    currentFile.eventsHeader = header;
+    remainingPostheaderData = header.sizeOfPostheaderData;
+    if (remainingPostheaderData > 0)
+      state = STATE_POSTHEADER;
+    else
+      beginFades();
+  }
+
+  /// Post-header data has no structure, it's passed through as it comes
+  void readPostheaderData(const unsigned char*& data, size_t& size)
+  {
+    size_t count = std::min(remainingPostheaderData, size);
+    if (keepContent)
+      currentFile.eventsPostheaderData.insert(
+        currentFile.eventsPostheaderData.end(), data, data + count);
+    data += count;
+    size -= count;
+    streamPosition += count;
+    remainingPostheaderData -= count;
+    if (remainingPostheaderData == 0)
+      beginFades();
+  }
+
+  void beginFades()
+  {
+    if (!expectChunks(STATE_FADES,
+                      currentFile.eventsHeader.sizeOfFadeSection / 32,
+                      sizeof(FadeChunk)))
+      beginScripts();
+  }
+
+  void beginScripts()
+  {
+    if (!expectChunks(STATE_SCRIPTS,
+                      currentFile.eventsHeader.sizeOfScriptSection / 40,
+                      sizeof(ScriptChunk)))
+      beginSounds();
+  }
+
+  void beginSounds()
+  {
+    if (!expectChunks(STATE_SOUNDS,
+                      currentFile.eventsHeader.sizeOfSoundSection / 40,
+                      sizeof(SoundChunk)))
+      beginDialogs();
+  }
+
+  void beginDialogs()
+  {
+    visitor.onSection(SECTION_DIALOGS);
+    state = STATE_DIALOG_HEADER;
+    reader.expect(sizeof(DialogHeader));
+  }
+
+  void readDialogHeader(const unsigned char* record)
+  {
+    auto header = decode<DialogHeader>(record);
+    currentFile.dialogHeader = header;
+    visitor.onDialogHeader(header);
+    beginDialogChunks();
+  }
+
+  void beginDialogChunks()
+  {
+    if (!expectChunks(STATE_DIALOGS, currentFile.dialogHeader.countOfDialogs,
+                      sizeof(DialogChunk)))
+      beginNarrators();
+  }
+
+  void beginNarrators()
+  {
+    if (!expectChunks(STATE_NARRATORS,
+                      currentFile.dialogHeader.countOfNarratorChunks,
+                      sizeof(NarratorChunk)))
+      beginMorphs();
+  }
+
+  void beginMorphs()
+  {
+    if (!expectChunks(STATE_MORPHS, currentFile.dialogHeader.unk2,
+                      sizeof(MorphChunk)))
+      state = STATE_DONE;
+  }
+
+  /// Appends chunk to content (if kept) and returns it
+  template<typename T>
+  T readChunk(const unsigned char* record, std::vector<T>& chunks)
+  {
+    T chunk = decode<T>(record);
+    if (keepContent)
+      chunks.push_back(chunk);
+    return chunk;
+  }
+
+  void readRecord(const unsigned char* record)
+  {
+    switch (state) {
+      case STATE_HEADER:
+        currentFile.header = decode<Header>(record);
+        visitor.onHeader(currentFile.header);
+        if (currentFile.header.magicByte != magicByteConstant)
+          fail("Invalid magic byte ...\n");
+        else
+          beginAnimations();
+        break;
+      case STATE_ANIMATIONS:
+        currentFile.animationBlocks.push_back(decode<AnimationBlock>(record));
+        visitor.onAnimation(currentFile.animationBlocks.back());
+        if (isLastChunk())
+          beginObjects();
+        break;
+      case STATE_OBJECTS:
+        currentFile.animatedObjects.push_back(
+          decode<AnimatedObjectDefinitions>(record));
+        visitor.onObject(chunkIndex, currentFile.animatedObjects.back());
+        if (isLastChunk())
+          beginTransformation();
+        break;
+      case STATE_STREAM_HEADER:
+        if (keepContent)
+          currentFile.transformTracks[objectIndex].streamHeader =
+            decode<TransformationHeader>(record);
+        streamOffset = sizeof(TransformationHeader);
+        beginChunk();
+        break;
+      case STATE_CHUNK_HEADER:
+        readChunkHeader(record);
+        break;
+      case STATE_CHUNK_PAYLOAD:
+        readKey(record, reader.getLength());
+        break;
+      case STATE_CAMERA:
+        visitor.onCameraChunk(
+          readChunk(record, currentFile.cameraPositionChunks));
+        if (isLastChunk())
+          beginCameraFocus();
+        break;
+      case STATE_CAMERA_FOCUS:
+        visitor.onCameraFocusChunk(
+          readChunk(record, currentFile.camerafocusChunks));
+        if (isLastChunk())
+          beginEvents();
+        break;
+      case STATE_EVENTS_HEADER:
+        readEventsHeader(record);
+        break;
+      case STATE_FADES:
+        visitor.onFade(readChunk(record, currentFile.fadeChunks));
+        if (isLastChunk())
+          beginScripts();
+        break;
+      case STATE_SCRIPTS:
+        visitor.onScript(readChunk(record, currentFile.scriptChunks));
+        if (isLastChunk())
+          beginSounds();
+        break;
+      case STATE_SOUNDS:
+        visitor.onSound(readChunk(record, currentFile.soundChunks));
+        if (isLastChunk())
+          beginDialogs();
+        break;
+      case STATE_DIALOG_HEADER:
+        readDialogHeader(record);
+        break;
+      case STATE_DIALOGS:
+        visitor.onDialog(readChunk(record, currentFile.dialogChunks));
+        if (isLastChunk())
+          beginNarrators();
+        break;
+      case STATE_NARRATORS:
+        visitor.onNarrator(readChunk(record, currentFile.narratorChunks));
+        if (isLastChunk())
+          beginMorphs();
+        break;
+      case STATE_MORPHS:
+        visitor.onMorph(readChunk(record, currentFile.morphChunks));
+        if (isLastChunk())
+          state = STATE_DONE;
+        break;
+      default:
+        break;
+    }
+  }
+
+public:
+  explicit PushParser(Visitor& fileVisitor,
+                      const std::string& name = "<stream>",
+                      bool shouldKeepContent = true)
+    : visitor(fileVisitor)
+    , keepContent(shouldKeepContent)
+  {
+    reset(name);
+  }
+
+  /// Starts parsing of another file, name is passed to Visitor::onBeginFile()
+  void reset(const std::string& name)
+  {
+    sourceName = name;
+    currentFile = File();
+    streamPosition = 0;
+    state = STATE_HEADER;
+    reader.expect(sizeof(Header));
+    visitor.onBeginFile(sourceName);
+  }
+
+  /* \brief Decodes fragment, which follows the previously fed ones
+   *
+   * Returns false (and reports an error) if the file is invalid, further
+   * fragments are ignored then.
+   */
+  bool feed(const uint8_t* data, size_t size)
+  {
+    const unsigned char* fragment = data;
+    while (size > 0 && state != STATE_DONE && state != STATE_FAILED) {
+      if (state == STATE_POSTHEADER) {
+        readPostheaderData(fragment, size);
+        continue;
+      }
+      if (state == STATE_CHUNK_HEADER && reader.getCountOfPending() == 0 &&
+          readChunks(fragment, size))
+        continue;
+      const unsigned char* record = reader.next(fragment, size);
+      if (!record)
+        break;
+      streamPosition += reader.getLength();
+      readRecord(record);
+    }
+    return state != STATE_FAILED;
+  }
+
+  /// Call after the last fragment, reports files ending before dialogs
+  bool finish()
+  {
+    if (state == STATE_DONE)
+      return true;
+    if (state != STATE_FAILED)
+      fail("Unexpected end of file " + sourceName);
+    return false;
+  }
+
+  bool isDone() const { return state == STATE_DONE; }
+  bool hasFailed() const { return state == STATE_FAILED; }
+  /// Count of decoded bytes (without the incomplete record)
+  size_t getPosition() const { return streamPosition; }
+  /// Content parsed so far, complete once isDone()
+  File& getFile() { return currentFile; }
+};
+
+} // namespace RepFile
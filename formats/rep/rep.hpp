@@ -5,14 +5,23 @@
  * Credits also go to guys from Lost Heaven Modding's wiki, who provided basics
  * of .rep structure
  */
+#pragma once
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <string.h>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include "allocations.hpp"
+#include "hash.hpp"
+
 /* \brief Stores cutscene directives
  *
  * .rep files contains directives for performing cutscenes.
@@ -53,8 +62,8 @@ struct Header
   uint32_t sizeOfAnimationSection; // the size (in bytes) of all animation
                                    // blocks together
   uint32_t
-    sizeOfObjectDefinitionsSection; // contains positions (with some auxiliary
-                                    // info) = probably camera tracks ?
+    sizeOfObjectDefinitionsSection; // the size (in bytes) of transformation
+                                    // stream of all objects together
   uint32_t countOfObjectDefinitionBlocks; // *108 to get size in bytes
   uint32_t fixedCCSequence;               // always contains 0xCC CC CC CC
   uint32_t countOfCameraChunks;           // each chunk has 64 bytes
@@ -176,12 +185,12 @@ struct TransformPayload
   uint32_t
     animationStartOffset; // last 0xFFF goes for animation frame offset (ahead) * 40 to get time in miliseconds
 
-  size_t getAnimationID() { return this->auxiliary & 0x3FF; }
+  size_t getAnimationID() const { return this->auxiliary & 0x3FF; }
   bool hasAnimationID() const { return this->auxiliary & ANIMATION_HAS_ID; }
   bool shouldInterpolate() const { return this->auxiliary & ANIMATION_SHOULD_INTERPOLATE; }
   bool shouldRepeat() const { return this->auxiliary & ANIMATION_SHOULD_REPEAT; }
 
-  size_t getFlags() { return this->auxiliary >> 12; }
+  size_t getFlags() const { return this->auxiliary >> 12; }
   std::string getFlagsAsString() const {
       std::string flags;
       if(shouldRepeat())
@@ -198,7 +207,7 @@ struct TransformPayload
       }
       return flags;
   };
-  size_t getAnimationOffset() { return this->animationStartOffset & 0xFFF; } 
+  size_t getAnimationOffset() const { return this->animationStartOffset & 0xFFF; }
 };
 
 /* \brief Describes camera position, rotation and FOV
@@ -345,308 +354,1365 @@ struct MorphChunk
 
 #pragma pack(pop)
 
+typedef std::array<float, 3> Position;
+typedef std::array<float, 4> Rotation;
+
+/* \brief Decoded transformation stream of a single animated object
+ *
+ * Keys are stored as struct-of-arrays: each channel lives in its own
+ * contiguous array, indexed by the key number. Thus, a sweep over timestamps
+ * or positions touches only the memory of that channel.
+ *
+ * Chunks, which are shorter than TransformPayload, inherit missing
+ * position/rotation from the previous key. Bytes of chunks, which are longer
+ * than TransformPayload, are kept in extraPayload in stream order.
+ */
+class TransformTrack
+{
+public:
+  TransformationHeader streamHeader; // leading 8 bytes of each object stream
+  std::vector<uint32_t> timestamps;
+  std::vector<uint32_t> types; // index into sizeOfBlocks
+  std::vector<Position> positions;
+  std::vector<Rotation> rotations;
+  std::vector<uint32_t> auxiliary; // animation ID + flags (TransformPayload)
+  std::vector<uint32_t> animationStartOffsets;
+  std::vector<unsigned char> extraPayload;
+
+  size_t size() const { return timestamps.size(); }
+
+  void reserve(size_t countOfKeys)
+  {
+    timestamps.reserve(countOfKeys);
+    types.reserve(countOfKeys);
+    positions.reserve(countOfKeys);
+    rotations.reserve(countOfKeys);
+    auxiliary.reserve(countOfKeys);
+    animationStartOffsets.reserve(countOfKeys);
+  }
+
+  /// Appends key decoded from chunk's header and its payload
+  void push(const TransformationHeader& header,
+            const unsigned char* payload,
+            size_t payloadLength)
+  {
+    TransformPayload body;
+    if (size() > 0) {
+      body = getPayload(size() - 1);
+      body.auxiliary = 0;
+      body.animationStartOffset = 0;
+    } else {
+      memset(&body, 0, sizeof(body));
+    }
+    size_t bodyLength = std::min(payloadLength, sizeof(TransformPayload));
+    memcpy(&body, payload, bodyLength);
+    extraPayload.insert(extraPayload.end(), payload + bodyLength,
+                        payload + payloadLength);
+
+    timestamps.push_back(header.timestamp);
+    types.push_back(header.type);
+    positions.push_back(
+      Position{ body.position[0], body.position[1], body.position[2] });
+    rotations.push_back(Rotation{ body.rotation[0], body.rotation[1],
+                                  body.rotation[2], body.rotation[3] });
+    auxiliary.push_back(body.auxiliary);
+    animationStartOffsets.push_back(body.animationStartOffset);
+  }
+
+  /// Gathers i-th key back into the packed on-disk layout
+  TransformPayload getPayload(size_t i) const
+  {
+    TransformPayload body;
+    memcpy(body.position, positions[i].data(), sizeof(body.position));
+    memcpy(body.rotation, rotations[i].data(), sizeof(body.rotation));
+    body.auxiliary = auxiliary[i];
+    body.animationStartOffset = animationStartOffsets[i];
+    return body;
+  }
+};
+
+/// Animation IDs in TransformPayload have 10 bits
+const size_t countOfAnimationIDs = 1024;
+const uint32_t invalidAnimationBlock = 0xFFFFFFFF;
+
+/* \brief Maps animation IDs of transformation stream to animation blocks
+ *
+ * Dense table indexed by TransformPayload::getAnimationID(), thus resolving
+ * the animation of a key is a single load. Only the lower 10 bits of
+ * AnimationBlock::animationID are used, the first block wins for duplicates.
+ */
+class AnimationTable
+{
+private:
+  std::array<uint32_t, countOfAnimationIDs> blocks;
+
+public:
+  AnimationTable() { blocks.fill(invalidAnimationBlock); }
+  AnimationTable(const AnimationBlock* animationBlocks, size_t count)
+    : AnimationTable()
+  {
+    for (size_t i = 0; i < count; i++) {
+      uint32_t& block = blocks[animationBlocks[i].animationID & 0x3FF];
+      if (block == invalidAnimationBlock)
+        block = static_cast<uint32_t>(i);
+    }
+  }
+
+  /// Returns index into animation blocks or invalidAnimationBlock
+  uint32_t findBlock(size_t animationID) const
+  {
+    return blocks[animationID & 0x3FF];
+  }
+  bool contains(size_t animationID) const
+  {
+    return findBlock(animationID) != invalidAnimationBlock;
+  }
+};
+
+/* \brief Content of .rep file
+ *
+ * Headers keep fields with unknown meaning, thus the file can be stored back
+ * without loss. Sizes and counts in headers are recomputed by storeFile().
+ */
 class File
 {
 public:
+  Header header = Header();
   std::vector<AnimationBlock> animationBlocks;
   std::vector<AnimatedObjectDefinitions> animatedObjects;
-  // Transformation payload TODO
+  std::vector<TransformTrack> transformTracks; // one per animatedObjects
   std::vector<CameraTransformationChunk> cameraPositionChunks;
   std::vector<CameraFocusChunk> camerafocusChunks;
+  ScriptsAndSoundsHeader eventsHeader = ScriptsAndSoundsHeader();
+  std::vector<unsigned char> eventsPostheaderData;
   std::vector<FadeChunk> fadeChunks;
   std::vector<ScriptChunk> scriptChunks;
   std::vector<SoundChunk> soundChunks;
+  DialogHeader dialogHeader = DialogHeader();
   std::vector<DialogChunk> dialogChunks;
+  std::vector<NarratorChunk> narratorChunks;
+  std::vector<MorphChunk> morphChunks;
+  AnimationTable animationTable; // built from animationBlocks
+
+  void updateAnimationTable()
+  {
+    animationTable =
+      AnimationTable(animationBlocks.data(), animationBlocks.size());
+  }
+};
+
+/// Chunk sizes of transformation stream used when sizeOfBlocks is not set
+const uint32_t defaultSizeOfBlocks[4] = { 8, 40, 44, 56 };
+
+/* \brief Decoders of object transformation streams
+ *
+ * The decoder is picked once per object by its sizeOfBlocks. For known
+ * layouts, chunk sizes are template arguments, thus each chunk is handed
+ * over with a compile-time payload length (std::integral_constant) and the
+ * callee copies it with fixed-size memcpy. Other layouts go through the
+ * generic decoder with runtime lengths.
+ *
+ * Both decoders reject chunks with type >= 4, chunks shorter than their
+ * header and chunks exceeding the stream, thus no chunk is read out of
+ * bounds. The callback gets (position in stream, header, payload, length).
+ */
+namespace ChunkDecoders {
+
+template<uint32_t ChunkSize, typename Function>
+inline bool decodeChunk(const unsigned char* stream,
+                        size_t size,
+                        size_t& position,
+                        const TransformationHeader& header,
+                        Function& function)
+{
+  static_assert(ChunkSize >= sizeof(TransformationHeader),
+                "chunk must contain its header");
+  if (ChunkSize > size - position)
+    return false;
+  function(position, header, stream + position + sizeof(header),
+           std::integral_constant<size_t, ChunkSize - sizeof(header)>());
+  position += ChunkSize;
+  return true;
+}
+
+template<uint32_t Size0, uint32_t Size1, uint32_t Size2, uint32_t Size3>
+struct FixedLayout
+{
+  static bool matches(const uint32_t sizeOfBlocks[4])
+  {
+    return sizeOfBlocks[0] == Size0 && sizeOfBlocks[1] == Size1 &&
+           sizeOfBlocks[2] == Size2 && sizeOfBlocks[3] == Size3;
+  }
+
+  template<typename Function>
+  static bool decode(const unsigned char* stream,
+                     size_t size,
+                     Function& function)
+  {
+    size_t position = sizeof(TransformationHeader);
+    while (position < size) {
+      TransformationHeader header;
+      if (size - position < sizeof(header))
+        return false;
+      memcpy(&header, stream + position, sizeof(header));
+      bool isValid = false;
+      switch (header.type) {
+        case 0:
+          isValid = decodeChunk<Size0>(stream, size, position, header, function);
+          break;
+        case 1:
+          isValid = decodeChunk<Size1>(stream, size, position, header, function);
+          break;
+        case 2:
+          isValid = decodeChunk<Size2>(stream, size, position, header, function);
+          break;
+        case 3:
+          isValid = decodeChunk<Size3>(stream, size, position, header, function);
+          break;
+        default:
+          break;
+      }
+      if (!isValid)
+        return false;
+    }
+    return true;
+  }
+};
+
+/// Layout of all objects seen in game files
+typedef FixedLayout<8, 40, 44, 56> DefaultLayout;
+
+template<typename Function>
+inline bool decodeGeneric(const unsigned char* stream,
+                          size_t size,
+                          const uint32_t sizeOfBlocks[4],
+                          Function& function)
+{
+  size_t position = sizeof(TransformationHeader);
+  while (position < size) {
+    TransformationHeader header;
+    if (size - position < sizeof(header))
+      return false;
+    memcpy(&header, stream + position, sizeof(header));
+    if (header.type >= 4 || sizeOfBlocks[header.type] < sizeof(header) ||
+        sizeOfBlocks[header.type] > size - position)
+      return false;
+    size_t payloadLength = sizeOfBlocks[header.type] - sizeof(header);
+    function(position, header, stream + position + sizeof(header),
+             payloadLength);
+    position += sizeOfBlocks[header.type];
+  }
+  return true;
+}
+
+/* \brief Calls function for each chunk of object stream
+ *
+ * stream starts with the leading TransformationHeader of object. Returns
+ * false for invalid streams (chunks before the invalid one are visited).
+ */
+template<typename Function>
+inline bool decodeStream(const unsigned char* stream,
+                         size_t size,
+                         const uint32_t sizeOfBlocks[4],
+                         Function function)
+{
+  if (size < sizeof(TransformationHeader))
+    return false;
+  if (DefaultLayout::matches(sizeOfBlocks))
+    return DefaultLayout::decode(stream, size, function);
+  return decodeGeneric(stream, size, sizeOfBlocks, function);
+}
+
+} // namespace ChunkDecoders
+
+/* \brief Headers of file as they are going to be stored
+ */
+struct Layout
+{
+  Header header;
+  std::vector<AnimatedObjectDefinitions> animatedObjects;
+  ScriptsAndSoundsHeader eventsHeader;
+  DialogHeader dialogHeader;
+  size_t fileSize;
+};
+
+/* \brief Sections of .rep file in the order of their appearance
+ */
+enum Section
+{
+  SECTION_ANIMATIONS = 0,
+  SECTION_OBJECTS,
+  SECTION_TRANSFORMATIONS,
+  SECTION_CAMERA,
+  SECTION_EVENTS,
+  SECTION_DIALOGS,
+  COUNT_OF_SECTIONS
 };
 
-#define GETPOS(stream)                                                         \
-  {                                                                            \
-    std::cerr << "Stream position at: 0x" << std::hex << stream.tellg()          \
-              << std::dec << std::endl;                                        \
+inline const char* getSectionName(Section section)
+{
+  static const char* names[COUNT_OF_SECTIONS] = {
+    "animations", "objects", "transformations", "camera", "events", "dialogs"
+  };
+  return section < COUNT_OF_SECTIONS ? names[section] : "unknown";
+}
+
+/* \brief Digests and sizes of sections of a stored file
+ *
+ * Filled by Loader::computeDigests() or by the incremental Loader::storeFile().
+ * Digests are computed from the content of File (not from its serialized
+ * form), thus they are cheap and equal digests mean equal bytes on disk.
+ * fileSize 0 means that content of the file on disk isn't known.
+ */
+struct SectionDigests
+{
+  uint64_t header;
+  uint64_t sections[COUNT_OF_SECTIONS];
+  uint64_t sizes[COUNT_OF_SECTIONS];
+  uint64_t fileSize;
+};
+
+/* \brief Cost of a single section of the last load
+ */
+struct SectionStats
+{
+  double seconds;
+  uint64_t bytes;
+  uint64_t countOfChunks; // blocks / keys / chunks, headers aren't counted
+  uint64_t countOfAllocations;
+};
+
+/* \brief Where the time of the last Loader::loadFile() went
+ *
+ * Times come from std::chrono::steady_clock. Allocations are counted only in
+ * executables using COUNT_ALLOCATIONS(), otherwise they stay 0.
+ */
+struct LoadStats
+{
+  SectionStats sections[COUNT_OF_SECTIONS];
+  uint64_t transformationTypes[4]; // histogram of chunk types
+  uint64_t fileSize;
+  double seconds; // whole load, including opening the file
+  uint64_t countOfAllocations;
+};
+
+/* \brief Receives content of .rep file while it's being parsed
+ *
+ * SAX-style interface: the Loader calls the methods in the order of chunks in
+ * the file. All methods do nothing by default, thus parsing without a visitor
+ * costs no formatting at all. Only errors are reported to std::cerr by
+ * default.
+ */
+class Visitor
+{
+public:
+  virtual ~Visitor() {}
+  virtual void onBeginFile(const std::string& /*fileName*/) {}
+  virtual void onError(const std::string& message)
+  {
+    std::cerr << "[Err] " << message << std::endl;
+  }
+  /// Problems, which don't prevent the file from being used
+  virtual void onWarning(const std::string& message)
+  {
+    std::cerr << "[Warn] " << message << std::endl;
+  }
+  /// Offset since the beginning of file, reported at section boundaries
+  virtual void onStreamPosition(size_t /*offset*/) {}
+  virtual void onSection(Section /*section*/) {}
+  virtual void onHeader(const Header& /*header*/) {}
+  virtual void onAnimation(const AnimationBlock& /*block*/) {}
+  virtual void onObject(size_t /*index*/,
+                        const AnimatedObjectDefinitions& /*object*/)
+  {}
+  /// Called before transformation stream of index-th object
+  virtual void onObjectStream(size_t /*index*/,
+                              const AnimatedObjectDefinitions& /*object*/)
+  {}
+  /// position is the offset since the beginning of transformation section
+  virtual void onTransform(size_t /*objectIndex*/,
+                           size_t /*position*/,
+                           const TransformationHeader& /*header*/,
+                           size_t /*payloadLength*/,
+                           const TransformPayload& /*payload*/)
+  {}
+  virtual void onCameraChunk(const CameraTransformationChunk& /*chunk*/) {}
+  virtual void onCameraFocusChunk(const CameraFocusChunk& /*chunk*/) {}
+  virtual void onEventsHeader(const ScriptsAndSoundsHeader& /*header*/) {}
+  virtual void onFade(const FadeChunk& /*chunk*/) {}
+  virtual void onScript(const ScriptChunk& /*chunk*/) {}
+  virtual void onSound(const SoundChunk& /*chunk*/) {}
+  virtual void onDialogHeader(const DialogHeader& /*header*/) {}
+  virtual void onDialog(const DialogChunk& /*chunk*/) {}
+  virtual void onNarrator(const NarratorChunk& /*chunk*/) {}
+  virtual void onMorph(const MorphChunk& /*chunk*/) {}
+};
+
+/* \brief Keeps the last error instead of printing it
+ */
+class ErrorCollector : public Visitor
+{
+public:
+  std::string lastError;
+  void onError(const std::string& message) override { lastError = message; }
+};
+
+/* \brief Prints out content of .rep file (as reploader does)
+ */
+class DumpVisitor : public Visitor
+{
+private:
+  Header fileHeader;
+
+public:
+  void onBeginFile(const std::string& fileName) override
+  {
+    std::cerr << "[RepParser] Parsing file: " << fileName << std::endl;
+  }
+
+  void onStreamPosition(size_t offset) override
+  {
+    std::cerr << "Stream position at: 0x" << std::hex << offset << std::dec
+              << std::endl;
+  }
+
+  void onSection(Section section) override
+  {
+    switch (section) {
+      case SECTION_ANIMATIONS:
+        std::cerr << "AnimationStart" << std::endl;
+        break;
+      case SECTION_OBJECTS:
+        std::cerr << "FrameSequence" << std::endl;
+        break;
+      case SECTION_CAMERA:
+        std::cerr << "[Camera Section] Count of camera chunks: "
+                  << fileHeader.countOfCameraChunks << std::endl;
+        std::cerr << "[Camera Section] Count of camera focus chunks: "
+                  << fileHeader.countOfCameraFocusChunks << std::endl;
+        break;
+      default:
+        break;
+    }
+  }
+
+  void onHeader(const Header& header) override
+  {
+    fileHeader = header;
+    std::cout << "Magic Byte: " << std::hex << header.magicByte << std::dec
+              << std::endl;
+    std::cout << "Anim block size: " << header.sizeOfAnimationSection
+              << std::endl;
+    std::cout << "Count of anims: " << header.countOfAnimationBlocks
+              << std::endl;
+  }
+
+  void onAnimation(const AnimationBlock& animationBlock) override
+  {
+    std::cerr << "[Animation Block] " << animationBlock.animationID << " - "
+              << animationBlock.animationName << std::endl;
+  }
+
+  void onObject(size_t /*index*/,
+                const AnimatedObjectDefinitions& postanimationBlock) override
+  {
+    std::cerr << "[FrameSequence Block] " << postanimationBlock.frameName
+              << " - " << postanimationBlock.actorName << " - Size: 0x"
+              << std::hex << postanimationBlock.sizeOfStreamSection
+              << "Start: " << postanimationBlock.positionOfTheBeginning
+              << std::dec << std::endl;
+    std::cerr << "[FS] ";
+    for (int i = 0; i < 4; i++) {
+      std::cerr << std::setw(6) << postanimationBlock.sizeOfBlocks[i] << " ";
+    }
+
+    std::cerr << "Time: " << std::setw(6) << std::hex
+              << postanimationBlock.activationTime << std::dec << " ";
+    std::cerr << std::setw(6) << std::hex
+              << postanimationBlock.deactivationTime << std::dec << " ";
+    std::cerr << " Type: " << postanimationBlock.getTypeString() << "["
+              << std::hex << postanimationBlock.type << "]" << std::dec;
+    std::cerr << std::endl;
+  }
+
+  void onObjectStream(size_t index,
+                      const AnimatedObjectDefinitions& animatedObject) override
+  {
+    std::cerr << "Reading object: " << animatedObject.actorName << "[ "
+              << animatedObject.frameName << " ] [" << index << "]"
+              << std::endl;
+  }
+
+  void onTransform(size_t /*objectIndex*/,
+                   size_t position,
+                   const TransformationHeader& header,
+                   size_t payloadLength,
+                   const TransformPayload& body) override
+  {
+    std::cerr << "Position: 0x" << std::hex << position << std::dec
+              << std::endl;
+    std::cerr << "[TransformSequence] Timestamp: 0x" << std::hex
+              << header.timestamp << std::dec << " Type: " << header.type
+              << " Read chunk with size(without header): " << payloadLength
+              << std::endl;
+    std::cerr << "[TransformSequence] Transform payload [" << body.position[0]
+              << "," << body.position[1] << "," << body.position[2] << "] ["
+              << body.rotation[0] << "," << body.rotation[1] << ","
+              << body.rotation[2] << "," << body.rotation[3]
+              << "] AnimID: " << body.getAnimationID() << " Flags:" << std::hex
+              << body.getFlags() << std::dec << " - "
+              << " Flags:" << body.getFlagsAsString() << " - "
+              << " Offset:" << body.getAnimationOffset() << " - " << std::hex
+              << body.auxiliary << std::dec << "\n";
+  }
+
+  void onCameraChunk(const CameraTransformationChunk& chunk) override
+  {
+    std::cerr << "Camera Section: Time: " << chunk.timestamp
+              << " Type: " << chunk.type << " [" << chunk.position[0] << ", "
+              << chunk.position[1] << ", " << chunk.position[2] << "]"
+              << " FOV: " << chunk.fov;
+    std::cerr << " [" << chunk.unkVector[0] << ", " << chunk.unkVector[1]
+              << ", " << chunk.unkVector[2] << "]"
+              << " - ";
+    std::cerr << " [" << chunk.unkVectorSecond[0] << ", "
+              << chunk.unkVectorSecond[1] << ", " << chunk.unkVectorSecond[2]
+              << "]" << std::endl;
+  }
+
+  void onCameraFocusChunk(const CameraFocusChunk& chunk) override
+  {
+    std::cerr << "Camera Focus: Time: " << chunk.timestamp
+              << " Type: " << chunk.type << " [" << chunk.position[0] << ", "
+              << chunk.position[1] << ", " << chunk.position[2] << "]";
+    std::cerr << " [" << chunk.unkVector[0] << ", " << chunk.unkVector[1]
+              << ", " << chunk.unkVector[2] << "]"
+              << " - ";
+    std::cerr << " [" << chunk.unkVectorSecond[0] << ", "
+              << chunk.unkVectorSecond[1] << ", " << chunk.unkVectorSecond[2]
+              << "]" << std::endl;
+  }
+
+  void onEventsHeader(const ScriptsAndSoundsHeader& header) override
+  {
+    std::cerr << "[EventsHeader] Size of post header section: 0x" << std::hex
+              << header.sizeOfPostheaderData << std::dec << std::endl;
+    std::cerr << "[EventsHeader] Size of Fade section: 0x" << std::hex
+              << header.sizeOfFadeSection << std::dec << std::endl;
+  }
+
+  void onFade(const FadeChunk& chunk) override
+  {
+    std::cerr << "Fade chunk: Time: " << chunk.getStartOfFadeEvent()
+              << " Flags: 0x" << std::hex << chunk.getFlags() << std::dec
+              << " - " << chunk.getFlagsAsString()
+              << " Duration: " << chunk.timeOfDarkening << std::endl;
+  }
+
+  void onScript(const ScriptChunk& chunk) override
+  {
+    std::cerr << "Script chunk: " << chunk.timestamp
+              << " Name: " << chunk.scriptName << std::endl;
+  }
+
+  void onSound(const SoundChunk& chunk) override
+  {
+    std::cerr << "Sound chunk: " << chunk.timestamp
+              << " Type: " << chunk.getTypeStringRepresentation() << " ("
+              << chunk.type << ") Name: " << chunk.soundName << std::endl;
+  }
+
+  void onDialogHeader(const DialogHeader& header) override
+  {
+    std::cerr << "[DialogSection] Count of dialog chunks: "
+              << header.countOfDialogs << std::endl;
+    std::cerr << "[DialogSection] Unk: " << header.countOfNarratorChunks
+              << std::endl;
+    std::cerr << "[DialogSection] Unk2: " << header.unk2 << std::endl;
   }
-#define READ(var)                                                              \
-  read(reinterpret_cast<char*>(&var), sizeof(var) / sizeof(char))
+
+  void onDialog(const DialogChunk& chunk) override
+  {
+    std::cerr << "Dialog chunk: stamp: " << chunk.timestamp
+              << " ID: " << chunk.channelID << " animation ID: " << std::hex
+              << chunk.dialogID << std::dec;
+    if (chunk.dialogID == 1)
+      std::cerr << " Name: " << chunk.framename;
+    std::cerr << std::endl;
+  }
+
+  void onNarrator(const NarratorChunk& chunk) override
+  {
+    std::cerr << "Narrator chunk: timestamp: " << chunk.timestamp
+              << " unk: " << chunk.unk2 << " speechID: " << std::hex
+              << chunk.speechID << std::dec << std::endl;
+  }
+
+  void onMorph(const MorphChunk& chunk) override
+  {
+    std::cerr << "Morph chunk: timestamp: " << chunk.timestamp
+              << " unk: " << chunk.unk1 << " frameName: " << chunk.frameName
+              << " unk: " << chunk.unk2 << std::endl;
+  }
+};
+
 class Loader
 {
 private:
   friend File;
   Header fileHeader;
   File currentFile;
+  Visitor* visitor;
+  size_t streamPosition;
+  size_t fileSize;
+  LoadStats stats;
+  std::chrono::steady_clock::time_point sectionStart;
+  size_t sectionStartPosition;
+  uint64_t sectionStartAllocations;
+
+  void beginSection()
+  {
+    sectionStart = std::chrono::steady_clock::now();
+    sectionStartPosition = streamPosition;
+    sectionStartAllocations = Allocations::getCount();
+  }
+
+  void endSection(Section section, size_t countOfChunks)
+  {
+    SectionStats& result = stats.sections[section];
+    result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - sectionStart)
+                       .count();
+    result.bytes = streamPosition - sectionStartPosition;
+    result.countOfChunks = countOfChunks;
+    result.countOfAllocations =
+      Allocations::getCount() - sectionStartAllocations;
+  }
+
+  template<typename T>
+  void read(std::ifstream& stream, T& var)
+  {
+    stream.read(reinterpret_cast<char*>(&var), sizeof(var));
+    streamPosition += sizeof(var);
+  }
+
+  /// Reserves count elements unless the rest of file can't hold them
+  template<typename T>
+  void reserve(std::vector<T>& vector, size_t count)
+  {
+    size_t remaining = fileSize > streamPosition ? fileSize - streamPosition : 0;
+    vector.reserve(std::min(count, remaining / sizeof(T)));
+  }
+
   void readAnimations(std::ifstream& stream)
   {
-    std::cerr << "AnimationStart" << std::endl;
-    for (size_t i = 0; i < fileHeader.countOfAnimationBlocks; i++) {
+    visitor->onSection(SECTION_ANIMATIONS);
+    reserve(currentFile.animationBlocks, fileHeader.countOfAnimationBlocks);
+    for (size_t i = 0; i < fileHeader.countOfAnimationBlocks && stream; i++) {
       AnimationBlock animationBlock;
       memset(&animationBlock, 0, 52);
-      stream.READ(animationBlock);
+      read(stream, animationBlock);
       currentFile.animationBlocks.push_back(animationBlock);
-      std::cerr << "[Animation Block] " << animationBlock.animationID << " - "
-                << animationBlock.animationName << std::endl;
+      visitor->onAnimation(animationBlock);
     }
+    currentFile.updateAnimationTable();
   }
 
   void readObjectDefinitions(std::ifstream& stream)
   {
-    std::cerr << "FrameSequence" << std::endl;
-    for (size_t i = 0; i < fileHeader.countOfObjectDefinitionBlocks; i++) {
+    visitor->onSection(SECTION_OBJECTS);
+    reserve(currentFile.animatedObjects,
+            fileHeader.countOfObjectDefinitionBlocks);
+    for (size_t i = 0; i < fileHeader.countOfObjectDefinitionBlocks && stream;
+         i++) {
       AnimatedObjectDefinitions postanimationBlock;
       memset(&postanimationBlock, 0, 108);
-      stream.READ(postanimationBlock);
+      read(stream, postanimationBlock);
       currentFile.animatedObjects.push_back(postanimationBlock);
-      std::cerr << "[FrameSequence Block] " << postanimationBlock.frameName
-                << " - " << postanimationBlock.actorName
-                << " - Size: 0x" << std::hex
-                << postanimationBlock.sizeOfStreamSection
-                << "Start: " << postanimationBlock.positionOfTheBeginning
-                << std::dec << std::endl;
-      std::cerr << "[FS] ";
-      for (int i = 0; i < 4; i++) {
-        std::cerr << std::setw(6) << postanimationBlock.sizeOfBlocks[i] << " ";
-      }
-
-      std::cerr << "Time: " << std::setw(6) << std::hex
-                << postanimationBlock.activationTime << std::dec << " ";
-      std::cerr << std::setw(6) << std::hex
-                << postanimationBlock.deactivationTime << std::dec << " ";
-      std::cerr << " Type: " << postanimationBlock.getTypeString() << "["
-                << std::hex << postanimationBlock.type << "]" << std::dec;
-      std::cerr << std::endl;
+      visitor->onObject(i, postanimationBlock);
     }
   }
 
-  void readTransformation(std::ifstream& stream)
+  bool readTransformation(std::ifstream& stream)
   {
-    size_t endPointer = 0;
+    visitor->onSection(SECTION_TRANSFORMATIONS);
     size_t currentPointer = 0;
+    currentFile.transformTracks.resize(currentFile.animatedObjects.size());
+    const auto& animations = currentFile.animationTable;
+    size_t countOfInvalidIDs = 0;
+    size_t firstInvalidID = 0, firstInvalidObject = 0;
+    std::vector<unsigned char> buffer;
     // for each animated object
-    for (size_t i = 0; i < fileHeader.countOfObjectDefinitionBlocks; i++) {
-      GETPOS(stream);
+    for (size_t i = 0; i < currentFile.animatedObjects.size(); i++) {
+      visitor->onStreamPosition(streamPosition);
       auto& animatedObject = currentFile.animatedObjects[i];
-      std::cerr << "Reading object: " << animatedObject.actorName << "[ "
-                << animatedObject.frameName << " ] [" << i << "]" << std::endl;
-      endPointer = currentPointer + animatedObject.sizeOfStreamSection;
-      uint32_t zeroUnkBlock;
-      // Skip leading 8 bytes
-      stream.READ(zeroUnkBlock);
-      stream.READ(zeroUnkBlock);
-      currentPointer += 8;
-
-      // for all blocks for current animated object
-      while (endPointer > currentPointer) {
-        std::cerr << "Position: 0x" << std::hex << currentPointer << std::dec
-                  << std::endl;
-        // get header with timestamp / type
-        TransformationHeader header;
-        stream.READ(header);
-        currentPointer += 8;
-
-        // get payload size (-8 is for header)
-        size_t payloadLength = animatedObject.sizeOfBlocks[header.type] - 8;
-        currentPointer += payloadLength;
-        // read payload
-        unsigned char payload[512];
-        stream.read(reinterpret_cast<char*>(&payload), payloadLength);
-        std::cerr << "[TransformSequence] Timestamp: 0x" << std::hex
-                  << header.timestamp << std::dec << " Type: " << header.type
-                  << " Read chunk with size(without header): " << payloadLength << std::endl;
-
-        TransformPayload* body = reinterpret_cast<TransformPayload*>(&payload);
-        std::cerr << "[TransformSequence] Transform payload ["
-                  << body->position[0] << "," << body->position[1] << ","
-                  << body->position[2] << "] [" << body->rotation[0] << ","
-                  << body->rotation[1] << "," << body->rotation[2] << ","
-                  << body->rotation[3] << "] AnimID: " << body->getAnimationID()
-                  << " Flags:" << std::hex << body->getFlags() << std::dec << " - "
-                  << " Flags:" << body->getFlagsAsString() << " - "
-                  << " Offset:" << body->getAnimationOffset() << " - "
-                  << std::hex << body->auxiliary << std::dec << "\n";
+      auto& track = currentFile.transformTracks[i];
+      visitor->onObjectStream(i, animatedObject);
+      size_t size = animatedObject.sizeOfStreamSection;
+      if (size > fileSize - std::min(streamPosition, fileSize)) {
+        visitor->onError("Transformation stream of object " +
+                         std::to_string(i) + " exceeds file");
+        return false;
       }
+      // the whole stream at once, chunks are decoded from memory
+      buffer.resize(size);
+      stream.read(reinterpret_cast<char*>(buffer.data()), size);
+      streamPosition += size;
+      if (!stream)
+        return true; // reported by loadFile()
+      // Leading 8 bytes carry no transformation
+      if (size >= sizeof(track.streamHeader))
+        memcpy(&track.streamHeader, buffer.data(), sizeof(track.streamHeader));
+      // estimate, chunks carrying a transformation have 40+ bytes
+      track.reserve(size / 40);
+
+      bool isValid = ChunkDecoders::decodeStream(
+        buffer.data(), size, animatedObject.sizeOfBlocks,
+        [&](size_t position, const TransformationHeader& header,
+            const unsigned char* payload, auto payloadLength) {
+          stats.transformationTypes[header.type]++;
+          track.push(header, payload, payloadLength);
+          visitor->onTransform(i, currentPointer + position, header,
+                               payloadLength,
+                               track.getPayload(track.size() - 1));
+          uint32_t auxiliary = track.auxiliary.back();
+          if ((auxiliary & ANIMATION_HAS_ID) &&
+              !animations.contains(auxiliary & 0x3FF)) {
+            if (countOfInvalidIDs++ == 0) {
+              firstInvalidID = auxiliary & 0x3FF;
+              firstInvalidObject = i;
+            }
+          }
+        });
+      if (!isValid) {
+        visitor->onError("Invalid chunk in transformation stream of object " +
+                         std::to_string(i));
+        return false;
+      }
+      currentPointer += size;
     }
+    if (countOfInvalidIDs > 0)
+      visitor->onWarning(std::to_string(countOfInvalidIDs) +
+                         " transformation chunks refer to missing animations"
+                         " (first: ID " + std::to_string(firstInvalidID) +
+                         " of object " + std::to_string(firstInvalidObject) +
+                         ")");
+    return true;
   }
 
   void readCameraSection(std::ifstream& stream)
-  { 
-    GETPOS(stream);
-    std::cerr << "[Camera Section] Count of camera chunks: " << fileHeader.countOfCameraChunks << std::endl;
-    std::cerr << "[Camera Section] Count of camera focus chunks: " << fileHeader.countOfCameraFocusChunks << std::endl;
-    for (size_t i = 0; i < fileHeader.countOfCameraChunks; i++) {
+  {
+    visitor->onStreamPosition(streamPosition);
+    visitor->onSection(SECTION_CAMERA);
+    reserve(currentFile.cameraPositionChunks, fileHeader.countOfCameraChunks);
+    reserve(currentFile.camerafocusChunks, fileHeader.countOfCameraFocusChunks);
+    for (size_t i = 0; i < fileHeader.countOfCameraChunks && stream; i++) {
       CameraTransformationChunk chunk;
-      stream.READ(chunk);
-      std::cerr << "Camera Section: Time: " << chunk.timestamp
-                << " Type: " << chunk.type << " [" << chunk.position[0] << ", "
-                << chunk.position[1] << ", " << chunk.position[2] << "]"
-                << " FOV: " << chunk.fov;
-      std::cerr << " [" << chunk.unkVector[0] << ", " << chunk.unkVector[1]
-                << ", " << chunk.unkVector[2] << "]"
-                << " - ";
-      std::cerr << " [" << chunk.unkVectorSecond[0] << ", "
-                << chunk.unkVectorSecond[1] << ", " << chunk.unkVectorSecond[2]
-                << "]" << std::endl;
+      read(stream, chunk);
+      visitor->onCameraChunk(chunk);
       currentFile.cameraPositionChunks.push_back(chunk);
     }
 
-    GETPOS(stream);
-    for (size_t i = 0; i < fileHeader.countOfCameraFocusChunks; i++) {
+    visitor->onStreamPosition(streamPosition);
+    for (size_t i = 0; i < fileHeader.countOfCameraFocusChunks && stream; i++) {
       CameraFocusChunk chunk;
-      stream.READ(chunk);
-      std::cerr << "Camera Focus: Time: " << chunk.timestamp
-                << " Type: " << chunk.type << " [" << chunk.position[0] << ", "
-                << chunk.position[1] << ", " << chunk.position[2] << "]";
-      std::cerr << " [" << chunk.unkVector[0] << ", " << chunk.unkVector[1]
-                << ", " << chunk.unkVector[2] << "]"
-                << " - ";
-      std::cerr << " [" << chunk.unkVectorSecond[0] << ", "
-                << chunk.unkVectorSecond[1] << ", " << chunk.unkVectorSecond[2]
-                << "]" << std::endl;
+      read(stream, chunk);
+      visitor->onCameraFocusChunk(chunk);
       currentFile.camerafocusChunks.push_back(chunk);
     }
   }
 
   void readScriptEvents(std::ifstream& stream)
   {
-    GETPOS(stream);
+    visitor->onStreamPosition(streamPosition);
+    visitor->onSection(SECTION_EVENTS);
     ScriptsAndSoundsHeader header;
-    stream.READ(header);
-    std::cerr << "[EventsHeader] Size of post header section: 0x" << std::hex << header.sizeOfPostheaderData << std::dec << std::endl;
-    std::cerr << "[EventsHeader] Size of Fade section: 0x" << std::hex << header.sizeOfFadeSection << std::dec << std::endl;
+    read(stream, header);
+    visitor->onEventsHeader(header);
 
-    stream.seekg(header.sizeOfPostheaderData, std::ifstream::cur);
+    currentFile.eventsHeader = header;
+    if (header.sizeOfPostheaderData > fileSize - streamPosition) {
+      stream.setstate(std::ifstream::failbit);
+      return;
+    }
+    currentFile.eventsPostheaderData.resize(header.sizeOfPostheaderData);
+    stream.read(
+      reinterpret_cast<char*>(currentFile.eventsPostheaderData.data()),
+      header.sizeOfPostheaderData);
+    streamPosition += header.sizeOfPostheaderData;
 
     uint32_t countOfFadeSection = header.sizeOfFadeSection/ 32;
     uint32_t countOfScriptSection = header.sizeOfScriptSection / 40;
     uint32_t countOfSoundSection = header.sizeOfSoundSection / 40;
-    for (size_t i = 0; i < countOfFadeSection; i++) {
+    reserve(currentFile.fadeChunks, countOfFadeSection);
+    reserve(currentFile.scriptChunks, countOfScriptSection);
+    reserve(currentFile.soundChunks, countOfSoundSection);
+    for (size_t i = 0; i < countOfFadeSection && stream; i++) {
       FadeChunk chunk;
-      stream.READ(chunk);
-      std::cerr << "Fade chunk: Time: " << chunk.getStartOfFadeEvent()
-                << " Flags: 0x" << std::hex << chunk.getFlags() <<std::dec << " - " << chunk.getFlagsAsString() 
-                << " Duration: " << chunk.timeOfDarkening << std::endl;
+      read(stream, chunk);
+      visitor->onFade(chunk);
       currentFile.fadeChunks.push_back(chunk);
     }
 
-    for (size_t i = 0; i < countOfScriptSection; i++) {
+    for (size_t i = 0; i < countOfScriptSection && stream; i++) {
       ScriptChunk chunk;
-      stream.READ(chunk);
-      std::cerr << "Script chunk: " << chunk.timestamp
-                << " Name: " << chunk.scriptName << std::endl;
+      read(stream, chunk);
+      visitor->onScript(chunk);
       currentFile.scriptChunks.push_back(chunk);
     }
 
-    for (size_t i = 0; i < countOfSoundSection; i++) {
+    for (size_t i = 0; i < countOfSoundSection && stream; i++) {
       SoundChunk chunk;
-      stream.READ(chunk);
-      std::cerr << "Sound chunk: " << chunk.timestamp
-                << " Type: " << chunk.getTypeStringRepresentation() << " ("
-                << chunk.type << ") Name: " << chunk.soundName << std::endl;
+      read(stream, chunk);
+      visitor->onSound(chunk);
       currentFile.soundChunks.push_back(chunk);
     }
   }
 
   void readDialogs(std::ifstream& stream)
   {
+    visitor->onSection(SECTION_DIALOGS);
     DialogHeader header;
-    stream.READ(header);
-    std::cerr << "[DialogSection] Count of dialog chunks: " << header.countOfDialogs << std::endl;
-    std::cerr << "[DialogSection] Unk: " << header.countOfNarratorChunks<< std::endl;
-    std::cerr << "[DialogSection] Unk2: " << header.unk2<< std::endl;
+    read(stream, header);
+    currentFile.dialogHeader = header;
+    visitor->onDialogHeader(header);
+    reserve(currentFile.dialogChunks, header.countOfDialogs);
+    reserve(currentFile.narratorChunks, header.countOfNarratorChunks);
+    reserve(currentFile.morphChunks, header.unk2);
 
-    for (size_t i = 0; i < header.countOfDialogs; i++) {
+    for (size_t i = 0; i < header.countOfDialogs && stream; i++) {
       DialogChunk chunk;
-      stream.READ(chunk);
-      std::cerr << "Dialog chunk: stamp: " << chunk.timestamp
-                << " ID: " << chunk.channelID << " animation ID: " << std::hex
-                << chunk.dialogID << std::dec;
-                if(chunk.dialogID == 1)
-                    std::cerr << " Name: " << chunk.framename;
-                std::cerr << std::endl;
+      read(stream, chunk);
+      visitor->onDialog(chunk);
       currentFile.dialogChunks.push_back(chunk);
     }
 
-    for (size_t i = 0; i < header.countOfNarratorChunks; i++) {
+    for (size_t i = 0; i < header.countOfNarratorChunks && stream; i++) {
       NarratorChunk chunk;
-      stream.READ(chunk);
-      std::cerr << "Narrator chunk: timestamp: " << chunk.timestamp 
-                << " unk: " << chunk.unk2 
-                << " speechID: " << std::hex << chunk.speechID << std::dec
-                << std::endl;
+      read(stream, chunk);
+      visitor->onNarrator(chunk);
+      currentFile.narratorChunks.push_back(chunk);
     }
 
-    for (size_t i = 0; i < header.unk2; i++) {
+    for (size_t i = 0; i < header.unk2 && stream; i++) {
       MorphChunk chunk;
-      stream.READ(chunk);
-      std::cerr << "Morph chunk: timestamp: " << chunk.timestamp 
-                << " unk: " << chunk.unk1 
-                << " frameName: " << chunk.frameName
-                << " unk: " << chunk.unk2 
+      read(stream, chunk);
+      visitor->onMorph(chunk);
+      currentFile.morphChunks.push_back(chunk);
+    }
+  }
+
+  template<typename T>
+  static void write(std::vector<char>& buffer, const T& var)
+  {
+    const char* bytes = reinterpret_cast<const char*>(&var);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(var));
+  }
+
+  /* \brief Computes section sizes / offsets of file as it's going to be stored
+   *
+   * Fills layout.header and layout.animatedObjects with sizes and offsets
+   * derived from the content of file.
+   */
+  static bool computeLayout(const File& file, Layout& layout)
+  {
+    if (file.transformTracks.size() != file.animatedObjects.size()) {
+      std::cerr << "[Err] Each animated object needs its transform track"
                 << std::endl;
+      return false;
+    }
+    Header& header = layout.header;
+    header = file.header;
+    header.magicByte = magicByteConstant;
+    header.countOfAnimationBlocks = file.animationBlocks.size();
+    // the animation section includes last two fields of Header
+    header.sizeOfAnimationSection =
+      sizeof(Header) - offsetof(Header, countOfAnimationBlocks) +
+      file.animationBlocks.size() * sizeof(AnimationBlock);
+    header.countOfObjectDefinitionBlocks = file.animatedObjects.size();
+
+    layout.animatedObjects = file.animatedObjects;
+    uint32_t transformationSize = 0;
+    for (size_t i = 0; i < layout.animatedObjects.size(); i++) {
+      auto& object = layout.animatedObjects[i];
+      const auto& track = file.transformTracks[i];
+      uint32_t streamSize = sizeof(TransformationHeader);
+      size_t extraSize = 0;
+      for (size_t type = 0; type < 4; type++) {
+        if (object.sizeOfBlocks[type] == 0)
+          object.sizeOfBlocks[type] = defaultSizeOfBlocks[type];
+      }
+      for (uint32_t type : track.types) {
+        if (type >= 4 || object.sizeOfBlocks[type] < 8) {
+          std::cerr << "[Err] Invalid chunk type " << type << " of object "
+                    << object.frameName << std::endl;
+          return false;
+        }
+        streamSize += object.sizeOfBlocks[type];
+        size_t payloadLength = object.sizeOfBlocks[type] - 8;
+        if (payloadLength > sizeof(TransformPayload))
+          extraSize += payloadLength - sizeof(TransformPayload);
+      }
+      if (extraSize != track.extraPayload.size()) {
+        std::cerr << "[Err] Extra payload of object " << object.frameName
+                  << " doesn't match its chunk types" << std::endl;
+        return false;
+      }
+      object.sizeOfStreamSection = streamSize;
+      object.positionOfTheBeginning = transformationSize;
+      transformationSize += streamSize;
+    }
+    header.sizeOfObjectDefinitionsSection = transformationSize;
+    header.countOfCameraChunks = file.cameraPositionChunks.size();
+    header.countOfCameraFocusChunks = file.camerafocusChunks.size();
+
+    layout.eventsHeader = file.eventsHeader;
+    layout.eventsHeader.sizeOfPostheaderData = file.eventsPostheaderData.size();
+    layout.eventsHeader.sizeOfFadeSection =
+      file.fadeChunks.size() * sizeof(FadeChunk);
+    layout.eventsHeader.sizeOfScriptSection =
+      file.scriptChunks.size() * sizeof(ScriptChunk);
+    layout.eventsHeader.sizeOfSoundSection =
+      file.soundChunks.size() * sizeof(SoundChunk);
+    header.sizeOfScriptEventsSequence =
+      sizeof(ScriptsAndSoundsHeader) +
+      layout.eventsHeader.sizeOfPostheaderData +
+      layout.eventsHeader.sizeOfFadeSection +
+      layout.eventsHeader.sizeOfScriptSection +
+      layout.eventsHeader.sizeOfSoundSection;
+
+    layout.dialogHeader = file.dialogHeader;
+    layout.dialogHeader.countOfDialogs = file.dialogChunks.size();
+    layout.dialogHeader.countOfNarratorChunks = file.narratorChunks.size();
+    layout.dialogHeader.unk2 = file.morphChunks.size();
+    header.sizeOfDialogSection =
+      sizeof(DialogHeader) + file.dialogChunks.size() * sizeof(DialogChunk) +
+      file.narratorChunks.size() * sizeof(NarratorChunk) +
+      file.morphChunks.size() * sizeof(MorphChunk);
+
+    layout.fileSize = sizeof(Header) +
+                      file.animationBlocks.size() * sizeof(AnimationBlock) +
+                      file.animatedObjects.size() *
+                        sizeof(AnimatedObjectDefinitions) +
+                      transformationSize +
+                      file.cameraPositionChunks.size() *
+                        sizeof(CameraTransformationChunk) +
+                      file.camerafocusChunks.size() * sizeof(CameraFocusChunk) +
+                      header.sizeOfScriptEventsSequence +
+                      header.sizeOfDialogSection;
+    return true;
+  }
+
+  static void storeHeader(const Layout& layout, std::vector<char>& buffer)
+  {
+    write(buffer, layout.header);
+  }
+
+  static void storeAnimations(const File& file, std::vector<char>& buffer)
+  {
+    for (const auto& block : file.animationBlocks)
+      write(buffer, block);
+  }
+
+  static void storeObjectDefinitions(const Layout& layout,
+                                     std::vector<char>& buffer)
+  {
+    for (const auto& object : layout.animatedObjects)
+      write(buffer, object);
+  }
+
+  static void storeTransformation(const File& file,
+                                  const Layout& layout,
+                                  std::vector<char>& buffer)
+  {
+    for (size_t i = 0; i < layout.animatedObjects.size(); i++) {
+      const auto& object = layout.animatedObjects[i];
+      const auto& track = file.transformTracks[i];
+      write(buffer, track.streamHeader);
+      const unsigned char* extra = track.extraPayload.data();
+      for (size_t key = 0; key < track.size(); key++) {
+        TransformationHeader header;
+        header.timestamp = track.timestamps[key];
+        header.type = track.types[key];
+        write(buffer, header);
+
+        size_t payloadLength = object.sizeOfBlocks[header.type] - 8;
+        TransformPayload body = track.getPayload(key);
+        size_t bodyLength = std::min(payloadLength, sizeof(TransformPayload));
+        const char* bytes = reinterpret_cast<const char*>(&body);
+        buffer.insert(buffer.end(), bytes, bytes + bodyLength);
+        buffer.insert(buffer.end(), extra,
+                      extra + (payloadLength - bodyLength));
+        extra += payloadLength - bodyLength;
+      }
     }
+  }
 
+  static void storeCameraSection(const File& file, std::vector<char>& buffer)
+  {
+    for (const auto& chunk : file.cameraPositionChunks)
+      write(buffer, chunk);
+    for (const auto& chunk : file.camerafocusChunks)
+      write(buffer, chunk);
+  }
 
+  static void storeScriptEvents(const File& file,
+                                const Layout& layout,
+                                std::vector<char>& buffer)
+  {
+    write(buffer, layout.eventsHeader);
+    buffer.insert(buffer.end(), file.eventsPostheaderData.begin(),
+                  file.eventsPostheaderData.end());
+    for (const auto& chunk : file.fadeChunks)
+      write(buffer, chunk);
+    for (const auto& chunk : file.scriptChunks)
+      write(buffer, chunk);
+    for (const auto& chunk : file.soundChunks)
+      write(buffer, chunk);
+  }
 
+  static void storeDialogs(const File& file,
+                           const Layout& layout,
+                           std::vector<char>& buffer)
+  {
+    write(buffer, layout.dialogHeader);
+    for (const auto& chunk : file.dialogChunks)
+      write(buffer, chunk);
+    for (const auto& chunk : file.narratorChunks)
+      write(buffer, chunk);
+    for (const auto& chunk : file.morphChunks)
+      write(buffer, chunk);
   }
 
-  bool storeHeader(std::ofstream outputFile)
+  static void storeSection(const File& file,
+                           const Layout& layout,
+                           Section section,
+                           std::vector<char>& buffer)
   {
-    Header header;
-    header.magicByte = 0x31160000;
-    // Calculate size of animation section as count of animations * size of AnimationBlock
-    header.sizeOfAnimationSection = currentFile.animationBlocks.size()*sizeof(AnimationBlock);
-    header.sizeOfObjectDefinitionsSection = currentFile.objectDefinitionBlocks.size()*sizeof(AnimatedObjectDefinitions);
+    switch (section) {
+      case SECTION_ANIMATIONS:
+        storeAnimations(file, buffer);
+        break;
+      case SECTION_OBJECTS:
+        storeObjectDefinitions(layout, buffer);
+        break;
+      case SECTION_TRANSFORMATIONS:
+        storeTransformation(file, layout, buffer);
+        break;
+      case SECTION_CAMERA:
+        storeCameraSection(file, buffer);
+        break;
+      case SECTION_EVENTS:
+        storeScriptEvents(file, layout, buffer);
+        break;
+      case SECTION_DIALOGS:
+        storeDialogs(file, layout, buffer);
+        break;
+      default:
+        break;
+    }
   }
 
-  bool storeAnimations(std::ofstream outputFile) {}
-  bool storeObjectDefinitions(std::ofstream outputFile) {}
-  bool storeTransformation(std::ofstream outputFile) {}
-  bool storeCameraSection(std::ofstream outputFile) {}
-  bool storeScriptEvents(std::ofstream outputFile) {}
-  bool storeDialogs(std::ofstream outputFile) {}
+  template<typename T>
+  static uint64_t hashValue(const T& value, uint64_t seed)
+  {
+    return Hash::hash64(&value, sizeof(value), seed);
+  }
 
+  template<typename T>
+  static uint64_t hashVector(const std::vector<T>& vector, uint64_t seed)
+  {
+    return Hash::hash64(vector.data(), vector.size() * sizeof(T), seed);
+  }
+
+  static void computeDigests(const File& file,
+                             const Layout& layout,
+                             SectionDigests& digests)
+  {
+    const Header& header = layout.header;
+    digests.header = hashValue(header, 0);
+    digests.sections[SECTION_ANIMATIONS] = hashVector(file.animationBlocks, 0);
+    digests.sections[SECTION_OBJECTS] = hashVector(layout.animatedObjects, 0);
+    uint64_t transformations = 0;
+    for (size_t i = 0; i < layout.animatedObjects.size(); i++) {
+      const auto& track = file.transformTracks[i];
+      // payload length of keys is given by sizes of blocks of the object
+      transformations =
+        hashValue(layout.animatedObjects[i].sizeOfBlocks, transformations);
+      transformations = hashValue(track.streamHeader, transformations);
+      transformations = hashVector(track.timestamps, transformations);
+      transformations = hashVector(track.types, transformations);
+      transformations = hashVector(track.positions, transformations);
+      transformations = hashVector(track.rotations, transformations);
+      transformations = hashVector(track.auxiliary, transformations);
+      transformations = hashVector(track.animationStartOffsets, transformations);
+      transformations = hashVector(track.extraPayload, transformations);
+    }
+    digests.sections[SECTION_TRANSFORMATIONS] = transformations;
+    digests.sections[SECTION_CAMERA] = hashVector(
+      file.camerafocusChunks, hashVector(file.cameraPositionChunks, 0));
+    uint64_t events = hashValue(layout.eventsHeader, 0);
+    events = hashVector(file.eventsPostheaderData, events);
+    events = hashVector(file.fadeChunks, events);
+    events = hashVector(file.scriptChunks, events);
+    digests.sections[SECTION_EVENTS] = hashVector(file.soundChunks, events);
+    uint64_t dialogs = hashValue(layout.dialogHeader, 0);
+    dialogs = hashVector(file.dialogChunks, dialogs);
+    dialogs = hashVector(file.narratorChunks, dialogs);
+    digests.sections[SECTION_DIALOGS] = hashVector(file.morphChunks, dialogs);
+
+    digests.sizes[SECTION_ANIMATIONS] =
+      file.animationBlocks.size() * sizeof(AnimationBlock);
+    digests.sizes[SECTION_OBJECTS] =
+      layout.animatedObjects.size() * sizeof(AnimatedObjectDefinitions);
+    digests.sizes[SECTION_TRANSFORMATIONS] =
+      header.sizeOfObjectDefinitionsSection;
+    digests.sizes[SECTION_CAMERA] =
+      file.cameraPositionChunks.size() * sizeof(CameraTransformationChunk) +
+      file.camerafocusChunks.size() * sizeof(CameraFocusChunk);
+    digests.sizes[SECTION_EVENTS] = header.sizeOfScriptEventsSequence;
+    digests.sizes[SECTION_DIALOGS] = header.sizeOfDialogSection;
+    digests.fileSize = layout.fileSize;
+  }
 
 public:
   File loadFile(std::string fileName)
   {
-    std::cerr << "[RepParser] Parsing file: " << fileName << std::endl;
+    Visitor silentVisitor;
+    return loadFile(fileName, silentVisitor);
+  }
+
+  File loadFile(std::string fileName, Visitor& fileVisitor)
+  {
+    File file;
+    loadFile(fileName, file, fileVisitor);
+    return file;
+  }
+
+  /// Statistics of the last loadFile() (partial if it failed)
+  const LoadStats& getStats() const { return stats; }
+
+  /// Parses file into file, returns false (and reports an error) on failure
+  bool loadFile(const std::string& fileName, File& file, Visitor& fileVisitor)
+  {
+    auto loadStart = std::chrono::steady_clock::now();
+    uint64_t loadStartAllocations = Allocations::getCount();
+    stats = LoadStats();
+    visitor = &fileVisitor;
+    streamPosition = 0;
+    currentFile = File();
+    visitor->onBeginFile(fileName);
     std::ifstream inputFile;
-    inputFile.open(fileName, std::ifstream::binary);
-    if (inputFile.is_open()) {
-      inputFile.READ(fileHeader);
-      std::cout << "Magic Byte: " << std::hex << fileHeader.magicByte
-                << std::dec << std::endl;
-      std::cout << "Anim block size: " << fileHeader.sizeOfAnimationSection
-                << std::endl;
-      std::cout << "Count of anims: " << fileHeader.countOfAnimationBlocks
-                << std::endl;
-      if (fileHeader.magicByte != magicByteConstant) {
-        std::cerr << "[Err] Invalid magic byte ...\n" << std::endl;
-        return File();
-      }
-      readAnimations(inputFile);
-      readObjectDefinitions(inputFile);
-      readTransformation(inputFile);
-      readCameraSection(inputFile);
-      readScriptEvents(inputFile);
-      readDialogs(inputFile);
-      inputFile.close();
-    } else {
-      std::cerr << "[Err] Failed to open file " << fileName << std::endl;
+    inputFile.open(fileName, std::ifstream::binary | std::ifstream::ate);
+    if (!inputFile.is_open()) {
+      visitor->onError("Failed to open file " + fileName);
+      return false;
+    }
+    fileSize = static_cast<size_t>(inputFile.tellg());
+    inputFile.seekg(0);
+    read(inputFile, fileHeader);
+    if (!inputFile) {
+      visitor->onError("Unexpected end of file " + fileName);
+      return false;
+    }
+    visitor->onHeader(fileHeader);
+    if (fileHeader.magicByte != magicByteConstant) {
+      visitor->onError("Invalid magic byte ...\n");
+      return false;
+    }
+    currentFile.header = fileHeader;
+    stats.fileSize = fileSize;
+    beginSection();
+    readAnimations(inputFile);
+    endSection(SECTION_ANIMATIONS, currentFile.animationBlocks.size());
+    beginSection();
+    readObjectDefinitions(inputFile);
+    endSection(SECTION_OBJECTS, currentFile.animatedObjects.size());
+    beginSection();
+    if (!readTransformation(inputFile))
+      return false;
+    size_t countOfKeys = 0;
+    for (const auto& track : currentFile.transformTracks)
+      countOfKeys += track.size();
+    endSection(SECTION_TRANSFORMATIONS, countOfKeys);
+    beginSection();
+    readCameraSection(inputFile);
+    endSection(SECTION_CAMERA, currentFile.cameraPositionChunks.size() +
+                                 currentFile.camerafocusChunks.size());
+    beginSection();
+    readScriptEvents(inputFile);
+    endSection(SECTION_EVENTS, currentFile.fadeChunks.size() +
+                                 currentFile.scriptChunks.size() +
+                                 currentFile.soundChunks.size());
+    beginSection();
+    readDialogs(inputFile);
+    endSection(SECTION_DIALOGS, currentFile.dialogChunks.size() +
+                                  currentFile.narratorChunks.size() +
+                                  currentFile.morphChunks.size());
+    if (!inputFile) {
+      visitor->onError("Unexpected end of file " + fileName);
+      return false;
     }
-    return currentFile;
+    file = std::move(currentFile);
+    stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - loadStart)
+                      .count();
+    stats.countOfAllocations = Allocations::getCount() - loadStartAllocations;
+    return true;
   }
-  bool storeFile(File file, std::string fileName)
+
+  /// Serializes file into buffer, which is allocated exactly once
+  static bool storeToBuffer(const File& file, std::vector<char>& buffer)
   {
-    std::cerr << "[RepParser] Parsing file: " << fileName << std::endl;
+    Layout layout;
+    if (!computeLayout(file, layout))
+      return false;
+    buffer.clear();
+    buffer.reserve(layout.fileSize);
+    storeHeader(layout, buffer);
+    storeAnimations(file, buffer);
+    storeObjectDefinitions(layout, buffer);
+    storeTransformation(file, layout, buffer);
+    storeCameraSection(file, buffer);
+    storeScriptEvents(file, layout, buffer);
+    storeDialogs(file, layout, buffer);
+    return true;
+  }
+
+  /// Stores file, the whole content is written with a single write
+  bool storeFile(const File& file, std::string fileName)
+  {
+    std::vector<char> buffer;
+    if (!storeToBuffer(file, buffer))
+      return false;
     std::ofstream outputFile;
-    outputFile.open(fileName, std::ifstream::binary);
-    if (outputFile.is_open()) {
-      currentFile = file;
-      storeHeader(outputFile);
-      storeAnimations(outputFile);
-      storeObjectDefinitions(outputFile);
-      storeTransformation(outputFile);
-      storeCameraSection(outputFile);
-      storeScriptEvents(outputFile);
-      storeDialogs(outputFile);
-      outputFile.close();
+    outputFile.open(fileName, std::ofstream::binary | std::ofstream::trunc);
+    if (!outputFile.is_open()) {
+      std::cerr << "[Err] Failed to open file " << fileName << std::endl;
+      return false;
+    }
+    // bigger than stream's buffer, thus passed to the OS directly
+    outputFile.write(buffer.data(), buffer.size());
+    outputFile.close();
+    return static_cast<bool>(outputFile);
+  }
+
+  /// Digests of file as it's going to be stored by storeFile()
+  static bool computeDigests(const File& file, SectionDigests& digests)
+  {
+    Layout layout;
+    if (!computeLayout(file, layout))
+      return false;
+    computeDigests(file, layout, digests);
+    return true;
+  }
+
+  /* \brief Stores file over its previous version, rewriting only modified
+   * sections
+   *
+   * digests must describe the current content of fileName, i.e. come from
+   * computeDigests() of the loaded file or from the previous call, and are
+   * updated to the stored file. The header is rewritten only if any count or
+   * size changed. Modified sections of unchanged size are patched in place.
+   * Sections from the first one whose size changed are moved: modified ones
+   * are serialized, the others are copied from their old offset. The result
+   * is identical to storeFile(file, fileName).
+   *
+   * If fileName doesn't exist or its size doesn't match digests, the whole
+   * file is written.
+   */
+  bool storeFile(const File& file,
+                 const std::string& fileName,
+                 SectionDigests& digests)
+  {
+    Layout layout;
+    if (!computeLayout(file, layout))
+      return false;
+    SectionDigests stored;
+    computeDigests(file, layout, stored);
+
+    std::error_code error;
+    auto oldSize = std::filesystem::file_size(fileName, error);
+    if (error || digests.fileSize == 0 || oldSize != digests.fileSize) {
+      digests.fileSize = 0;
+      if (!storeFile(file, fileName))
+        return false;
+      digests = stored;
+      return true;
+    }
+
+    size_t firstMoved = COUNT_OF_SECTIONS;
+    for (size_t i = 0; i < COUNT_OF_SECTIONS && firstMoved == COUNT_OF_SECTIONS;
+         i++) {
+      if (digests.sizes[i] != stored.sizes[i])
+        firstMoved = i;
+    }
+    uint64_t oldOffsets[COUNT_OF_SECTIONS];
+    uint64_t newOffsets[COUNT_OF_SECTIONS];
+    oldOffsets[0] = newOffsets[0] = sizeof(Header);
+    for (size_t i = 1; i < COUNT_OF_SECTIONS; i++) {
+      oldOffsets[i] = oldOffsets[i - 1] + digests.sizes[i - 1];
+      newOffsets[i] = newOffsets[i - 1] + stored.sizes[i - 1];
+    }
+
+    std::fstream outputFile;
+    outputFile.open(fileName,
+                    std::fstream::binary | std::fstream::in | std::fstream::out);
+    if (!outputFile.is_open()) {
+      std::cerr << "[Err] Failed to open file " << fileName << std::endl;
+      return false;
+    }
+    // from now on, the file on disk may differ from digests until it's done
+    digests.fileSize = 0;
+
+    // moved sections are gathered before anything is written, thus clean ones
+    // can be copied from their old place even if they overlap the new one
+    std::vector<char> movedBuffer;
+    if (firstMoved < COUNT_OF_SECTIONS)
+      movedBuffer.reserve(layout.fileSize - newOffsets[firstMoved]);
+    for (size_t i = firstMoved; i < COUNT_OF_SECTIONS; i++) {
+      if (digests.sections[i] != stored.sections[i]) {
+        storeSection(file, layout, Section(i), movedBuffer);
+        continue;
+      }
+      size_t start = movedBuffer.size();
+      movedBuffer.resize(start + stored.sizes[i]);
+      outputFile.seekg(oldOffsets[i]);
+      outputFile.read(movedBuffer.data() + start, stored.sizes[i]);
+    }
+
+    std::vector<char> buffer;
+    if (digests.header != stored.header) {
+      storeHeader(layout, buffer);
+      outputFile.seekp(0);
+      outputFile.write(buffer.data(), buffer.size());
+    }
+    for (size_t i = 0; i < firstMoved; i++) {
+      if (digests.sections[i] == stored.sections[i])
+        continue;
+      buffer.clear();
+      storeSection(file, layout, Section(i), buffer);
+      outputFile.seekp(newOffsets[i]);
+      outputFile.write(buffer.data(), buffer.size());
+    }
+    if (!movedBuffer.empty()) {
+      outputFile.seekp(newOffsets[firstMoved]);
+      outputFile.write(movedBuffer.data(), movedBuffer.size());
+    }
+    outputFile.close();
+    if (!outputFile) {
+      std::cerr << "[Err] Failed to update file " << fileName << std::endl;
+      return false;
+    }
+    if (layout.fileSize < oldSize) {
+      std::filesystem::resize_file(fileName, layout.fileSize, error);
+      if (error) {
+        std::cerr << "[Err] Failed to truncate file " << fileName << std::endl;
+        return false;
+      }
+    }
+    digests = stored;
+    return true;
   }
 };
 } // namespace RepFile
@@ -0,0 +1,402 @@
+/*
+ * .rep parser benchmark
+ * Author: Roman Romop5 Dobias
+ * Purpose: times section readers, whole-file load, sampling and serialization
+ * and prints the results as JSON, thus runs can be compared between releases
+ */
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+
+#include "arena.hpp"
+#include "batch.hpp"
+#include "cache.hpp"
+#include "camera.hpp"
+#include "compact.hpp"
+#include "decimate.hpp"
+#include "generator.hpp"
+#include "json.hpp"
+#include "parallel.hpp"
+#include "push.hpp"
+#include "symbols.hpp"
+#include "timeline.hpp"
+#include "view.hpp"
+using namespace RepFile;
+
+using Clock = std::chrono::steady_clock;
+
+// results of measured loops are stored here, thus they aren't optimized out
+static volatile uint64_t sink;
+
+struct Result
+{
+  std::string name;
+  std::vector<double> seconds; // one per iteration
+  uint64_t bytes;              // processed bytes per iteration
+  uint64_t items;              // processed items (keys, poses) per iteration
+
+  double getMinimum() const
+  {
+    return *std::min_element(seconds.begin(), seconds.end());
+  }
+
+  double getMedian() const
+  {
+    std::vector<double> sorted = seconds;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[sorted.size() / 2];
+  }
+};
+
+/* \brief Measures time spent in each section reader of Loader
+ */
+class SectionTimer : public Visitor
+{
+public:
+  double seconds[COUNT_OF_SECTIONS] = {};
+  Section currentSection = COUNT_OF_SECTIONS;
+  Clock::time_point sectionStart;
+
+  void onSection(Section section) override
+  {
+    finish();
+    currentSection = section;
+    sectionStart = Clock::now();
+  }
+
+  void finish()
+  {
+    if (currentSection == COUNT_OF_SECTIONS)
+      return;
+    seconds[currentSection] +=
+      std::chrono::duration<double>(Clock::now() - sectionStart).count();
+    currentSection = COUNT_OF_SECTIONS;
+  }
+};
+
+template<typename Function>
+Result measure(const std::string& name,
+               size_t iterations,
+               uint64_t bytes,
+               uint64_t items,
+               Function function)
+{
+  Result result{ name, {}, bytes, items };
+  for (size_t i = 0; i < iterations; i++) {
+    auto start = Clock::now();
+    function();
+    result.seconds.push_back(
+      std::chrono::duration<double>(Clock::now() - start).count());
+  }
+  return result;
+}
+
+static uint64_t getSectionSize(const Header& header, Section section)
+{
+  switch (section) {
+    case SECTION_ANIMATIONS:
+      return uint64_t(header.countOfAnimationBlocks) * sizeof(AnimationBlock);
+    case SECTION_OBJECTS:
+      return uint64_t(header.countOfObjectDefinitionBlocks) *
+             sizeof(AnimatedObjectDefinitions);
+    case SECTION_TRANSFORMATIONS:
+      return header.sizeOfObjectDefinitionsSection;
+    case SECTION_CAMERA:
+      return uint64_t(header.countOfCameraChunks) *
+               sizeof(CameraTransformationChunk) +
+             uint64_t(header.countOfCameraFocusChunks) * sizeof(CameraFocusChunk);
+    case SECTION_EVENTS:
+      return header.sizeOfScriptEventsSequence;
+    case SECTION_DIALOGS:
+      return header.sizeOfDialogSection;
+    default:
+      return 0;
+  }
+}
+
+/// Decimation bounds are in radians of rotation, thus 1 degree must be 1 degree
+static bool checkRotationMetric()
+{
+  const float degree = 3.14159265f / 180.0f;
+  Rotation identity = { 1.0f, 0.0f, 0.0f, 0.0f };
+  Rotation rotated = { std::cos(degree / 2.0f), std::sin(degree / 2.0f), 0.0f,
+                       0.0f };
+  float angle = Decimation::Detail::getAngle(identity, rotated);
+  if (std::fabs(angle - degree) > 1e-3f * degree) {
+    std::cerr << "[Err] rotation of 1 deg measured as " << angle / degree
+              << " deg" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static void printJson(const std::string& input,
+                      uint64_t fileSize,
+                      const std::vector<Result>& results,
+                      std::ostream& output)
+{
+  output << "{\n  \"benchmark\": \"repbench\",\n  \"version\": 1,\n"
+         << "  \"input\": \"" << Json::escape(input) << "\",\n"
+         << "  \"fileSize\": " << fileSize << ",\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& result = results[i];
+    double minimum = result.getMinimum();
+    output << "    { \"name\": \"" << result.name << "\""
+           << ", \"iterations\": " << result.seconds.size()
+           << ", \"minMs\": " << minimum * 1e3
+           << ", \"medianMs\": " << result.getMedian() * 1e3
+           << ", \"bytes\": " << result.bytes
+           << ", \"items\": " << result.items << ", \"mbPerSecond\": "
+           << (minimum > 0.0 ? result.bytes / minimum / (1024.0 * 1024.0) : 0.0)
+           << ", \"itemsPerSecond\": "
+           << (minimum > 0.0 ? result.items / minimum : 0.0) << " }"
+           << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  output << "  ]\n}" << std::endl;
+}
+
+static void printUsage()
+{
+  std::cerr << "USAGE: repbench [options]" << std::endl
+            << "  --input FILE      benchmark given .rep instead of a synthetic one"
+            << std::endl
+            << "  --actors N        count of actors of the synthetic file" << std::endl
+            << "  --duration MS     length of the synthetic file" << std::endl
+            << "  --iterations N    repetitions of each measurement" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  GeneratorSettings settings;
+  settings.countOfActors = 32;
+  settings.duration = 300000;
+  size_t iterations = 5;
+  std::string input;
+  for (int i = 1; i < argc; i++) {
+    std::string option = argv[i];
+    if (i + 1 >= argc) {
+      printUsage();
+      return 1;
+    }
+    std::string value = argv[++i];
+    if (option == "--input")
+      input = value;
+    else if (option == "--actors")
+      settings.countOfActors = std::strtoul(value.c_str(), nullptr, 10);
+    else if (option == "--duration")
+      settings.duration = uint32_t(std::strtoul(value.c_str(), nullptr, 10));
+    else if (option == "--iterations")
+      iterations = std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+    else {
+      printUsage();
+      return 1;
+    }
+  }
+
+  if (!checkRotationMetric())
+    return 1;
+
+  Loader loader;
+  std::string fileName = input;
+  if (input.empty()) {
+    fileName =
+      (std::filesystem::temp_directory_path() / "repbench.rep").string();
+    if (!loader.storeFile(Generator(settings).generate(), fileName))
+      return 1;
+  }
+
+  ErrorCollector errors;
+  File file;
+  if (!loader.loadFile(fileName, file, errors)) {
+    std::cerr << "[Err] " << errors.lastError << std::endl;
+    return 1;
+  }
+  uint64_t fileSize = std::filesystem::file_size(fileName);
+  uint64_t countOfKeys = 0;
+  uint32_t duration = 0;
+  for (const auto& track : file.transformTracks) {
+    countOfKeys += track.size();
+    if (track.size() > 0)
+      duration = std::max(duration, track.timestamps.back());
+  }
+
+  std::vector<Result> results;
+
+  // section readers, measured inside of whole-file loads
+  std::vector<double> sectionSeconds[COUNT_OF_SECTIONS];
+  for (size_t i = 0; i < iterations; i++) {
+    SectionTimer timer;
+    File loaded;
+    loader.loadFile(fileName, loaded, timer);
+    timer.finish();
+    for (size_t section = 0; section < COUNT_OF_SECTIONS; section++)
+      sectionSeconds[section].push_back(timer.seconds[section]);
+  }
+  for (size_t section = 0; section < COUNT_OF_SECTIONS; section++) {
+    Section type = static_cast<Section>(section);
+    Result result{ std::string("section.") + getSectionName(type),
+                   sectionSeconds[section], getSectionSize(file.header, type),
+                   0 };
+    if (type == SECTION_TRANSFORMATIONS)
+      result.items = countOfKeys;
+    results.push_back(result);
+  }
+
+  results.push_back(measure("load.file", iterations, fileSize, countOfKeys, [&]() {
+    File loaded;
+    Visitor silent;
+    loader.loadFile(fileName, loaded, silent);
+  }));
+  BStream source;
+  source.open(fileName);
+  results.push_back(measure("load.push", iterations, fileSize, countOfKeys, [&]() {
+    // fragments as they come from a pipe
+    Visitor silent;
+    PushParser parser(silent);
+    const size_t fragmentSize = 64 * 1024;
+    for (size_t offset = 0; offset < source.size(); offset += fragmentSize)
+      parser.feed(source.data() + offset,
+                  std::min(fragmentSize, source.size() - offset));
+    parser.finish();
+  }));
+  results.push_back(measure("load.view", iterations, fileSize, 0, [&]() {
+    View view;
+    view.open(fileName);
+  }));
+  ThreadPool pool;
+  ParallelLoader parallelLoader(pool);
+  results.push_back(measure("load.parallel", iterations, fileSize, countOfKeys, [&]() {
+    File loaded;
+    parallelLoader.loadFile(fileName, loaded);
+  }));
+  std::string cacheDirectory =
+    (std::filesystem::temp_directory_path() / "repbench_cache").string();
+  Cache cache(cacheDirectory);
+  {
+    CachedFile warmup;
+    cache.load(fileName, warmup);
+  }
+  results.push_back(measure("load.cached", iterations, fileSize, countOfKeys, [&]() {
+    CachedFile cached;
+    cache.load(fileName, cached);
+  }));
+  results.push_back(measure("load.arena", iterations, fileSize, countOfKeys, [&]() {
+    Arena arena;
+    arena.loadFile(fileName);
+  }));
+
+  const uint32_t frameTime = 16;
+  uint64_t countOfPoses =
+    uint64_t(duration / frameTime + 1) * file.transformTracks.size();
+  Sampler sampler(file);
+  Pose pose;
+  results.push_back(measure("sample.cursor", iterations, 0, countOfPoses, [&]() {
+    auto cursor = sampler.createCursor();
+    for (uint32_t time = 0; time <= duration; time += frameTime) {
+      for (size_t i = 0; i < sampler.getCountOfObjects(); i++)
+        pose = cursor.poseAt(i, time);
+    }
+  }));
+  std::vector<Position> positions(sampler.getCountOfObjects());
+  std::vector<Rotation> rotations(sampler.getCountOfObjects());
+  results.push_back(measure("sample.batch", iterations, 0, countOfPoses, [&]() {
+    BatchEvaluator evaluator(sampler, ROTATION_NLERP);
+    for (uint32_t time = 0; time <= duration; time += frameTime)
+      evaluator.evaluate(time, positions.data(), rotations.data());
+  }));
+
+  CameraTrack camera(file);
+  uint32_t cameraEnd = std::max<uint32_t>(camera.getEndTime(), 1);
+  uint64_t countOfCameraFrames = cameraEnd / frameTime + 1;
+  CameraState cameraState;
+  results.push_back(measure("camera.cursor", iterations, 0, countOfCameraFrames, [&]() {
+    auto cursor = camera.createCursor();
+    for (uint32_t time = 0; time <= cameraEnd; time += frameTime)
+      cameraState = cursor.cameraAt(time);
+    sink = uint64_t(cameraState.fov);
+  }));
+  auto cameraTable = camera.bake(frameTime);
+  results.push_back(measure("camera.table", iterations, 0, countOfCameraFrames, [&]() {
+    for (uint32_t time = 0; time <= cameraEnd; time += frameTime)
+      cameraState = cameraTable.at(time);
+    sink = uint64_t(cameraState.fov);
+  }));
+
+  Timeline timeline(file);
+  results.push_back(measure("timeline.build", iterations, 0, timeline.size(), [&]() {
+    Timeline built(file);
+  }));
+  size_t countOfFired = 0;
+  results.push_back(measure("timeline.cursor", iterations, 0, duration / frameTime + 1, [&]() {
+    auto cursor = timeline.createCursor();
+    for (uint32_t time = 0; time <= duration; time += frameTime)
+      countOfFired += cursor.advance(time).size();
+    sink = countOfFired;
+  }));
+
+  // resolve every actor once, as scripts do when binding a cutscene
+  std::vector<std::string> actors;
+  for (const auto& object : file.animatedObjects)
+    actors.emplace_back(object.actorName,
+                        strnlen(object.actorName, sizeof(object.actorName)));
+  size_t countOfResolved = 0;
+  results.push_back(measure("names.scan", iterations, 0, actors.size(), [&]() {
+    for (const auto& actor : actors) {
+      for (size_t i = 0; i < file.animatedObjects.size(); i++) {
+        if (strncmp(file.animatedObjects[i].actorName, actor.c_str(),
+                    sizeof(file.animatedObjects[i].actorName)) == 0) {
+          countOfResolved++;
+          break;
+        }
+      }
+    }
+    sink = countOfResolved;
+  }));
+  results.push_back(measure("names.build", iterations, 0, actors.size(), [&]() {
+    NameIndex built(file);
+  }));
+  NameIndex names(file);
+  results.push_back(measure("names.index", iterations, 0, actors.size(), [&]() {
+    for (const auto& actor : actors)
+      countOfResolved += names.findObjectByActor(actor) != NameIndex::notFound;
+    sink = countOfResolved;
+  }));
+
+  std::vector<char> buffer;
+  results.push_back(measure("store.buffer", iterations, fileSize, countOfKeys, [&]() {
+    Loader::storeToBuffer(file, buffer);
+  }));
+  std::string outputName =
+    (std::filesystem::temp_directory_path() / "repbench_store.rep").string();
+  results.push_back(measure("store.file", iterations, fileSize, countOfKeys, [&]() {
+    loader.storeFile(file, outputName);
+  }));
+  // edits a single script timestamp, as editors do, and re-saves the file
+  File edited = file;
+  if (edited.scriptChunks.empty())
+    edited.scriptChunks.push_back(ScriptChunk());
+  SectionDigests digests;
+  Loader::computeDigests(edited, digests);
+  loader.storeFile(edited, outputName);
+  results.push_back(measure("store.update", iterations, fileSize, 0, [&]() {
+    edited.scriptChunks[0].timestamp++;
+    loader.storeFile(edited, outputName, digests);
+  }));
+
+  std::vector<unsigned char> compact;
+  Compact::encode(file, compact);
+  results.push_back(measure("compact.encode", iterations, fileSize, countOfKeys, [&]() {
+    Compact::encode(file, compact);
+  }));
+  results.push_back(measure("compact.decode", iterations, compact.size(), countOfKeys, [&]() {
+    File decoded;
+    Compact::decode(compact.data(), compact.size(), decoded);
+  }));
+
+  std::filesystem::remove(outputName);
+  std::filesystem::remove_all(cacheDirectory);
+  if (input.empty())
+    std::filesystem::remove(fileName);
+  printJson(input.empty() ? "synthetic" : input, fileSize, results, std::cout);
+  return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * Synthetic .rep generator
+ * Author: Roman Romop5 Dobias
+ * Purpose: writes valid cutscenes of arbitrary size for benchmarking
+ */
+#include <cstdlib>
+
+#include "generator.hpp"
+using namespace RepFile;
+
+static void printUsage()
+{
+  std::cerr << "USAGE: repgen output.rep [options]" << std::endl
+            << "  --actors N        count of animated objects" << std::endl
+            << "  --duration MS     length of cutscene" << std::endl
+            << "  --key-interval MS time between transformation keys" << std::endl
+            << "  --animations N    count of animation blocks" << std::endl
+            << "  --cameras N       count of camera chunks" << std::endl
+            << "  --focus N         count of camera focus chunks" << std::endl
+            << "  --scripts N       count of script chunks" << std::endl
+            << "  --sounds N        count of sound chunks" << std::endl
+            << "  --dialogs N       count of dialog chunks" << std::endl
+            << "  --narrators N     count of narrator chunks" << std::endl
+            << "  --morphs N        count of morph chunks" << std::endl
+            << "  --seed N          random seed" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    printUsage();
+    return 1;
+  }
+  GeneratorSettings settings;
+  for (int i = 2; i < argc; i++) {
+    std::string option = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "[Err] Missing value of " << option << std::endl;
+      return 1;
+    }
+    unsigned long value = std::strtoul(argv[++i], nullptr, 10);
+    if (option == "--actors")
+      settings.countOfActors = value;
+    else if (option == "--duration")
+      settings.duration = uint32_t(value);
+    else if (option == "--key-interval")
+      settings.keyInterval = uint32_t(value);
+    else if (option == "--animations")
+      settings.countOfAnimations = value;
+    else if (option == "--cameras")
+      settings.countOfCameraChunks = value;
+    else if (option == "--focus")
+      settings.countOfFocusChunks = value;
+    else if (option == "--scripts")
+      settings.countOfScripts = value;
+    else if (option == "--sounds")
+      settings.countOfSounds = value;
+    else if (option == "--dialogs")
+      settings.countOfDialogs = value;
+    else if (option == "--narrators")
+      settings.countOfNarrators = value;
+    else if (option == "--morphs")
+      settings.countOfMorphs = value;
+    else if (option == "--seed")
+      settings.seed = uint32_t(value);
+    else {
+      std::cerr << "[Err] Unknown option " << option << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+  File file = Generator(settings).generate();
+  Loader loader;
+  return loader.storeFile(file, argv[1]) ? 0 : 1;
+}
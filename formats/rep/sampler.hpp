@@ -0,0 +1,251 @@
+#pragma once
+/*
+ * .rep pose sampler
+ * Author: Roman Romop5 Dobias
+ * Purpose: evaluate animated objects at arbitrary time of cutscene
+ */
+
+#include <cmath>
+
+#include "bstream.hpp"
+#include "rep.hpp"
+
+namespace RepFile {
+
+/* \brief Read-only channels of a single transformation track
+ *
+ * Decouples sampling from the storage of tracks.
+ */
+struct TrackView
+{
+  Span<const uint32_t> timestamps;
+  Span<const Position> positions;
+  Span<const Rotation> rotations;
+  Span<const uint32_t> auxiliary;
+  Span<const uint32_t> animationStartOffsets;
+
+  size_t size() const { return timestamps.size(); }
+};
+
+inline TrackView makeTrackView(const TransformTrack& track)
+{
+  TrackView view;
+  view.timestamps = Span<const uint32_t>(track.timestamps.data(), track.size());
+  view.positions = Span<const Position>(track.positions.data(), track.size());
+  view.rotations = Span<const Rotation>(track.rotations.data(), track.size());
+  view.auxiliary = Span<const uint32_t>(track.auxiliary.data(), track.size());
+  view.animationStartOffsets =
+    Span<const uint32_t>(track.animationStartOffsets.data(), track.size());
+  return view;
+}
+
+/* \brief State of animated object at given time
+ */
+struct Pose
+{
+  Position position;
+  Rotation rotation;
+  uint32_t animationID;   // valid only if hasAnimation
+  uint32_t animationBlock; // index into animation blocks (AnimationTable)
+  uint32_t animationTime; // miliseconds since the start of animation
+  bool hasAnimation;
+  bool shouldRepeat; // animation loops, wrapping animationTime is up to caller
+  bool isValid;      // false for objects without any key
+};
+
+/// Each unit of TransformPayload::getAnimationOffset() stands for 40 ms
+const uint32_t animationOffsetUnit = 40;
+
+/// Linear interpolation of positions
+inline Position lerp(const Position& a, const Position& b, float alpha)
+{
+  return Position{ a[0] + (b[0] - a[0]) * alpha, a[1] + (b[1] - a[1]) * alpha,
+                   a[2] + (b[2] - a[2]) * alpha };
+}
+
+/// Spherical interpolation of rotations along the shortest arc
+inline Rotation slerp(const Rotation& a, const Rotation& b, float alpha)
+{
+  float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+  float sign = 1.0f;
+  if (dot < 0.0f) {
+    dot = -dot;
+    sign = -1.0f;
+  }
+  float weightA = 1.0f - alpha;
+  float weightB = alpha;
+  // fall back to linear interpolation for almost identical rotations
+  if (dot < 0.9995f) {
+    float angle = std::acos(dot);
+    float inverseSin = 1.0f / std::sin(angle);
+    weightA = std::sin(weightA * angle) * inverseSin;
+    weightB = std::sin(weightB * angle) * inverseSin;
+  }
+  weightB *= sign;
+  Rotation result;
+  float length = 0.0f;
+  for (size_t i = 0; i < 4; i++) {
+    result[i] = a[i] * weightA + b[i] * weightB;
+    length += result[i] * result[i];
+  }
+  float inverseLength = length > 0.0f ? 1.0f / std::sqrt(length) : 0.0f;
+  for (size_t i = 0; i < 4; i++)
+    result[i] *= inverseLength;
+  return result;
+}
+
+/* \brief Evaluates poses of animated objects
+ *
+ * Keys are searched by binary search on timestamps, thus poseAt() costs
+ * O(log n). For linear playback, Cursor remembers the last key of each object
+ * and moves forward in amortized O(1).
+ *
+ * Interpolation rules:
+ *  - before the first key / after the last key, the boundary key is held
+ *  - if the key at the start of segment has ANIMATION_SHOULD_INTERPOLATE,
+ *    position is lerped and rotation slerped towards the next key, otherwise
+ *    the key is held until the next one (step)
+ *  - animation of the key starts getAnimationOffset() * 40 ms ahead
+ *
+ * Sampler only refers to tracks, thus the sampled File must outlive it.
+ */
+class Sampler
+{
+private:
+  std::vector<TrackView> tracks;
+  AnimationTable animations;
+
+public:
+  Sampler() {}
+  explicit Sampler(const File& file)
+    : animations(file.animationTable)
+  {
+    tracks.reserve(file.transformTracks.size());
+    for (const auto& track : file.transformTracks)
+      tracks.push_back(makeTrackView(track));
+  }
+  explicit Sampler(std::vector<TrackView> views,
+                   const AnimationTable& animationTable = AnimationTable())
+    : tracks(std::move(views))
+    , animations(animationTable)
+  {}
+
+  size_t getCountOfObjects() const { return tracks.size(); }
+  const TrackView& getTrack(size_t objectIndex) const
+  {
+    return tracks[objectIndex];
+  }
+
+  /// Returns index of the last key at or before timeMs (0 if there is none)
+  size_t findKey(size_t objectIndex, uint32_t timeMs) const
+  {
+    const auto& timestamps = tracks[objectIndex].timestamps;
+    const uint32_t* upper =
+      std::upper_bound(timestamps.begin(), timestamps.end(), timeMs);
+    return upper == timestamps.begin() ? 0 : upper - timestamps.begin() - 1;
+  }
+
+  /// Evaluates segment starting at given key
+  Pose poseAtKey(size_t objectIndex, size_t key, uint32_t timeMs) const
+  {
+    const auto& track = tracks[objectIndex];
+    Pose pose;
+    pose.isValid = track.size() > 0;
+    if (!pose.isValid) {
+      pose.position = Position{ 0.0f, 0.0f, 0.0f };
+      pose.rotation = Rotation{ 1.0f, 0.0f, 0.0f, 0.0f };
+      pose.animationID = 0;
+      pose.animationBlock = invalidAnimationBlock;
+      pose.animationTime = 0;
+      pose.hasAnimation = false;
+      pose.shouldRepeat = false;
+      return pose;
+    }
+
+    TransformPayload body;
+    body.auxiliary = track.auxiliary[key];
+    body.animationStartOffset = track.animationStartOffsets[key];
+    uint32_t keyTime = track.timestamps[key];
+    size_t next = key + 1;
+    if (body.shouldInterpolate() && next < track.size() && timeMs > keyTime) {
+      uint32_t duration = track.timestamps[next] - keyTime;
+      float alpha =
+        duration > 0 ? std::min(1.0f, float(timeMs - keyTime) / duration)
+                     : 1.0f;
+      pose.position = lerp(track.positions[key], track.positions[next], alpha);
+      pose.rotation = slerp(track.rotations[key], track.rotations[next], alpha);
+    } else {
+      pose.position = track.positions[key];
+      pose.rotation = track.rotations[key];
+    }
+
+    pose.hasAnimation = body.hasAnimationID();
+    pose.animationID = static_cast<uint32_t>(body.getAnimationID());
+    pose.animationBlock = pose.hasAnimation
+                            ? animations.findBlock(pose.animationID)
+                            : invalidAnimationBlock;
+    pose.shouldRepeat = body.shouldRepeat();
+    pose.animationTime =
+      (timeMs > keyTime ? timeMs - keyTime : 0) +
+      static_cast<uint32_t>(body.getAnimationOffset()) * animationOffsetUnit;
+    return pose;
+  }
+
+  Pose poseAt(size_t objectIndex, uint32_t timeMs) const
+  {
+    return poseAtKey(objectIndex, findKey(objectIndex, timeMs), timeMs);
+  }
+
+  /* \brief Stateful sampler for playback
+   *
+   * Keeps the current key of each object. Moving forward in time only steps
+   * over the keys, which were passed since the last call, moving backward
+   * falls back to binary search.
+   */
+  class Cursor
+  {
+  private:
+    const Sampler* sampler;
+    std::vector<size_t> currentKeys;
+    std::vector<uint32_t> lastTimes;
+
+  public:
+    explicit Cursor(const Sampler& owner)
+      : sampler(&owner)
+      , currentKeys(owner.getCountOfObjects(), 0)
+      , lastTimes(owner.getCountOfObjects(), 0)
+    {}
+
+    /// Returns index of the last key at or before timeMs (0 if there is none)
+    size_t findKey(size_t objectIndex, uint32_t timeMs)
+    {
+      size_t& key = currentKeys[objectIndex];
+      if (timeMs < lastTimes[objectIndex]) {
+        key = sampler->findKey(objectIndex, timeMs);
+      } else {
+        const auto& timestamps = sampler->getTrack(objectIndex).timestamps;
+        while (key + 1 < timestamps.size() && timestamps[key + 1] <= timeMs)
+          key++;
+      }
+      lastTimes[objectIndex] = timeMs;
+      return key;
+    }
+
+    const Sampler& getSampler() const { return *sampler; }
+
+    Pose poseAt(size_t objectIndex, uint32_t timeMs)
+    {
+      return sampler->poseAtKey(
+        objectIndex, findKey(objectIndex, timeMs), timeMs);
+    }
+
+    void reset()
+    {
+      std::fill(currentKeys.begin(), currentKeys.end(), 0);
+      std::fill(lastTimes.begin(), lastTimes.end(), 0);
+    }
+  };
+
+  Cursor createCursor() const { return Cursor(*this); }
+};
+} // namespace RepFile
@@ -0,0 +1,178 @@
+/*
+ * .rep multi-instance scheduler benchmark
+ * Author: Roman Romop5 Dobias
+ * Purpose: plays thousands of concurrent cutscene instances with different
+ * counts of threads and checks that fired events don't depend on them
+ */
+#include <chrono>
+#include <cstdlib>
+
+#include "generator.hpp"
+#include "hash.hpp"
+#include "scheduler.hpp"
+using namespace RepFile;
+
+using Clock = std::chrono::steady_clock;
+
+// results of measured loops are stored here, thus they aren't optimized out
+static volatile float sink;
+
+struct Run
+{
+  size_t countOfThreads;
+  size_t countOfBatches;
+  double seconds;
+  uint64_t countOfFirings;
+  uint64_t firingsHash;
+};
+
+static void printUsage()
+{
+  std::cerr << "USAGE: schedbench [options]" << std::endl
+            << "  --instances N     count of concurrent instances" << std::endl
+            << "  --cutscenes N     count of distinct shared cutscenes" << std::endl
+            << "  --actors N        count of actors of each cutscene" << std::endl
+            << "  --duration MS     length of each cutscene" << std::endl
+            << "  --ticks N         count of played ticks" << std::endl
+            << "  --frame MS        time between two ticks" << std::endl
+            << "  --threads N       the largest count of threads (all cores)"
+            << std::endl
+            << "  --batch KIB       memory of instances evaluated by one task"
+            << std::endl;
+}
+
+static Run play(const std::vector<std::shared_ptr<const File>>& files,
+                size_t countOfInstances,
+                size_t countOfTicks,
+                uint32_t frameTime,
+                uint32_t duration,
+                size_t countOfThreads,
+                const SchedulerSettings& settings)
+{
+  ThreadPool pool(countOfThreads);
+  Scheduler scheduler(pool, settings);
+  for (const auto& file : files)
+    scheduler.addCutscene(file);
+  // instances are staggered over the length of cutscene, thus they don't
+  // fire together, and all of them are playing since the first tick
+  uint64_t span = std::max<uint32_t>(duration, 1);
+  for (size_t i = 0; i < countOfInstances; i++)
+    scheduler.addInstance(i % files.size(), uint64_t(i) * 7919 % span);
+
+  Run run = Run();
+  run.countOfThreads = countOfThreads;
+  auto start = Clock::now();
+  for (size_t tick = 0; tick < countOfTicks; tick++) {
+    const auto& firings = scheduler.tick(span + uint64_t(tick) * frameTime);
+    for (const Firing& firing : firings) {
+      uint64_t fields[4] = { firing.time, firing.instance, firing.event.type,
+                             firing.event.index };
+      run.firingsHash = Hash::hash64(fields, sizeof(fields), run.firingsHash);
+    }
+    run.countOfFirings += firings.size();
+    // touch the output as a consumer would
+    size_t instance = tick % scheduler.getCountOfInstances();
+    Span<const Pose> poses = scheduler.getPoses(instance);
+    sink = poses.size() > 0 ? poses[0].position[0] : 0.0f;
+  }
+  run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  run.countOfBatches = scheduler.getCountOfBatches();
+  return run;
+}
+
+int main(int argc, char** argv)
+{
+  size_t countOfInstances = 10000;
+  size_t countOfCutscenes = 4;
+  size_t countOfTicks = 250;
+  uint32_t frameTime = 40;
+  size_t countOfCores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  size_t maxThreads = countOfCores;
+  GeneratorSettings generatorSettings;
+  generatorSettings.countOfActors = 8;
+  SchedulerSettings settings;
+  for (int i = 1; i < argc; i++) {
+    std::string option = argv[i];
+    if (i + 1 >= argc) {
+      printUsage();
+      return 1;
+    }
+    unsigned long number = std::strtoul(argv[++i], nullptr, 10);
+    if (option == "--instances")
+      countOfInstances = number;
+    else if (option == "--cutscenes")
+      countOfCutscenes = std::max<size_t>(number, 1);
+    else if (option == "--actors")
+      generatorSettings.countOfActors = number;
+    else if (option == "--duration")
+      generatorSettings.duration = uint32_t(number);
+    else if (option == "--ticks")
+      countOfTicks = number;
+    else if (option == "--frame")
+      frameTime = std::max<uint32_t>(1, uint32_t(number));
+    else if (option == "--threads")
+      maxThreads = std::max<size_t>(number, 1);
+    else if (option == "--batch")
+      settings.batchBytes = std::max<size_t>(number, 1) * 1024;
+    else {
+      printUsage();
+      return 1;
+    }
+  }
+
+  std::vector<std::shared_ptr<const File>> files;
+  for (size_t i = 0; i < countOfCutscenes; i++) {
+    GeneratorSettings cutsceneSettings = generatorSettings;
+    cutsceneSettings.seed = uint32_t(i + 1);
+    files.push_back(
+      std::make_shared<const File>(Generator(cutsceneSettings).generate()));
+  }
+
+  // 1, 2, 4, ... threads and the largest count
+  std::vector<size_t> counts;
+  for (size_t count = 1; count < maxThreads; count *= 2)
+    counts.push_back(count);
+  counts.push_back(maxThreads);
+
+  std::vector<Run> runs;
+  for (size_t count : counts)
+    runs.push_back(play(files, countOfInstances, countOfTicks, frameTime,
+                        generatorSettings.duration, count, settings));
+
+  bool isDeterministic = true;
+  for (const auto& run : runs)
+    isDeterministic &= run.firingsHash == runs.front().firingsHash &&
+                       run.countOfFirings == runs.front().countOfFirings;
+
+  std::cout << "{\n  \"benchmark\": \"schedbench\",\n  \"version\": 1,\n"
+            << "  \"instances\": " << countOfInstances
+            << ",\n  \"cutscenes\": " << countOfCutscenes
+            << ",\n  \"actors\": " << generatorSettings.countOfActors
+            << ",\n  \"ticks\": " << countOfTicks
+            << ",\n  \"batchBytes\": " << settings.batchBytes
+            << ",\n  \"cores\": " << countOfCores
+            << ",\n  \"runs\": [";
+  for (size_t i = 0; i < runs.size(); i++) {
+    const Run& run = runs[i];
+    double tickMs = run.seconds * 1e3 / std::max<size_t>(countOfTicks, 1);
+    std::cout << (i > 0 ? "," : "") << "\n    { \"threads\": "
+              << run.countOfThreads << ", \"batches\": " << run.countOfBatches
+              << ", \"tickMs\": " << tickMs
+              << ", \"instancesPerSecond\": "
+              << countOfInstances * countOfTicks / std::max(run.seconds, 1e-9)
+              << ", \"speedup\": "
+              << runs.front().seconds / std::max(run.seconds, 1e-9)
+              << ", \"firings\": " << run.countOfFirings
+              // more threads than cores can't scale, the speedup is noise then
+              << ", \"oversubscribed\": "
+              << (run.countOfThreads > countOfCores ? "true" : "false") << " }";
+  }
+  std::cout << "\n  ],\n  \"deterministic\": "
+            << (isDeterministic ? "true" : "false") << "\n}" << std::endl;
+  if (!isDeterministic) {
+    std::cerr << "[Err] Fired events depend on the count of threads"
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
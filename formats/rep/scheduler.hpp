@@ -0,0 +1,257 @@
+#pragma once
+/*
+ * .rep multi-instance scheduler
+ * Author: Roman Romop5 Dobias
+ * Purpose: play many cutscene instances at once on all cores
+ */
+
+#include <memory>
+
+#include "camera.hpp"
+#include "sampler.hpp"
+#include "threadpool.hpp"
+#include "timeline.hpp"
+
+namespace RepFile {
+
+/* \brief Immutable data of a cutscene, shared by all its instances
+ *
+ * Sampler, Timeline and CameraTrack are built once, instances only keep
+ * their cursors.
+ */
+class Cutscene
+{
+private:
+  std::shared_ptr<const File> file;
+  Sampler sampler;
+  Timeline timeline;
+  CameraTrack camera;
+  uint32_t duration;
+
+public:
+  explicit Cutscene(std::shared_ptr<const File> sharedFile)
+    : file(std::move(sharedFile))
+    , sampler(*file)
+    , timeline(*file)
+    , camera(*file)
+  {
+    duration = camera.getEndTime();
+    for (const auto& track : file->transformTracks) {
+      if (track.size() > 0)
+        duration = std::max(duration, track.timestamps.back());
+    }
+    if (timeline.size() > 0)
+      duration = std::max(duration, timeline.getEvents().back().timestamp);
+  }
+
+  const File& getFile() const { return *file; }
+  const Sampler& getSampler() const { return sampler; }
+  const Timeline& getTimeline() const { return timeline; }
+  const CameraTrack& getCamera() const { return camera; }
+  /// Time of the last key / event
+  uint32_t getDuration() const { return duration; }
+  size_t getCountOfObjects() const { return sampler.getCountOfObjects(); }
+};
+
+/* \brief Event fired by an instance during Scheduler::tick()
+ *
+ * time is the global time of the event (start of instance + timestamp).
+ */
+struct Firing
+{
+  uint64_t time;
+  uint32_t instance;
+  Event event;
+};
+
+struct SchedulerSettings
+{
+  /// Output and cursors of a batch should fit into this (L2 cache)
+  size_t batchBytes = 256 * 1024;
+};
+
+/* \brief Plays instances of shared cutscenes, each from its own start time
+ *
+ * tick(t) evaluates poses, camera and due events of all instances at global
+ * time t. Instances are split into batches of contiguous instances, whose
+ * poses, cursors and camera take at most SchedulerSettings::batchBytes (and
+ * into at least 4 batches per thread), and batches are run by
+ * ThreadPool::parallelFor(). Each batch only writes its own instances and its
+ * own list of firings, thus nothing is locked.
+ *
+ * Firings are returned in deterministic order, which doesn't depend on the
+ * count of threads: by global time, then by instance and then in Timeline
+ * order. An instance before its start isn't evaluated and fires nothing,
+ * after its end the last pose is held. Going back in time is allowed, events
+ * are fired again then.
+ *
+ * Cutscenes are kept by Scheduler, thus they stay valid for its lifetime.
+ */
+class Scheduler
+{
+private:
+  struct Instance
+  {
+    const Cutscene* cutscene;
+    uint64_t startTime;
+    Sampler::Cursor poseCursor;
+    CameraTrack::Cursor cameraCursor;
+    Timeline::Cursor eventCursor;
+    uint32_t lastTime;
+    size_t firstPose; // into poses
+    bool isStarted;
+  };
+
+  struct Batch
+  {
+    size_t firstInstance;
+    size_t countOfInstances;
+    std::vector<Firing> firings;
+  };
+
+  ThreadPool& pool;
+  SchedulerSettings settings;
+  std::vector<std::unique_ptr<Cutscene>> cutscenes;
+  std::vector<Instance> instances;
+  std::vector<Pose> poses;
+  std::vector<CameraState> cameras;
+  std::vector<Batch> batches;
+  std::vector<Firing> firings;
+  bool areBatchesValid = false;
+
+  static size_t getInstanceBytes(const Instance& instance)
+  {
+    size_t countOfObjects = instance.cutscene->getCountOfObjects();
+    // Pose + key index and last time of Sampler::Cursor
+    return sizeof(Instance) + sizeof(CameraState) +
+           countOfObjects * (sizeof(Pose) + sizeof(size_t) + sizeof(uint32_t));
+  }
+
+  void buildBatches()
+  {
+    batches.clear();
+    // a few batches per thread, thus idle threads can steal the rest
+    size_t countOfTasks = std::max<size_t>(pool.size(), 1) * 4;
+    size_t maxInstances = (instances.size() + countOfTasks - 1) / countOfTasks;
+    size_t bytes = 0;
+    for (size_t i = 0; i < instances.size(); i++) {
+      size_t instanceBytes = getInstanceBytes(instances[i]);
+      if (batches.empty() || bytes + instanceBytes > settings.batchBytes ||
+          batches.back().countOfInstances >= maxInstances) {
+        batches.push_back(Batch{ i, 0, std::vector<Firing>() });
+        bytes = 0;
+      }
+      batches.back().countOfInstances++;
+      bytes += instanceBytes;
+    }
+    areBatchesValid = true;
+  }
+
+  void evaluate(Batch& batch, uint64_t timeMs)
+  {
+    batch.firings.clear();
+    size_t end = batch.firstInstance + batch.countOfInstances;
+    for (size_t i = batch.firstInstance; i < end; i++) {
+      Instance& instance = instances[i];
+      if (timeMs < instance.startTime) {
+        instance.isStarted = false;
+        continue;
+      }
+      uint64_t elapsed = timeMs - instance.startTime;
+      uint32_t localTime = uint32_t(std::min<uint64_t>(elapsed, UINT32_MAX));
+      if (!instance.isStarted || localTime < instance.lastTime) {
+        instance.eventCursor.seek(0);
+        instance.isStarted = true;
+      }
+      instance.lastTime = localTime;
+
+      const Cutscene& cutscene = *instance.cutscene;
+      Pose* instancePoses = poses.data() + instance.firstPose;
+      for (size_t object = 0; object < cutscene.getCountOfObjects(); object++)
+        instancePoses[object] = instance.poseCursor.poseAt(object, localTime);
+      if (cutscene.getCamera().isValid())
+        cameras[i] = instance.cameraCursor.cameraAt(localTime);
+      for (const Event& event : instance.eventCursor.advance(localTime))
+        batch.firings.push_back(
+          Firing{ instance.startTime + event.timestamp, uint32_t(i), event });
+    }
+  }
+
+public:
+  explicit Scheduler(ThreadPool& threadPool,
+                     const SchedulerSettings& schedulerSettings =
+                       SchedulerSettings())
+    : pool(threadPool)
+    , settings(schedulerSettings)
+  {}
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  /// Returns index of cutscene, the file is shared (not copied)
+  size_t addCutscene(std::shared_ptr<const File> file)
+  {
+    cutscenes.emplace_back(new Cutscene(std::move(file)));
+    return cutscenes.size() - 1;
+  }
+
+  /// Returns index of instance, which starts playing at global startTimeMs
+  size_t addInstance(size_t cutsceneIndex, uint64_t startTimeMs)
+  {
+    const Cutscene* cutscene = cutscenes[cutsceneIndex].get();
+    CameraState camera = CameraState();
+    instances.push_back(Instance{ cutscene, startTimeMs,
+                                  Sampler::Cursor(cutscene->getSampler()),
+                                  cutscene->getCamera().createCursor(),
+                                  cutscene->getTimeline().createCursor(), 0,
+                                  poses.size(), false });
+    poses.resize(poses.size() + cutscene->getCountOfObjects());
+    cameras.push_back(camera);
+    areBatchesValid = false;
+    return instances.size() - 1;
+  }
+
+  /// Evaluates all instances at global time, returns events fired since the
+  /// previous tick
+  const std::vector<Firing>& tick(uint64_t timeMs)
+  {
+    if (!areBatchesValid)
+      buildBatches();
+    pool.parallelFor(batches.size(),
+                     [this, timeMs](size_t i) { evaluate(batches[i], timeMs); });
+    firings.clear();
+    for (const auto& batch : batches)
+      firings.insert(firings.end(), batch.firings.begin(), batch.firings.end());
+    // batches are in instance order, thus the stable sort keeps the rest
+    std::stable_sort(firings.begin(), firings.end(),
+                     [](const Firing& a, const Firing& b) {
+                       return a.time < b.time;
+                     });
+    return firings;
+  }
+
+  size_t getCountOfCutscenes() const { return cutscenes.size(); }
+  const Cutscene& getCutscene(size_t index) const { return *cutscenes[index]; }
+  size_t getCountOfInstances() const { return instances.size(); }
+  size_t getCountOfBatches() const { return areBatchesValid ? batches.size() : 0; }
+
+  /// Poses of all objects of instance from the last tick
+  Span<const Pose> getPoses(size_t instance) const
+  {
+    const Instance& state = instances[instance];
+    return Span<const Pose>(poses.data() + state.firstPose,
+                            state.cutscene->getCountOfObjects());
+  }
+  const CameraState& getCamera(size_t instance) const
+  {
+    return cameras[instance];
+  }
+  bool isStarted(size_t instance) const { return instances[instance].isStarted; }
+  bool isFinished(size_t instance) const
+  {
+    const Instance& state = instances[instance];
+    return state.isStarted && state.lastTime >= state.cutscene->getDuration();
+  }
+};
+
+} // namespace RepFile
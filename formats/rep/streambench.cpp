@@ -0,0 +1,184 @@
+/*
+ * .rep streaming playback benchmark
+ * Author: Roman Romop5 Dobias
+ * Purpose: plays a (multi-hour) cutscene with StreamingPlayer and checks that
+ * the resident memory of process stays within the given limit
+ */
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "generator.hpp"
+#include "json.hpp"
+#include "streaming.hpp"
+using namespace RepFile;
+
+using Clock = std::chrono::steady_clock;
+
+// results of measured loops are stored here, thus they aren't optimized out
+static volatile float sink;
+
+/// Peak resident set size of process in bytes (0 if unknown)
+static uint64_t getPeakRss()
+{
+#if !defined(_WIN32)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+  return 0;
+}
+
+/* \brief Writes synthetic cutscene
+ *
+ * The whole File is built in memory, thus it's done by a child process and
+ * the peak RSS of benchmark isn't affected by it.
+ */
+static bool generateFile(const GeneratorSettings& settings,
+                         const std::string& fileName)
+{
+#if !defined(_WIN32)
+  pid_t child = fork();
+  if (child < 0)
+    return false;
+  if (child == 0) {
+    Loader loader;
+    _exit(loader.storeFile(Generator(settings).generate(), fileName) ? 0 : 1);
+  }
+  int status = 0;
+  if (waitpid(child, &status, 0) != child)
+    return false;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#else
+  Loader loader;
+  return loader.storeFile(Generator(settings).generate(), fileName);
+#endif
+}
+
+static void printUsage()
+{
+  std::cerr << "USAGE: streambench [options]" << std::endl
+            << "  --input FILE      play given .rep instead of a synthetic one"
+            << std::endl
+            << "  --actors N        count of actors of the synthetic file" << std::endl
+            << "  --duration MS     length of the synthetic file (3 hours)" << std::endl
+            << "  --window MS       keys around playhead kept decoded" << std::endl
+            << "  --budget KIB      memory budget of player" << std::endl
+            << "  --rss-limit KIB   fail if peak RSS of process exceeds it" << std::endl
+            << "  --frame MS        time between two played frames" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  GeneratorSettings settings;
+  settings.countOfActors = 8;
+  settings.duration = 3 * 60 * 60 * 1000;
+  StreamingSettings streaming;
+  uint64_t rssLimit = 64 * 1024 * 1024;
+  uint32_t frameTime = 40;
+  std::string input;
+  for (int i = 1; i < argc; i++) {
+    std::string option = argv[i];
+    if (i + 1 >= argc) {
+      printUsage();
+      return 1;
+    }
+    std::string value = argv[++i];
+    unsigned long number = std::strtoul(value.c_str(), nullptr, 10);
+    if (option == "--input")
+      input = value;
+    else if (option == "--actors")
+      settings.countOfActors = number;
+    else if (option == "--duration")
+      settings.duration = uint32_t(number);
+    else if (option == "--window")
+      streaming.windowMs = uint32_t(number);
+    else if (option == "--budget")
+      streaming.memoryBudget = size_t(number) * 1024;
+    else if (option == "--rss-limit")
+      rssLimit = uint64_t(number) * 1024;
+    else if (option == "--frame")
+      frameTime = std::max<uint32_t>(1, uint32_t(number));
+    else {
+      printUsage();
+      return 1;
+    }
+  }
+
+  std::string fileName = input;
+  if (input.empty()) {
+    fileName =
+      (std::filesystem::temp_directory_path() / "streambench.rep").string();
+    if (!generateFile(settings, fileName)) {
+      std::cerr << "[Err] Failed to generate " << fileName << std::endl;
+      return 1;
+    }
+  }
+
+  auto start = Clock::now();
+  StreamingPlayer player;
+  if (!player.open(fileName, streaming))
+    return 1;
+  double openSeconds =
+    std::chrono::duration<double>(Clock::now() - start).count();
+
+  start = Clock::now();
+  uint64_t countOfFrames = 0;
+  bool isPlayed = true;
+  for (uint64_t time = 0; time <= player.getDuration(); time += frameTime) {
+    if (!player.setPlayhead(uint32_t(time))) {
+      isPlayed = false;
+      break;
+    }
+    float sum = 0.0f;
+    for (size_t i = 0; i < player.getCountOfObjects(); i++)
+      sum += player.poseAt(i, uint32_t(time)).position[0];
+    sink = sum;
+    countOfFrames++;
+  }
+  double playSeconds =
+    std::chrono::duration<double>(Clock::now() - start).count();
+
+  StreamingStats stats = player.getStats();
+  uint64_t peakRss = getPeakRss();
+  bool isWithinLimit = peakRss <= rssLimit &&
+                       stats.peakResidentBytes <= streaming.memoryBudget;
+  std::cout << "{\n  \"benchmark\": \"streambench\",\n  \"version\": 1,\n"
+            << "  \"input\": \"" << Json::escape(input.empty() ? "synthetic" : input)
+            << "\",\n"
+            << "  \"fileSize\": " << std::filesystem::file_size(fileName)
+            << ",\n  \"durationMs\": " << player.getDuration()
+            << ",\n  \"windowMs\": " << stats.windowMs
+            << ",\n  \"budget\": " << streaming.memoryBudget
+            << ",\n  \"indexBytes\": " << stats.indexBytes
+            << ",\n  \"peakResidentBytes\": " << stats.peakResidentBytes
+            << ",\n  \"peakRss\": " << peakRss
+            << ",\n  \"rssLimit\": " << rssLimit
+            << ",\n  \"openMs\": " << openSeconds * 1e3
+            << ",\n  \"playMs\": " << playSeconds * 1e3
+            << ",\n  \"frames\": " << countOfFrames
+            << ",\n  \"loads\": " << stats.countOfLoads
+            << ",\n  \"prefetches\": " << stats.countOfPrefetches
+            << ",\n  \"drops\": " << stats.countOfDrops
+            << ",\n  \"passed\": " << (isPlayed && isWithinLimit ? "true" : "false")
+            << "\n}" << std::endl;
+
+  if (input.empty())
+    std::filesystem::remove(fileName);
+  if (!isPlayed) {
+    std::cerr << "[Err] Playback failed" << std::endl;
+    return 1;
+  }
+  if (!isWithinLimit) {
+    std::cerr << "[Err] Peak RSS " << peakRss << " B exceeds limit "
+              << rssLimit << " B" << std::endl;
+    return 1;
+  }
+  return 0;
+}
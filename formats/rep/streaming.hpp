@@ -0,0 +1,638 @@
+#pragma once
+/*
+ * .rep streaming playback
+ * Author: Roman Romop5 Dobias
+ * Purpose: play cutscenes of any length with a bounded amount of memory
+ */
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "bstream.hpp"
+#include "sampler.hpp"
+
+namespace RepFile {
+
+struct StreamingSettings
+{
+  /// Keys in [t - windowMs, t + windowMs] around the playhead stay decoded
+  uint32_t windowMs = 10000;
+  /// Upper bound of memory of seek index, decoded windows and read buffers
+  size_t memoryBudget = 16 * 1024 * 1024;
+  /// Density of seek index (keys between two entries)
+  size_t keysPerIndexEntry = 256;
+};
+
+/// Shortest window, which open() falls back to if the budget is small
+const uint32_t minimumWindowMs = 100;
+
+struct StreamingStats
+{
+  uint32_t windowMs;     // after fitting into the budget
+  size_t indexBytes;
+  size_t residentBytes;  // index, buffers and windows resident now
+  size_t peakResidentBytes;
+  size_t countOfLoads;   // windows decoded on the playback thread (stalls)
+  size_t countOfPrefetches; // windows decoded in background
+  size_t countOfDrops;
+};
+
+/* \brief Plays transformation tracks of .rep without loading them
+ *
+ * The time is cut into windows of windowMs. When the playhead is in window
+ * s, windows s - 1, s and s + 1 are resident, s + 1 is decoded by a
+ * background thread ahead of time and windows, which were already played,
+ * are dropped. Each window holds, for every object, keys inside of it plus
+ * the last key before it and the first key after it, thus it samples the
+ * same poses as Sampler over the whole File.
+ *
+ * Windows are decoded from the object streams (positionOfTheBeginning /
+ * sizeOfStreamSection), which are read with pread in small blocks. A sparse
+ * seek index, built by a single pass at open(), stores every
+ * keysPerIndexEntry-th key with its offset and with the position / rotation
+ * its chunk inherits, thus decoding starts right before the window.
+ *
+ * The budget is enforced: open() computes (from the seek index) an upper
+ * bound of the size of every window and shortens the window until three of
+ * them fit next to the index and the read buffers. If even minimumWindowMs
+ * doesn't fit, open() fails. Object streams must have sorted timestamps.
+ *
+ * All methods but the constructor must be called from a single thread.
+ */
+class StreamingPlayer
+{
+private:
+  static constexpr size_t readBufferSize = 64 * 1024;
+  static constexpr size_t bytesPerKey = sizeof(uint32_t) + sizeof(Position) +
+                                        sizeof(Rotation) +
+                                        2 * sizeof(uint32_t);
+  static constexpr uint32_t noWindow = 0xFFFFFFFF;
+
+  /// State before indexed key, decoding may start at its chunk
+  struct SeekEntry
+  {
+    uint32_t timestamp;
+    uint32_t offset; // within object stream
+    Position position; // inherited by chunks without position
+    Rotation rotation;
+  };
+
+  struct ObjectIndex
+  {
+    std::vector<SeekEntry> entries;
+    size_t countOfKeys = 0;
+  };
+
+  struct WindowTrack
+  {
+    std::vector<uint32_t> timestamps;
+    std::vector<Position> positions;
+    std::vector<Rotation> rotations;
+    std::vector<uint32_t> auxiliary;
+    std::vector<uint32_t> animationStartOffsets;
+
+    void reserve(size_t count)
+    {
+      timestamps.reserve(count);
+      positions.reserve(count);
+      rotations.reserve(count);
+      auxiliary.reserve(count);
+      animationStartOffsets.reserve(count);
+    }
+
+    TrackView getView() const
+    {
+      TrackView view;
+      size_t count = timestamps.size();
+      view.timestamps = Span<const uint32_t>(timestamps.data(), count);
+      view.positions = Span<const Position>(positions.data(), count);
+      view.rotations = Span<const Rotation>(rotations.data(), count);
+      view.auxiliary = Span<const uint32_t>(auxiliary.data(), count);
+      view.animationStartOffsets =
+        Span<const uint32_t>(animationStartOffsets.data(), count);
+      return view;
+    }
+  };
+
+  struct Window
+  {
+    uint32_t number;
+    size_t bytes; // reserved for window, its tracks never exceed it
+    std::vector<WindowTrack> tracks;
+    Sampler sampler;
+  };
+
+  FileReader file;
+  std::vector<AnimatedObjectDefinitions> animatedObjects;
+  AnimationTable animations;
+  size_t transformationOffset;
+  std::vector<ObjectIndex> indexes;
+  uint32_t windowMs;
+  uint32_t countOfWindows;
+  uint32_t duration;
+  size_t keysPerIndexEntry;
+  size_t memoryBudget;
+  std::vector<unsigned char> readBuffer;
+  uint32_t currentWindow;
+  Window* playheadWindow; // window of currentWindow
+  StreamingStats stats;
+
+  // shared with the prefetching thread
+  std::mutex lock;
+  std::condition_variable wakeUp;
+  std::vector<std::unique_ptr<Window>> windows;
+  uint32_t requestedWindow;
+  bool isPrefetching;
+  bool shouldStop;
+  std::thread worker;
+
+  static bool fail(const std::string& message)
+  {
+    std::cerr << "[Err] " << message << std::endl;
+    return false;
+  }
+
+  /* \brief Decodes keys of object stream starting at offset
+   *
+   * function gets (offset of chunk, header, payload, payloadLength) and
+   * returns false to stop. Returns false for invalid streams.
+   */
+  template<typename Function>
+  bool decodeObjectStream(size_t objectIndex,
+                          size_t offset,
+                          std::vector<unsigned char>& buffer,
+                          Function function) const
+  {
+    const auto& object = animatedObjects[objectIndex];
+    size_t streamBase = transformationOffset + object.positionOfTheBeginning;
+    size_t streamSize = object.sizeOfStreamSection;
+    size_t begin = 0, end = 0; // decoded part of buffer
+    size_t bufferOffset = offset; // offset of buffer[begin] in stream
+    while (bufferOffset < streamSize) {
+      size_t bufferedEnd = bufferOffset + (end - begin);
+      if (end - begin < readBufferSize / 2 && bufferedEnd < streamSize) {
+        memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+        size_t count = std::min(buffer.size() - end, streamSize - bufferedEnd);
+        if (!file.read(streamBase + bufferOffset + end, buffer.data() + end,
+                       count))
+          return false;
+        end += count;
+      }
+      TransformationHeader header;
+      if (end - begin < sizeof(header))
+        return false;
+      memcpy(&header, buffer.data() + begin, sizeof(header));
+      if (header.type >= 4 ||
+          object.sizeOfBlocks[header.type] < sizeof(header) ||
+          object.sizeOfBlocks[header.type] > end - begin)
+        return false;
+      size_t chunkSize = object.sizeOfBlocks[header.type];
+      if (!function(bufferOffset, header, buffer.data() + begin + sizeof(header),
+                    chunkSize - sizeof(header)))
+        return true;
+      begin += chunkSize;
+      bufferOffset += chunkSize;
+    }
+    return true;
+  }
+
+  /// Applies chunk to the inherited state as TransformTrack::push() does
+  static TransformPayload decodePayload(const Position& position,
+                                        const Rotation& rotation,
+                                        const unsigned char* payload,
+                                        size_t payloadLength)
+  {
+    TransformPayload body;
+    memcpy(body.position, position.data(), sizeof(body.position));
+    memcpy(body.rotation, rotation.data(), sizeof(body.rotation));
+    body.auxiliary = 0;
+    body.animationStartOffset = 0;
+    memcpy(&body, payload, std::min(payloadLength, sizeof(TransformPayload)));
+    return body;
+  }
+
+  bool buildIndex(size_t objectIndex)
+  {
+    ObjectIndex& index = indexes[objectIndex];
+    Position position{ 0.0f, 0.0f, 0.0f };
+    Rotation rotation{ 0.0f, 0.0f, 0.0f, 0.0f };
+    uint32_t lastTimestamp = 0;
+    bool isSorted = true;
+    bool isValid = decodeObjectStream(
+      objectIndex, sizeof(TransformationHeader), readBuffer,
+      [&](size_t offset, const TransformationHeader& header,
+          const unsigned char* payload, size_t payloadLength) {
+        if (index.countOfKeys % keysPerIndexEntry == 0)
+          index.entries.push_back(SeekEntry{ header.timestamp,
+                                             uint32_t(offset), position,
+                                             rotation });
+        if (header.timestamp < lastTimestamp)
+          isSorted = false;
+        lastTimestamp = header.timestamp;
+        auto body = decodePayload(position, rotation, payload, payloadLength);
+        memcpy(position.data(), body.position, sizeof(body.position));
+        memcpy(rotation.data(), body.rotation, sizeof(body.rotation));
+        index.countOfKeys++;
+        return isSorted;
+      });
+    if (!isValid)
+      return fail("Invalid chunk in transformation stream of object " +
+                  std::to_string(objectIndex));
+    if (!isSorted)
+      return fail("Timestamps of object " + std::to_string(objectIndex) +
+                  " aren't sorted");
+    return true;
+  }
+
+  /// Index of the entry, which decoding of keys since timeMs starts at
+  static size_t findEntry(const ObjectIndex& index, uint64_t timeMs)
+  {
+    // the last entry before timeMs, thus the key before timeMs is decoded
+    auto upper = std::lower_bound(
+      index.entries.begin(), index.entries.end(), timeMs,
+      [](const SeekEntry& entry, uint64_t time) {
+        return entry.timestamp < time;
+      });
+    return upper == index.entries.begin() ? 0
+                                          : upper - index.entries.begin() - 1;
+  }
+
+  /// Upper bound of count of keys, which window keeps for object
+  size_t getCountOfKeys(size_t objectIndex,
+                        uint64_t startMs,
+                        uint64_t endMs) const
+  {
+    const ObjectIndex& index = indexes[objectIndex];
+    if (index.entries.empty())
+      return 0;
+    size_t first = findEntry(index, startMs);
+    auto last = std::lower_bound(
+      index.entries.begin() + first, index.entries.end(), endMs,
+      [](const SeekEntry& entry, uint64_t time) {
+        return entry.timestamp < time;
+      });
+    // keys up to (and including) the first key of entry at / after endMs
+    size_t lastKey = last == index.entries.end()
+                       ? index.countOfKeys
+                       : (last - index.entries.begin()) * keysPerIndexEntry + 1;
+    return std::min(lastKey, index.countOfKeys) - first * keysPerIndexEntry;
+  }
+
+  size_t getWindowBytes(uint32_t number, uint32_t length) const
+  {
+    uint64_t startMs = uint64_t(number) * length;
+    size_t bytes = sizeof(Window) + indexes.size() * (sizeof(WindowTrack) +
+                                                      sizeof(TrackView));
+    for (size_t i = 0; i < indexes.size(); i++)
+      bytes += getCountOfKeys(i, startMs, startMs + length) * bytesPerKey;
+    return bytes;
+  }
+
+  size_t getFixedBytes() const
+  {
+    // read buffers of both threads
+    return stats.indexBytes + 2 * readBufferSize;
+  }
+
+  bool fitWindow(uint32_t requestedMs)
+  {
+    windowMs = std::max(requestedMs, minimumWindowMs);
+    while (true) {
+      countOfWindows = duration / windowMs + 1;
+      size_t largestWindow = 0;
+      for (uint32_t i = 0; i < countOfWindows; i++)
+        largestWindow = std::max(largestWindow, getWindowBytes(i, windowMs));
+      if (getFixedBytes() + 3 * largestWindow <= memoryBudget)
+        return true;
+      if (windowMs == minimumWindowMs)
+        return fail("Memory budget of " + std::to_string(memoryBudget) +
+                    " B can't hold windows of " +
+                    std::to_string(minimumWindowMs) + " ms");
+      windowMs = std::max(windowMs / 2, minimumWindowMs);
+    }
+  }
+
+  bool loadWindow(Window& window, std::vector<unsigned char>& buffer) const
+  {
+    uint64_t startMs = uint64_t(window.number) * windowMs;
+    uint64_t endMs = startMs + windowMs;
+    window.tracks.resize(indexes.size());
+    std::vector<TrackView> views(indexes.size());
+    for (size_t i = 0; i < indexes.size(); i++) {
+      const ObjectIndex& index = indexes[i];
+      if (index.entries.empty())
+        continue;
+      WindowTrack& track = window.tracks[i];
+      track.reserve(getCountOfKeys(i, startMs, endMs));
+      const SeekEntry& entry = index.entries[findEntry(index, startMs)];
+      Position position = entry.position;
+      Rotation rotation = entry.rotation;
+      bool isValid = decodeObjectStream(
+        i, entry.offset, buffer,
+        [&](size_t, const TransformationHeader& header,
+            const unsigned char* payload, size_t payloadLength) {
+          auto body = decodePayload(position, rotation, payload, payloadLength);
+          memcpy(position.data(), body.position, sizeof(body.position));
+          memcpy(rotation.data(), body.rotation, sizeof(body.rotation));
+          // only the last key before the window is kept
+          if (!track.timestamps.empty() && header.timestamp < startMs &&
+              track.timestamps.back() < startMs) {
+            track.timestamps.pop_back();
+            track.positions.pop_back();
+            track.rotations.pop_back();
+            track.auxiliary.pop_back();
+            track.animationStartOffsets.pop_back();
+          }
+          track.timestamps.push_back(header.timestamp);
+          track.positions.push_back(position);
+          track.rotations.push_back(rotation);
+          track.auxiliary.push_back(body.auxiliary);
+          track.animationStartOffsets.push_back(body.animationStartOffset);
+          return header.timestamp < endMs;
+        });
+      if (!isValid)
+        return false;
+      views[i] = track.getView();
+    }
+    window.sampler = Sampler(std::move(views), animations);
+    return true;
+  }
+
+  Window* findWindow(uint32_t number)
+  {
+    for (auto& window : windows) {
+      if (window->number == number)
+        return window.get();
+    }
+    return nullptr;
+  }
+
+  void addResident(size_t bytes)
+  {
+    stats.residentBytes += bytes;
+    stats.peakResidentBytes =
+      std::max(stats.peakResidentBytes, stats.residentBytes);
+  }
+
+  void prefetchLoop()
+  {
+    std::vector<unsigned char> buffer(readBufferSize);
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+      wakeUp.wait(guard,
+                  [this]() { return shouldStop || requestedWindow != noWindow; });
+      if (shouldStop)
+        return;
+      std::unique_ptr<Window> window(new Window());
+      window->number = requestedWindow;
+      requestedWindow = noWindow;
+      window->bytes = getWindowBytes(window->number, windowMs);
+      if (findWindow(window->number) ||
+          stats.residentBytes + window->bytes > memoryBudget)
+        continue;
+      addResident(window->bytes);
+      isPrefetching = true;
+      guard.unlock();
+      bool isLoaded = loadWindow(*window, buffer);
+      guard.lock();
+      isPrefetching = false;
+      if (isLoaded) {
+        stats.countOfPrefetches++;
+        windows.push_back(std::move(window));
+      } else {
+        stats.residentBytes -= window->bytes;
+      }
+      wakeUp.notify_all();
+    }
+  }
+
+  void stopWorker()
+  {
+    if (!worker.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      shouldStop = true;
+    }
+    wakeUp.notify_all();
+    worker.join();
+  }
+
+  /// Drops windows outside of [number - 1, number + 1]
+  void dropWindows(uint32_t number)
+  {
+    for (size_t i = 0; i < windows.size();) {
+      uint32_t other = windows[i]->number;
+      if (other + 1 >= number && other <= number + 1) {
+        i++;
+        continue;
+      }
+      stats.residentBytes -= windows[i]->bytes;
+      stats.countOfDrops++;
+      windows.erase(windows.begin() + i);
+    }
+  }
+
+  /// Returns resident window, decodes it if needed (nullptr on failure)
+  Window* acquireWindow(uint32_t number, std::unique_lock<std::mutex>& guard)
+  {
+    // the window may be being prefetched right now
+    wakeUp.wait(guard, [this]() { return !isPrefetching; });
+    if (Window* window = findWindow(number))
+      return window;
+    std::unique_ptr<Window> window(new Window());
+    window->number = number;
+    window->bytes = getWindowBytes(number, windowMs);
+    if (stats.residentBytes + window->bytes > memoryBudget)
+      return nullptr;
+    addResident(window->bytes);
+    if (!loadWindow(*window, readBuffer)) {
+      stats.residentBytes -= window->bytes;
+      return nullptr;
+    }
+    stats.countOfLoads++;
+    windows.push_back(std::move(window));
+    return windows.back().get();
+  }
+
+public:
+  StreamingPlayer() { close(); }
+  ~StreamingPlayer() { stopWorker(); }
+
+  StreamingPlayer(const StreamingPlayer&) = delete;
+  StreamingPlayer& operator=(const StreamingPlayer&) = delete;
+
+  void close()
+  {
+    stopWorker();
+    file.close();
+    animatedObjects.clear();
+    animations = AnimationTable();
+    indexes.clear();
+    windows.clear();
+    readBuffer.clear();
+    readBuffer.shrink_to_fit();
+    windowMs = minimumWindowMs;
+    countOfWindows = 0;
+    duration = 0;
+    currentWindow = noWindow;
+    playheadWindow = nullptr;
+    requestedWindow = noWindow;
+    isPrefetching = false;
+    shouldStop = false;
+    stats = StreamingStats();
+  }
+
+  /// Reads headers and builds the seek index, returns false on failure
+  bool open(const std::string& fileName,
+            const StreamingSettings& settings = StreamingSettings())
+  {
+    close();
+    if (!file.open(fileName))
+      return fail("Failed to open file " + fileName);
+    Header header;
+    if (!file.read(0, header) || header.magicByte != magicByteConstant)
+      return fail("Invalid header of " + fileName);
+    size_t offset = sizeof(Header);
+    std::vector<AnimationBlock> animationBlocks(
+      std::min<size_t>(header.countOfAnimationBlocks,
+                       file.size() / sizeof(AnimationBlock)));
+    if (animationBlocks.size() != header.countOfAnimationBlocks ||
+        !file.read(offset, animationBlocks.data(),
+                   animationBlocks.size() * sizeof(AnimationBlock)))
+      return fail("Unexpected end of file " + fileName);
+    animations =
+      AnimationTable(animationBlocks.data(), animationBlocks.size());
+    offset += animationBlocks.size() * sizeof(AnimationBlock);
+    animatedObjects.resize(
+      std::min<size_t>(header.countOfObjectDefinitionBlocks,
+                       file.size() / sizeof(AnimatedObjectDefinitions)));
+    if (animatedObjects.size() != header.countOfObjectDefinitionBlocks ||
+        !file.read(offset, animatedObjects.data(),
+                   animatedObjects.size() * sizeof(AnimatedObjectDefinitions)))
+      return fail("Unexpected end of file " + fileName);
+    transformationOffset =
+      offset + animatedObjects.size() * sizeof(AnimatedObjectDefinitions);
+    for (size_t i = 0; i < animatedObjects.size(); i++) {
+      const auto& object = animatedObjects[i];
+      if (object.sizeOfStreamSection < sizeof(TransformationHeader) ||
+          uint64_t(transformationOffset) + object.positionOfTheBeginning +
+              object.sizeOfStreamSection > file.size())
+        return fail("Transformation stream of object " + std::to_string(i) +
+                    " exceeds file");
+      for (size_t type = 0; type < 4; type++) {
+        if (object.sizeOfBlocks[type] > readBufferSize / 2)
+          return fail("Chunks of object " + std::to_string(i) +
+                      " are too long");
+      }
+    }
+
+    keysPerIndexEntry = std::max<size_t>(settings.keysPerIndexEntry, 1);
+    memoryBudget = settings.memoryBudget;
+    readBuffer.resize(readBufferSize);
+    indexes.resize(animatedObjects.size());
+    for (size_t i = 0; i < indexes.size(); i++) {
+      if (!buildIndex(i))
+        return false;
+      stats.indexBytes += indexes[i].entries.capacity() * sizeof(SeekEntry);
+      if (!indexes[i].entries.empty()) {
+        // the last entry is close to the end, the rest is short to decode
+        size_t last = indexes[i].entries.size() - 1;
+        decodeObjectStream(
+          i, indexes[i].entries[last].offset, readBuffer,
+          [&](size_t, const TransformationHeader& chunk, const unsigned char*,
+              size_t) {
+            duration = std::max(duration, chunk.timestamp);
+            return true;
+          });
+      }
+    }
+    stats.indexBytes += indexes.size() * sizeof(ObjectIndex) +
+                        animatedObjects.size() *
+                          sizeof(AnimatedObjectDefinitions) +
+                        sizeof(AnimationTable);
+    if (!fitWindow(settings.windowMs))
+      return false;
+    stats.windowMs = windowMs;
+    addResident(getFixedBytes());
+    worker = std::thread([this]() { prefetchLoop(); });
+    return true;
+  }
+
+  size_t getCountOfObjects() const { return animatedObjects.size(); }
+  const std::vector<AnimatedObjectDefinitions>& getAnimatedObjects() const
+  {
+    return animatedObjects;
+  }
+  /// Timestamp of the last key of all objects
+  uint32_t getDuration() const { return duration; }
+  uint32_t getWindowMs() const { return windowMs; }
+
+  StreamingStats getStats()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+  }
+
+  /* \brief Moves playhead, drops played windows and prefetches the next one
+   *
+   * Blocks only if the window of timeMs isn't resident (after a seek or if
+   * the prefetch didn't make it). Returns false if it can't be decoded.
+   */
+  bool setPlayhead(uint32_t timeMs)
+  {
+    uint32_t number = timeMs / windowMs;
+    if (number == currentWindow)
+      return true;
+    std::unique_lock<std::mutex> guard(lock);
+    // a window, which is being prefetched, may be dropped, thus it's awaited
+    requestedWindow = noWindow;
+    wakeUp.wait(guard, [this]() { return !isPrefetching; });
+    dropWindows(number);
+    playheadWindow = acquireWindow(number, guard);
+    if (!playheadWindow) {
+      currentWindow = noWindow;
+      return false;
+    }
+    currentWindow = number;
+    if (number + 1 < countOfWindows && !findWindow(number + 1)) {
+      requestedWindow = number + 1;
+      wakeUp.notify_all();
+    }
+    return true;
+  }
+
+  /* \brief Pose of object at timeMs within window around the playhead
+   *
+   * The pose is the same as Sampler::poseAt() over the whole File. Times
+   * outside of [playhead - windowMs, playhead + windowMs] (or before
+   * setPlayhead()) give pose with isValid false.
+   */
+  Pose poseAt(size_t objectIndex, uint32_t timeMs)
+  {
+    uint32_t number = timeMs / windowMs;
+    // windows are dropped only by this thread, thus the playhead one is safe
+    if (number == currentWindow)
+      return playheadWindow->sampler.poseAt(objectIndex, timeMs);
+    Window* window = nullptr;
+    if (currentWindow != noWindow && number + 1 >= currentWindow &&
+        number <= currentWindow + 1) {
+      std::unique_lock<std::mutex> guard(lock);
+      window = acquireWindow(number, guard);
+    }
+    if (!window) {
+      Pose pose = Pose();
+      pose.rotation = Rotation{ 1.0f, 0.0f, 0.0f, 0.0f };
+      pose.animationBlock = invalidAnimationBlock;
+      pose.isValid = false;
+      return pose;
+    }
+    return window->sampler.poseAt(objectIndex, timeMs);
+  }
+};
+
+} // namespace RepFile
@@ -0,0 +1,234 @@
+#pragma once
+/*
+ * .rep name interning
+ * Author: Roman Romop5 Dobias
+ * Purpose: resolve actor, frame, animation, script and sound names by hash
+ * instead of strcmp scans over fixed-size arrays
+ */
+
+#include <deque>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+#include "arena.hpp"
+
+namespace RepFile {
+
+typedef uint32_t Symbol;
+const Symbol invalidSymbol = 0xFFFFFFFF;
+
+/* \brief Pool of unique names with stable integer ids
+ *
+ * Ids are assigned in order of interning and never change, thus they can be
+ * stored instead of names. A single table can be shared by indexes of many
+ * files, so the same name gets the same id in all of them.
+ *
+ * The table isn't synchronized, shared tables must be filled from one thread.
+ */
+class SymbolTable
+{
+private:
+  std::deque<std::string> names; // deque keeps views of map valid
+  std::unordered_map<std::string_view, Symbol> ids;
+
+public:
+  SymbolTable() {}
+  SymbolTable(const SymbolTable&) = delete;
+  SymbolTable& operator=(const SymbolTable&) = delete;
+
+  /// Returns id of name, adding it if it hasn't been interned yet
+  Symbol intern(std::string_view name)
+  {
+    auto it = ids.find(name);
+    if (it != ids.end())
+      return it->second;
+    Symbol symbol = Symbol(names.size());
+    names.emplace_back(name);
+    ids.emplace(std::string_view(names.back()), symbol);
+    return symbol;
+  }
+
+  /// Interns on-disk name, which is NULL-terminated unless it fills the array
+  template<size_t N>
+  Symbol intern(const char (&name)[N])
+  {
+    return intern(std::string_view(name, strnlen(name, N)));
+  }
+
+  /// Returns id of name or invalidSymbol when it hasn't been interned
+  Symbol find(std::string_view name) const
+  {
+    auto it = ids.find(name);
+    return it != ids.end() ? it->second : invalidSymbol;
+  }
+
+  const std::string& getName(Symbol symbol) const { return names[symbol]; }
+  size_t size() const { return names.size(); }
+};
+
+/* \brief Interned names of a single file and hash indexes over them
+ *
+ * Names of all chunks are interned when constructed, the index then answers
+ * find*() in O(1). Hot paths (e.g. scripts resolving actors every frame)
+ * should resolve the name to a Symbol once and use the Symbol overloads.
+ *
+ * When more objects share a name, the first one is returned, which matches
+ * a linear scan. Unless a shared SymbolTable is passed, the index owns its
+ * table. The index doesn't refer to the File / Arena it was built from.
+ */
+class NameIndex
+{
+public:
+  static constexpr size_t notFound = ~size_t(0);
+
+private:
+  std::unique_ptr<SymbolTable> ownTable;
+  SymbolTable* symbols;
+
+  std::vector<Symbol> animationNames;
+  std::vector<Symbol> frameNames;
+  std::vector<Symbol> actorNames;
+  std::vector<Symbol> scriptNames;
+  std::vector<Symbol> soundNames;
+  std::vector<Symbol> dialogFrameNames;
+  std::vector<Symbol> morphFrameNames;
+
+  std::unordered_map<Symbol, uint32_t> objectsByActor;
+  std::unordered_map<Symbol, uint32_t> objectsByFrame;
+  std::unordered_map<Symbol, uint32_t> animationsByName;
+
+  template<typename Chunk, size_t N>
+  void internAll(Span<const Chunk> chunks,
+                 char (Chunk::*name)[N],
+                 std::vector<Symbol>& result)
+  {
+    result.resize(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++)
+      result[i] = symbols->intern(chunks[i].*name);
+  }
+
+  static void createIndex(const std::vector<Symbol>& names,
+                          std::unordered_map<Symbol, uint32_t>& index)
+  {
+    index.reserve(names.size());
+    // emplace keeps the first occurrence
+    for (size_t i = 0; i < names.size(); i++)
+      index.emplace(names[i], uint32_t(i));
+  }
+
+  static size_t lookup(const std::unordered_map<Symbol, uint32_t>& index,
+                       Symbol symbol)
+  {
+    auto it = index.find(symbol);
+    return it != index.end() ? it->second : notFound;
+  }
+
+  void build(Span<const AnimationBlock> animationBlocks,
+             Span<const AnimatedObjectDefinitions> animatedObjects,
+             Span<const ScriptChunk> scriptChunks,
+             Span<const SoundChunk> soundChunks,
+             Span<const DialogChunk> dialogChunks,
+             Span<const MorphChunk> morphChunks)
+  {
+    internAll(animationBlocks, &AnimationBlock::animationName, animationNames);
+    internAll(animatedObjects, &AnimatedObjectDefinitions::frameName,
+              frameNames);
+    internAll(animatedObjects, &AnimatedObjectDefinitions::actorName,
+              actorNames);
+    internAll(scriptChunks, &ScriptChunk::scriptName, scriptNames);
+    internAll(soundChunks, &SoundChunk::soundName, soundNames);
+    internAll(dialogChunks, &DialogChunk::framename, dialogFrameNames);
+    internAll(morphChunks, &MorphChunk::frameName, morphFrameNames);
+    createIndex(actorNames, objectsByActor);
+    createIndex(frameNames, objectsByFrame);
+    createIndex(animationNames, animationsByName);
+  }
+
+  template<typename T>
+  static Span<const T> toSpan(const std::vector<T>& vector)
+  {
+    return Span<const T>(vector.data(), vector.size());
+  }
+
+  NameIndex(const File& file, SymbolTable* sharedTable)
+    : ownTable(sharedTable ? nullptr : new SymbolTable())
+    , symbols(sharedTable ? sharedTable : ownTable.get())
+  {
+    build(toSpan(file.animationBlocks), toSpan(file.animatedObjects),
+          toSpan(file.scriptChunks), toSpan(file.soundChunks),
+          toSpan(file.dialogChunks), toSpan(file.morphChunks));
+  }
+
+  NameIndex(const Arena& arena, SymbolTable* sharedTable)
+    : ownTable(sharedTable ? nullptr : new SymbolTable())
+    , symbols(sharedTable ? sharedTable : ownTable.get())
+  {
+    build(arena.getAnimationBlocks(), arena.getAnimatedObjects(),
+          arena.getScriptChunks(), arena.getSoundChunks(),
+          arena.getDialogChunks(), arena.getMorphChunks());
+  }
+
+public:
+  explicit NameIndex(const File& file)
+    : NameIndex(file, nullptr)
+  {}
+
+  NameIndex(const File& file, SymbolTable& sharedTable)
+    : NameIndex(file, &sharedTable)
+  {}
+
+  explicit NameIndex(const Arena& arena)
+    : NameIndex(arena, nullptr)
+  {}
+
+  NameIndex(const Arena& arena, SymbolTable& sharedTable)
+    : NameIndex(arena, &sharedTable)
+  {}
+
+  const SymbolTable& getSymbols() const { return *symbols; }
+  Symbol findSymbol(std::string_view name) const
+  {
+    return symbols->find(name);
+  }
+
+  /// Returns index of object with given actorName or notFound
+  size_t findObjectByActor(Symbol actor) const
+  {
+    return lookup(objectsByActor, actor);
+  }
+  size_t findObjectByActor(std::string_view actor) const
+  {
+    return findObjectByActor(findSymbol(actor));
+  }
+
+  /// Returns index of object with given frameName or notFound
+  size_t findObjectByFrame(Symbol frame) const
+  {
+    return lookup(objectsByFrame, frame);
+  }
+  size_t findObjectByFrame(std::string_view frame) const
+  {
+    return findObjectByFrame(findSymbol(frame));
+  }
+
+  /// Returns index of animation block with given name or notFound
+  size_t findAnimationByName(Symbol animation) const
+  {
+    return lookup(animationsByName, animation);
+  }
+  size_t findAnimationByName(std::string_view animation) const
+  {
+    return findAnimationByName(findSymbol(animation));
+  }
+
+  Symbol getAnimationName(size_t i) const { return animationNames[i]; }
+  Symbol getFrameName(size_t i) const { return frameNames[i]; }
+  Symbol getActorName(size_t i) const { return actorNames[i]; }
+  Symbol getScriptName(size_t i) const { return scriptNames[i]; }
+  Symbol getSoundName(size_t i) const { return soundNames[i]; }
+  Symbol getDialogFrameName(size_t i) const { return dialogFrameNames[i]; }
+  Symbol getMorphFrameName(size_t i) const { return morphFrameNames[i]; }
+};
+
+} // namespace RepFile
@@ -0,0 +1,285 @@
+#pragma once
+/*
+ * .rep event timeline
+ * Author: Roman Romop5 Dobias
+ * Purpose: fire fades, scripts, sounds, dialogs, narrators and morphs in time
+ * order without scanning each section for every frame
+ */
+
+#include "arena.hpp"
+
+namespace RepFile {
+
+enum EventType : uint32_t
+{
+  EVENT_FADE = 0,
+  EVENT_SCRIPT,
+  EVENT_SOUND_START,
+  EVENT_SOUND_END,
+  EVENT_DIALOG,
+  EVENT_NARRATOR,
+  EVENT_MORPH,
+};
+
+/* \brief Single event of cutscene
+ *
+ * index refers to the chunk in the section of given type (sounds share the
+ * section for starts and ends).
+ */
+struct Event
+{
+  uint32_t timestamp;
+  EventType type;
+  uint32_t index;
+};
+
+/* \brief All events of a cutscene sorted by their time
+ *
+ * Events with the same time keep the order of EventType and then the order of
+ * chunks in file, thus the order is deterministic. Morphs with zero timestamp
+ * are activated at unk1.
+ *
+ * eventsIn() is O(log n + k). For playback, Cursor returns events which
+ * became due since its last call in amortized O(1).
+ *
+ * Timeline refers to chunks of the File / Arena it was built from, which must
+ * outlive it.
+ */
+class Timeline
+{
+private:
+  std::vector<Event> events;
+  Span<const FadeChunk> fadeChunks;
+  Span<const ScriptChunk> scriptChunks;
+  Span<const SoundChunk> soundChunks;
+  Span<const DialogChunk> dialogChunks;
+  Span<const NarratorChunk> narratorChunks;
+  Span<const MorphChunk> morphChunks;
+
+  template<typename T>
+  static Span<const T> toSpan(const std::vector<T>& vector)
+  {
+    return Span<const T>(vector.data(), vector.size());
+  }
+
+  void add(uint32_t timestamp, EventType type, size_t index)
+  {
+    events.push_back(Event{ timestamp, type, uint32_t(index) });
+  }
+
+  void build()
+  {
+    events.clear();
+    events.reserve(fadeChunks.size() + scriptChunks.size() +
+                   soundChunks.size() + dialogChunks.size() +
+                   narratorChunks.size() + morphChunks.size());
+    for (size_t i = 0; i < fadeChunks.size(); i++)
+      add(fadeChunks[i].getStartOfFadeEvent(), EVENT_FADE, i);
+    for (size_t i = 0; i < scriptChunks.size(); i++)
+      add(scriptChunks[i].timestamp, EVENT_SCRIPT, i);
+    for (size_t i = 0; i < soundChunks.size(); i++)
+      add(soundChunks[i].timestamp,
+          soundChunks[i].type == SOUND_END ? EVENT_SOUND_END : EVENT_SOUND_START,
+          i);
+    for (size_t i = 0; i < dialogChunks.size(); i++)
+      add(dialogChunks[i].timestamp, EVENT_DIALOG, i);
+    for (size_t i = 0; i < narratorChunks.size(); i++)
+      add(narratorChunks[i].timestamp, EVENT_NARRATOR, i);
+    for (size_t i = 0; i < morphChunks.size(); i++) {
+      const auto& chunk = morphChunks[i];
+      add(chunk.timestamp == 0 ? chunk.unk1 : chunk.timestamp, EVENT_MORPH, i);
+    }
+    std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+      if (a.timestamp != b.timestamp)
+        return a.timestamp < b.timestamp;
+      if (a.type != b.type)
+        return a.type < b.type;
+      return a.index < b.index;
+    });
+  }
+
+public:
+  Timeline() {}
+
+  explicit Timeline(const File& file)
+    : fadeChunks(toSpan(file.fadeChunks))
+    , scriptChunks(toSpan(file.scriptChunks))
+    , soundChunks(toSpan(file.soundChunks))
+    , dialogChunks(toSpan(file.dialogChunks))
+    , narratorChunks(toSpan(file.narratorChunks))
+    , morphChunks(toSpan(file.morphChunks))
+  {
+    build();
+  }
+
+  explicit Timeline(const Arena& arena)
+    : fadeChunks(arena.getFadeChunks())
+    , scriptChunks(arena.getScriptChunks())
+    , soundChunks(arena.getSoundChunks())
+    , dialogChunks(arena.getDialogChunks())
+    , narratorChunks(arena.getNarratorChunks())
+    , morphChunks(arena.getMorphChunks())
+  {
+    build();
+  }
+
+  /// Uses events sorted earlier (e.g. stored by Cache), nothing is sorted
+  Timeline(const Arena& arena, Span<const Event> sortedEvents)
+    : events(sortedEvents.begin(), sortedEvents.end())
+    , fadeChunks(arena.getFadeChunks())
+    , scriptChunks(arena.getScriptChunks())
+    , soundChunks(arena.getSoundChunks())
+    , dialogChunks(arena.getDialogChunks())
+    , narratorChunks(arena.getNarratorChunks())
+    , morphChunks(arena.getMorphChunks())
+  {}
+
+  /// Checks that events are sorted and refer to existing chunks
+  bool isValid() const
+  {
+    if (!std::is_sorted(events.begin(), events.end(),
+                        [](const Event& a, const Event& b) {
+                          return a.timestamp < b.timestamp;
+                        }))
+      return false;
+    for (const auto& event : events) {
+      size_t count = 0;
+      switch (event.type) {
+        case EVENT_FADE:
+          count = fadeChunks.size();
+          break;
+        case EVENT_SCRIPT:
+          count = scriptChunks.size();
+          break;
+        case EVENT_SOUND_START:
+        case EVENT_SOUND_END:
+          count = soundChunks.size();
+          break;
+        case EVENT_DIALOG:
+          count = dialogChunks.size();
+          break;
+        case EVENT_NARRATOR:
+          count = narratorChunks.size();
+          break;
+        case EVENT_MORPH:
+          count = morphChunks.size();
+          break;
+      }
+      if (event.index >= count)
+        return false;
+    }
+    return true;
+  }
+
+  size_t size() const { return events.size(); }
+  Span<const Event> getEvents() const
+  {
+    return Span<const Event>(events.data(), events.size());
+  }
+
+  /// Returns events with startMs <= timestamp < endMs
+  Span<const Event> eventsIn(uint32_t startMs, uint32_t endMs) const
+  {
+    if (endMs <= startMs)
+      return Span<const Event>();
+    auto byTime = [](const Event& event, uint32_t time) {
+      return event.timestamp < time;
+    };
+    auto first =
+      std::lower_bound(events.begin(), events.end(), startMs, byTime);
+    auto last = std::lower_bound(first, events.end(), endMs, byTime);
+    return Span<const Event>(events.data() + (first - events.begin()),
+                             last - first);
+  }
+
+  const FadeChunk& getFade(const Event& event) const
+  {
+    return fadeChunks[event.index];
+  }
+  const ScriptChunk& getScript(const Event& event) const
+  {
+    return scriptChunks[event.index];
+  }
+  const SoundChunk& getSound(const Event& event) const
+  {
+    return soundChunks[event.index];
+  }
+  const DialogChunk& getDialog(const Event& event) const
+  {
+    return dialogChunks[event.index];
+  }
+  const NarratorChunk& getNarrator(const Event& event) const
+  {
+    return narratorChunks[event.index];
+  }
+  const MorphChunk& getMorph(const Event& event) const
+  {
+    return morphChunks[event.index];
+  }
+
+  /* \brief Forward playback over timeline
+   *
+   * advance(t) returns events with timestamp <= t, which weren't returned
+   * yet. Going back in time requires seek().
+   */
+  class Cursor
+  {
+  private:
+    const Timeline* timeline;
+    size_t next;
+
+  public:
+    explicit Cursor(const Timeline& owner)
+      : timeline(&owner)
+      , next(0)
+    {}
+
+    Span<const Event> advance(uint32_t timeMs)
+    {
+      const auto& events = timeline->events;
+      size_t first = next;
+      while (next < events.size() && events[next].timestamp <= timeMs)
+        next++;
+      return Span<const Event>(events.data() + first, next - first);
+    }
+
+    /// The next advance() starts with events at timeMs
+    void seek(uint32_t timeMs)
+    {
+      const auto& events = timeline->events;
+      next = std::lower_bound(events.begin(), events.end(), timeMs,
+                              [](const Event& event, uint32_t time) {
+                                return event.timestamp < time;
+                              }) -
+             events.begin();
+    }
+
+    void reset() { next = 0; }
+  };
+
+  Cursor createCursor() const { return Cursor(*this); }
+};
+
+inline const char* getEventTypeName(EventType type)
+{
+  switch (type) {
+    case EVENT_FADE:
+      return "FADE";
+    case EVENT_SCRIPT:
+      return "SCRIPT";
+    case EVENT_SOUND_START:
+      return "SOUND_START";
+    case EVENT_SOUND_END:
+      return "SOUND_END";
+    case EVENT_DIALOG:
+      return "DIALOG";
+    case EVENT_NARRATOR:
+      return "NARRATOR";
+    case EVENT_MORPH:
+      return "MORPH";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+} // namespace RepFile
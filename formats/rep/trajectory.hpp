@@ -0,0 +1,177 @@
+#pragma once
+/*
+ * .rep trajectory index
+ * Author: Roman Romop5 Dobias
+ * Purpose: spatial queries over animated objects of a file or corpus
+ */
+
+#include "sampler.hpp"
+#include "spatial.hpp"
+
+namespace RepFile {
+
+/* \brief Object found by TrajectoryIndex
+ */
+struct ObjectHit
+{
+  uint32_t file; // as returned by TrajectoryIndex::add()
+  uint32_t object;
+  Position position; // at the queried time (findObjectsNear() only)
+  float distance;
+};
+
+/* \brief Spatial index over transformation tracks of one or more files
+ *
+ * Each track is cut into segments of keysPerSegment keys, a segment covers
+ * the time from its first key to its last one, which is also the first key
+ * of the next segment. Poses of Sampler lie within the box of keys (lerp
+ * stays between keys, step holds them), the first / last key is held before
+ * / after the track. Segments go into Spatial::Bvh, candidates are then
+ * checked exactly:
+ *  - findObjectsNear() samples the pose at the queried time
+ *  - findObjectsIn() tests interpolated pieces between keys (or key
+ *    positions, if the key isn't interpolated) against the region
+ *
+ * Files are referred to, thus they must outlive the index. Call build()
+ * after add() and before queries.
+ */
+class TrajectoryIndex
+{
+private:
+  size_t keysPerSegment;
+  std::vector<const File*> files;
+  std::vector<Sampler> samplers;
+  Spatial::Bvh bvh;
+
+  void addSegments(uint32_t fileIndex,
+                   uint32_t object,
+                   const TransformTrack& track,
+                   std::vector<Spatial::Item>& items) const
+  {
+    if (track.size() == 0)
+      return;
+    for (size_t first = 0; first < track.size(); first += keysPerSegment) {
+      size_t last = std::min(first + keysPerSegment, track.size() - 1);
+      Spatial::Item item;
+      item.box = Spatial::Box::createEmpty();
+      for (size_t key = first; key <= last; key++)
+        item.box.extend(track.positions[key].data());
+      item.startTime = first == 0 ? 0 : track.timestamps[first];
+      item.endTime =
+        last + 1 == track.size() ? UINT32_MAX : track.timestamps[last];
+      item.group = fileIndex;
+      item.object = object;
+      item.firstKey = uint32_t(first);
+      item.lastKey = uint32_t(last);
+      items.push_back(item);
+      if (last + 1 == track.size())
+        break;
+    }
+  }
+
+  bool passesThrough(const Spatial::Item& item, const Spatial::Box& region) const
+  {
+    const TransformTrack& track =
+      files[item.group]->transformTracks[item.object];
+    for (size_t key = item.firstKey; key <= item.lastKey; key++) {
+      const float* position = track.positions[key].data();
+      bool isInterpolated =
+        (track.auxiliary[key] & ANIMATION_SHOULD_INTERPOLATE) && key < item.lastKey;
+      if (isInterpolated
+            ? Spatial::intersectsSegment(region, position,
+                                         track.positions[key + 1].data())
+            : region.contains(position))
+        return true;
+    }
+    return false;
+  }
+
+  static void sortHits(std::vector<ObjectHit>& hits)
+  {
+    std::sort(hits.begin(), hits.end(), [](const ObjectHit& a, const ObjectHit& b) {
+      return a.file != b.file ? a.file < b.file : a.object < b.object;
+    });
+    hits.erase(std::unique(hits.begin(), hits.end(),
+                           [](const ObjectHit& a, const ObjectHit& b) {
+                             return a.file == b.file && a.object == b.object;
+                           }),
+               hits.end());
+  }
+
+public:
+  explicit TrajectoryIndex(size_t countOfKeysPerSegment = 16)
+    : keysPerSegment(std::max<size_t>(countOfKeysPerSegment, 1))
+  {}
+
+  /// Returns index of file, which is reported by queries
+  uint32_t add(const File& file)
+  {
+    files.push_back(&file);
+    samplers.emplace_back(file);
+    return uint32_t(files.size() - 1);
+  }
+
+  void build()
+  {
+    std::vector<Spatial::Item> items;
+    for (size_t i = 0; i < files.size(); i++) {
+      const auto& tracks = files[i]->transformTracks;
+      for (size_t object = 0; object < tracks.size(); object++)
+        addSegments(uint32_t(i), uint32_t(object), tracks[object], items);
+    }
+    bvh = Spatial::Bvh(std::move(items));
+  }
+
+  size_t getCountOfFiles() const { return files.size(); }
+  const Spatial::Bvh& getBvh() const { return bvh; }
+
+  /// Objects within radius of point at given time, sorted by file and object
+  std::vector<ObjectHit> findObjectsNear(const Position& point,
+                                         float radius,
+                                         uint32_t timeMs) const
+  {
+    std::vector<ObjectHit> hits;
+    float radiusSquared = radius * radius;
+    Spatial::Box region = Spatial::Box::createAround(point.data(), radius);
+    bvh.query(region, timeMs, timeMs, [&](const Spatial::Item& item) {
+      if (item.box.getDistanceSquared(point.data()) > radiusSquared)
+        return;
+      Pose pose = samplers[item.group].poseAt(item.object, timeMs);
+      float distanceSquared = 0.0f;
+      for (size_t c = 0; c < 3; c++)
+        distanceSquared +=
+          (pose.position[c] - point[c]) * (pose.position[c] - point[c]);
+      if (distanceSquared <= radiusSquared)
+        hits.push_back(ObjectHit{ item.group, item.object, pose.position,
+                                  std::sqrt(distanceSquared) });
+    });
+    sortHits(hits);
+    return hits;
+  }
+
+  /// Objects, which pass through region at any time
+  std::vector<ObjectHit> findObjectsIn(const Spatial::Box& region) const
+  {
+    std::vector<ObjectHit> hits;
+    bvh.query(region, 0, UINT32_MAX, [&](const Spatial::Item& item) {
+      if (passesThrough(item, region))
+        hits.push_back(
+          ObjectHit{ item.group, item.object, Position(), 0.0f });
+    });
+    sortHits(hits);
+    return hits;
+  }
+
+  /// Files (cutscenes), whose some object passes through region
+  std::vector<uint32_t> findFilesIn(const Spatial::Box& region) const
+  {
+    std::vector<uint32_t> result;
+    for (const auto& hit : findObjectsIn(region)) {
+      if (result.empty() || result.back() != hit.file)
+        result.push_back(hit.file);
+    }
+    return result;
+  }
+};
+
+} // namespace RepFile
@@ -0,0 +1,244 @@
+#pragma once
+/*
+ * .rep zero-copy view
+ * Author: Roman Romop5 Dobias
+ * Purpose: inspect .rep file directly from its memory mapping
+ */
+
+#include "bstream.hpp"
+#include "rep.hpp"
+
+namespace RepFile {
+
+/* \brief Walks chunks of object stream without decoding them
+ *
+ * Returns false if any chunk has invalid type or exceeds the stream.
+ */
+inline bool scanObjectStream(Span<const unsigned char> stream,
+                             const AnimatedObjectDefinitions& object,
+                             size_t& countOfKeys,
+                             size_t& extraSize)
+{
+  countOfKeys = 0;
+  extraSize = 0;
+  return ChunkDecoders::decodeStream(
+    stream.data(), stream.size(), object.sizeOfBlocks,
+    [&](size_t, const TransformationHeader&, const unsigned char*,
+        auto payloadLength) {
+      if (payloadLength > sizeof(TransformPayload))
+        extraSize += payloadLength - sizeof(TransformPayload);
+      countOfKeys++;
+    });
+}
+
+/* \brief Read-only view of .rep file
+ *
+ * The file is memory-mapped and all sections are located using sizes stored
+ * in Header. No chunk is copied, all getters return spans pointing into the
+ * mapping, thus the View must outlive all spans obtained from it.
+ *
+ * Opening a file only touches header pages, which makes View suitable for
+ * tools that just peek at headers or camera tracks of many cutscenes.
+ */
+class View
+{
+private:
+  BStream stream;
+  const Header* header;
+  Span<const AnimationBlock> animationBlocks;
+  Span<const AnimatedObjectDefinitions> animatedObjects;
+  size_t transformationOffset;
+  Span<const CameraTransformationChunk> cameraPositionChunks;
+  Span<const CameraFocusChunk> cameraFocusChunks;
+  const ScriptsAndSoundsHeader* eventsHeader;
+  Span<const unsigned char> eventsPostheaderData;
+  Span<const FadeChunk> fadeChunks;
+  Span<const ScriptChunk> scriptChunks;
+  Span<const SoundChunk> soundChunks;
+  const DialogHeader* dialogHeader;
+  Span<const DialogChunk> dialogChunks;
+  Span<const NarratorChunk> narratorChunks;
+  Span<const MorphChunk> morphChunks;
+
+  void reset()
+  {
+    header = nullptr;
+    animationBlocks = Span<const AnimationBlock>();
+    animatedObjects = Span<const AnimatedObjectDefinitions>();
+    transformationOffset = 0;
+    cameraPositionChunks = Span<const CameraTransformationChunk>();
+    cameraFocusChunks = Span<const CameraFocusChunk>();
+    eventsHeader = nullptr;
+    eventsPostheaderData = Span<const unsigned char>();
+    fadeChunks = Span<const FadeChunk>();
+    scriptChunks = Span<const ScriptChunk>();
+    soundChunks = Span<const SoundChunk>();
+    dialogHeader = nullptr;
+    dialogChunks = Span<const DialogChunk>();
+    narratorChunks = Span<const NarratorChunk>();
+    morphChunks = Span<const MorphChunk>();
+  }
+
+  template<typename T>
+  bool locate(Span<const T>& span, size_t& offset, size_t count)
+  {
+    span = stream.getSpan<T>(offset, count);
+    if (span.size() != count)
+      return false;
+    offset += count * sizeof(T);
+    return true;
+  }
+
+  bool fail(const char* message)
+  {
+    std::cerr << "[Err] " << message << std::endl;
+    reset();
+    return false;
+  }
+
+  bool locateSections()
+  {
+    header = stream.getPointer<Header>(0);
+    if (!header)
+      return fail("File is too short to contain header");
+    if (header->magicByte != magicByteConstant)
+      return fail("Invalid magic byte");
+
+    // the animation section starts with the last two fields of Header
+    size_t offset = sizeof(Header);
+    size_t animationSectionEnd = offsetof(Header, countOfAnimationBlocks) +
+                                 header->sizeOfAnimationSection;
+    if (!locate(animationBlocks, offset, header->countOfAnimationBlocks) ||
+        offset != animationSectionEnd)
+      return fail("Animation section doesn't match its declared size");
+
+    if (!locate(animatedObjects, offset,
+                header->countOfObjectDefinitionBlocks))
+      return fail("Object definitions exceed file");
+
+    transformationOffset = offset;
+    size_t transformationSize = header->sizeOfObjectDefinitionsSection;
+    if (transformationSize > stream.size() - offset)
+      return fail("Transformation section exceeds file");
+    for (const auto& object : animatedObjects) {
+      if (object.positionOfTheBeginning > transformationSize ||
+          object.sizeOfStreamSection >
+            transformationSize - object.positionOfTheBeginning)
+        return fail("Object stream exceeds transformation section");
+    }
+    offset += transformationSize;
+
+    if (!locate(cameraPositionChunks, offset, header->countOfCameraChunks) ||
+        !locate(cameraFocusChunks, offset, header->countOfCameraFocusChunks))
+      return fail("Camera section exceeds file");
+
+    size_t eventsEnd = offset + header->sizeOfScriptEventsSequence;
+    eventsHeader = stream.getPointer<ScriptsAndSoundsHeader>(offset);
+    if (!eventsHeader || eventsEnd > stream.size())
+      return fail("Events section exceeds file");
+    offset += sizeof(ScriptsAndSoundsHeader);
+    if (!locate(eventsPostheaderData, offset,
+                eventsHeader->sizeOfPostheaderData) ||
+        !locate(fadeChunks, offset,
+                eventsHeader->sizeOfFadeSection / sizeof(FadeChunk)) ||
+        !locate(scriptChunks, offset,
+                eventsHeader->sizeOfScriptSection / sizeof(ScriptChunk)) ||
+        !locate(soundChunks, offset,
+                eventsHeader->sizeOfSoundSection / sizeof(SoundChunk)) ||
+        offset > eventsEnd)
+      return fail("Events section doesn't match its declared size");
+    offset = eventsEnd;
+
+    size_t dialogsEnd = offset + header->sizeOfDialogSection;
+    dialogHeader = stream.getPointer<DialogHeader>(offset);
+    if (!dialogHeader || dialogsEnd > stream.size())
+      return fail("Dialog section exceeds file");
+    offset += sizeof(DialogHeader);
+    if (!locate(dialogChunks, offset, dialogHeader->countOfDialogs) ||
+        !locate(narratorChunks, offset,
+                dialogHeader->countOfNarratorChunks) ||
+        !locate(morphChunks, offset, dialogHeader->unk2) ||
+        offset > dialogsEnd)
+      return fail("Dialog section doesn't match its declared size");
+    return true;
+  }
+
+public:
+  View() { reset(); }
+
+  /// Maps file and locates its sections, returns false for invalid files
+  bool open(const std::string& fileName)
+  {
+    reset();
+    if (!stream.open(fileName)) {
+      std::cerr << "[Err] Failed to open file " << fileName << std::endl;
+      return false;
+    }
+    return locateSections();
+  }
+
+  /// Views file already stored in memory (which must outlive the View)
+  bool open(const void* data, size_t size)
+  {
+    reset();
+    stream.open(data, size);
+    return locateSections();
+  }
+
+  bool isValid() const { return header != nullptr; }
+  size_t getFileSize() const { return stream.size(); }
+
+  const Header& getHeader() const { return *header; }
+  Span<const AnimationBlock> getAnimationBlocks() const
+  {
+    return animationBlocks;
+  }
+  Span<const AnimatedObjectDefinitions> getAnimatedObjects() const
+  {
+    return animatedObjects;
+  }
+
+  /// Returns raw transformation section of all objects
+  Span<const unsigned char> getTransformationSection() const
+  {
+    return stream.getSpan<unsigned char>(
+      transformationOffset, header->sizeOfObjectDefinitionsSection);
+  }
+
+  /// Returns raw transformation stream of i-th animated object
+  Span<const unsigned char> getObjectStream(size_t i) const
+  {
+    const auto& object = animatedObjects[i];
+    return stream.getSpan<unsigned char>(transformationOffset +
+                                           object.positionOfTheBeginning,
+                                         object.sizeOfStreamSection);
+  }
+
+  Span<const CameraTransformationChunk> getCameraPositionChunks() const
+  {
+    return cameraPositionChunks;
+  }
+  Span<const CameraFocusChunk> getCameraFocusChunks() const
+  {
+    return cameraFocusChunks;
+  }
+  const ScriptsAndSoundsHeader& getEventsHeader() const
+  {
+    return *eventsHeader;
+  }
+  Span<const unsigned char> getEventsPostheaderData() const
+  {
+    return eventsPostheaderData;
+  }
+  Span<const FadeChunk> getFadeChunks() const { return fadeChunks; }
+  Span<const ScriptChunk> getScriptChunks() const { return scriptChunks; }
+  Span<const SoundChunk> getSoundChunks() const { return soundChunks; }
+  const DialogHeader& getDialogHeader() const { return *dialogHeader; }
+  Span<const DialogChunk> getDialogChunks() const { return dialogChunks; }
+  Span<const NarratorChunk> getNarratorChunks() const
+  {
+    return narratorChunks;
+  }
+  Span<const MorphChunk> getMorphChunks() const { return morphChunks; }
+};
+} // namespace RepFile
@@ -0,0 +1,143 @@
+#pragma once
+/*
+ * Compact .tck encoding
+ * Author: Roman Romop5 Dobias
+ * Purpose: keep many tracks resident in a fraction of their memory
+ */
+
+#include "bitpack.hpp"
+#include "tck.hpp"
+
+namespace TckFile {
+
+/* \brief Lossy compact sidecar encoding of File
+ *
+ * Frames are implied by milisecondsPerFrame, thus only positions are encoded:
+ * quantized to 16 bits per axis and stored as varint residuals of linear
+ * prediction. Header's startPosition/endPosition don't bound the track (they
+ * are equal in the files seen so far), hence the bounding box of blocks is
+ * stored instead.
+ *
+ * Error bound: each axis within extent / 131070 of the bounding box.
+ * Header, the leading block and trailing data are restored exactly.
+ */
+class Compact
+{
+public:
+  static constexpr uint32_t magicConstant = 0x434b4354; // "TCKC"
+  static constexpr uint32_t version = 1;
+  static constexpr unsigned positionBits = 16;
+
+  struct Statistics
+  {
+    size_t rawSize;        // in-memory size of position blocks
+    size_t compactSize;    // encoded size of whole file
+    float maxPositionError; // measured on the encoded data
+  };
+
+  static bool encode(const File& file,
+                     std::vector<unsigned char>& output,
+                     Statistics* statistics = nullptr)
+  {
+    Statistics localStatistics = Statistics();
+    output.clear();
+    Packing::Writer writer(output);
+    writer.put(magicConstant);
+    writer.put(version);
+    writer.put(file.header);
+    writer.put(file.leadingBlock);
+    writer.putVarint(file.positionBlocks.size());
+
+    Packing::Bounds bounds;
+    for (const auto& block : file.positionBlocks)
+      bounds.extend(block.position);
+    for (size_t c = 0; c < 3; c++) {
+      writer.put(bounds.minimum[c]);
+      writer.put(bounds.maximum[c]);
+    }
+    for (size_t c = 0; c < 3; c++) {
+      Packing::Quantizer quantizer(bounds.minimum[c], bounds.maximum[c],
+                                   positionBits);
+      Packing::LinearPredictor predictor;
+      for (const auto& block : file.positionBlocks) {
+        int64_t value = quantizer.quantize(block.position[c]);
+        writer.putSignedVarint(value - predictor.predict());
+        predictor.push(value);
+        localStatistics.maxPositionError = std::max(
+          localStatistics.maxPositionError,
+          std::fabs(quantizer.dequantize(uint32_t(value)) - block.position[c]));
+      }
+    }
+    writer.putVarint(file.trailingData.size());
+    writer.putRaw(file.trailingData.data(), file.trailingData.size());
+    localStatistics.rawSize = file.positionBlocks.size() * sizeof(PositionBlock);
+    localStatistics.compactSize = writer.size();
+    if (statistics)
+      *statistics = localStatistics;
+    return true;
+  }
+
+  static bool decode(const void* data, size_t size, File& file)
+  {
+    Packing::Reader reader(data, size);
+    uint32_t magic = 0, fileVersion = 0;
+    reader.get(magic);
+    reader.get(fileVersion);
+    if (magic != magicConstant || fileVersion != version)
+      return false;
+    file = File();
+    reader.get(file.header);
+    reader.get(file.leadingBlock);
+    file.hasLeadingBlock = file.header.countOfPositionBlocks > 0;
+    uint64_t countOfBlocks = reader.getVarint();
+    // each block takes at least 3 bytes (one-byte varint per axis)
+    if (reader.hasFailed() || countOfBlocks > reader.remaining() / 3)
+      return false;
+    Packing::Bounds bounds;
+    for (size_t c = 0; c < 3; c++) {
+      reader.get(bounds.minimum[c]);
+      reader.get(bounds.maximum[c]);
+    }
+    file.positionBlocks.resize(static_cast<size_t>(countOfBlocks));
+    for (size_t c = 0; c < 3; c++) {
+      Packing::Quantizer quantizer(bounds.minimum[c], bounds.maximum[c],
+                                   positionBits);
+      Packing::LinearPredictor predictor;
+      for (auto& block : file.positionBlocks) {
+        int64_t value = predictor.predict() + reader.getSignedVarint();
+        predictor.push(value);
+        block.position[c] = quantizer.dequantize(uint32_t(value));
+      }
+    }
+    uint64_t countOfTrailingBytes = reader.getVarint();
+    if (reader.hasFailed() || countOfTrailingBytes > reader.remaining())
+      return false;
+    file.trailingData.resize(static_cast<size_t>(countOfTrailingBytes));
+    return reader.getRaw(file.trailingData.data(), file.trailingData.size());
+  }
+
+  static bool storeFile(const File& file,
+                        const std::string& fileName,
+                        Statistics* statistics = nullptr)
+  {
+    std::vector<unsigned char> buffer;
+    if (!encode(file, buffer, statistics))
+      return false;
+    std::ofstream outputFile(fileName, std::ofstream::binary);
+    outputFile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    return static_cast<bool>(outputFile);
+  }
+
+  static bool loadFile(const std::string& fileName, File& file)
+  {
+    std::ifstream inputFile(fileName, std::ifstream::binary | std::ifstream::ate);
+    if (!inputFile.is_open())
+      return false;
+    std::vector<unsigned char> buffer(static_cast<size_t>(inputFile.tellg()));
+    inputFile.seekg(0);
+    inputFile.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    return inputFile && decode(buffer.data(), buffer.size(), file);
+  }
+};
+
+} // namespace TckFile
@@ -0,0 +1,127 @@
+#pragma once
+/*
+ * .tck keyframe decimation
+ * Author: Roman Romop5 Dobias
+ * Purpose: turn fixed-rate tracks into sparse keyframe tracks
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "tck.hpp"
+
+namespace TckFile {
+
+/* \brief Sparse track of keyframes, positions are lerped between them
+ *
+ * The same sampling as File::positionAt(), only keys aren't equidistant,
+ * thus the key is found by binary search in O(log n).
+ */
+class KeyframeTrack
+{
+public:
+  std::vector<uint32_t> timestamps; // ascending
+  std::vector<PositionBlock> positions;
+
+  size_t size() const { return timestamps.size(); }
+  /// Memory taken by keys
+  size_t getSize() const
+  {
+    return size() * (sizeof(uint32_t) + sizeof(PositionBlock));
+  }
+
+  PositionBlock positionAt(uint32_t timeMs) const
+  {
+    if (timestamps.empty())
+      return PositionBlock();
+    const uint32_t* upper =
+      std::upper_bound(timestamps.data(), timestamps.data() + size(), timeMs);
+    if (upper == timestamps.data())
+      return positions.front();
+    size_t key = upper - timestamps.data() - 1;
+    if (key + 1 >= size())
+      return positions.back();
+    float alpha = float(timeMs - timestamps[key]) /
+                  (timestamps[key + 1] - timestamps[key]);
+    const PositionBlock& a = positions[key];
+    const PositionBlock& b = positions[key + 1];
+    PositionBlock result;
+    for (size_t c = 0; c < 3; c++)
+      result.position[c] = a.position[c] + (b.position[c] - a.position[c]) * alpha;
+    return result;
+  }
+};
+
+struct DecimationStatistics
+{
+  size_t countOfFrames;
+  size_t countOfKeys;
+  size_t trackSize; // position blocks of File
+  size_t decimatedSize; // KeyframeTrack::getSize()
+  float maxError; // of removed frames
+};
+
+/* \brief Keeps only frames, which can't be lerped from their neighbours
+ *
+ * Frames of File are lerped, thus between two kept keys both the original
+ * and the decimated track are linear between frames and the largest error
+ * is at a removed frame. A frame is removed only if its distance to the lerp
+ * of the kept keys around it is at most maxError. The first and the last
+ * frame are always kept. Greedy, each key spans at most maxSpan frames.
+ */
+inline KeyframeTrack decimate(const File& file,
+                              float maxError,
+                              DecimationStatistics* statistics = nullptr,
+                              size_t maxSpan = 256)
+{
+  const auto& frames = file.getPositionBlocks();
+  uint32_t frameTime = std::max<uint32_t>(file.getMilisecondsPerFrame(), 1);
+  auto getError = [&frames](size_t start, size_t end, size_t frame) {
+    float alpha = float(frame - start) / (end - start);
+    float error = 0.0f;
+    for (size_t c = 0; c < 3; c++) {
+      float a = frames[start].position[c];
+      float value = a + (frames[end].position[c] - a) * alpha;
+      float delta = value - frames[frame].position[c];
+      error += delta * delta;
+    }
+    return std::sqrt(error);
+  };
+
+  KeyframeTrack track;
+  float maxRemovedError = 0.0f;
+  size_t start = 0;
+  while (start < frames.size()) {
+    track.timestamps.push_back(uint32_t(start * frameTime));
+    track.positions.push_back(frames[start]);
+    if (start + 1 >= frames.size())
+      break;
+    size_t end = start + 1;
+    float segmentError = 0.0f;
+    while (end + 1 < frames.size() && end + 1 - start <= maxSpan) {
+      float error = 0.0f;
+      bool isWithinError = true;
+      for (size_t frame = start + 1; frame <= end && isWithinError; frame++) {
+        error = std::max(error, getError(start, end + 1, frame));
+        isWithinError = error <= maxError;
+      }
+      if (!isWithinError)
+        break;
+      segmentError = error;
+      end++;
+    }
+    maxRemovedError = std::max(maxRemovedError, segmentError);
+    start = end;
+  }
+
+  if (statistics) {
+    statistics->countOfFrames = frames.size();
+    statistics->countOfKeys = track.size();
+    statistics->trackSize = frames.size() * sizeof(PositionBlock);
+    statistics->decimatedSize = track.getSize();
+    statistics->maxError = maxRemovedError;
+  }
+  return track;
+}
+
+} // namespace TckFile
@@ -0,0 +1,73 @@
+#pragma once
+/*
+ * Synthetic .tck generator
+ * Author: Roman Romop5 Dobias
+ * Purpose: produce tracks of arbitrary length for benchmarks
+ */
+
+#include <cmath>
+
+#include "tck.hpp"
+
+namespace TckFile {
+
+struct GeneratorSettings
+{
+  size_t countOfFrames = 1000;
+  uint32_t milisecondsPerFrame = 20;
+  uint32_t seed = 1;
+};
+
+/* \brief Builds a File with a smooth random track
+ *
+ * As in the game files, the leading block is zero, positions are relative to
+ * the start of animation and the start/end positions in header are equal.
+ */
+class Generator
+{
+private:
+  GeneratorSettings settings;
+  uint32_t state;
+
+  float random()
+  {
+    state = state * 1103515245 + 12345;
+    return float((state >> 8) & 0xFFFF) / 65535.0f;
+  }
+
+public:
+  explicit Generator(const GeneratorSettings& generatorSettings)
+    : settings(generatorSettings)
+    , state(generatorSettings.seed)
+  {}
+
+  File generate()
+  {
+    state = settings.seed;
+    File file;
+    file.header.magicByte = magicByteConstant;
+    for (size_t c = 0; c < 3; c++) {
+      file.header.startPosition[c] = (random() - 0.5f) * 0.01f;
+      file.header.endPosition[c] = file.header.startPosition[c];
+    }
+    file.header.lengthOfAnimation =
+      uint32_t(settings.countOfFrames * settings.milisecondsPerFrame);
+    file.header.milisecondsPerFrame = settings.milisecondsPerFrame;
+    file.header.countOfPositionBlocks = uint32_t(settings.countOfFrames + 1);
+
+    file.positionBlocks.reserve(settings.countOfFrames);
+    float velocity[3] = { 0.0f, 0.0f, 0.0f };
+    PositionBlock block = PositionBlock();
+    for (size_t i = 0; i < settings.countOfFrames; i++) {
+      for (size_t c = 0; c < 3; c++) {
+        velocity[c] = velocity[c] * 0.9f + (random() - 0.5f) * 0.002f;
+        block.position[c] += velocity[c];
+      }
+      file.positionBlocks.push_back(block);
+    }
+    file.trailingData.assign(4, 0);
+    return file;
+  }
+};
+
+} // namespace TckFile
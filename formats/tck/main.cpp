@@ -1,12 +1,198 @@
+#include <cstdlib>
+#include <deque>
+
+#include "compact.hpp"
+#include "corpus.hpp"
+#include "decimate.hpp"
+#include "json.hpp"
+#include "push.hpp"
+#include "resample.hpp"
 #include "tck.hpp"
+#include "trajectory.hpp"
 using namespace TckFile;
+
+COUNT_ALLOCATIONS()
+
+static int processDirectory(const std::string& directory, size_t countOfThreads)
+{
+    ThreadPool pool(countOfThreads);
+    auto files = Corpus::findFiles(directory, ".tck");
+    auto report = Corpus::processFiles(files, [](const std::string& path, std::string& message) {
+        // each task owns its loader, nothing is shared between files
+        Loader loader;
+        ErrorCollector errors;
+        File file;
+        bool success = loader.loadFile(path, file, errors);
+        message = errors.lastError;
+        return success;
+    }, pool);
+    Corpus::printReport(report, std::cout);
+    return report.countOfFailures == 0 ? 0 : 1;
+}
+
+static int compactFile(const std::string& inputName, const std::string& outputName)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(inputName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    Compact::Statistics statistics;
+    if(!Compact::storeFile(file, outputName, &statistics))
+    {
+        std::cerr << "[Err] Failed to store " << outputName << std::endl;
+        return 1;
+    }
+    std::cout << "Positions: " << statistics.rawSize << " B -> "
+              << statistics.compactSize << " B ("
+              << double(statistics.rawSize) / std::max<size_t>(statistics.compactSize, 1)
+              << "x)" << std::endl;
+    std::cout << "Max position error: " << statistics.maxPositionError << std::endl;
+    return 0;
+}
+
+static int resampleFile(const std::string& inputName, const std::string& outputName,
+                        uint32_t milisecondsPerFrame)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(inputName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    File resampled = resample(file, milisecondsPerFrame);
+    std::cout << "Frames: " << file.getCountOfFrames() << " x " << file.getMilisecondsPerFrame()
+              << " ms -> " << resampled.getCountOfFrames() << " x "
+              << resampled.getMilisecondsPerFrame() << " ms" << std::endl;
+    return loader.storeFile(resampled, outputName) ? 0 : 1;
+}
+
+static int decimateFile(const std::string& inputName, float maxError)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(inputName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    DecimationStatistics statistics;
+    KeyframeTrack track = decimate(file, maxError, &statistics);
+    std::cout << "Keys: " << statistics.countOfFrames << " frames -> "
+              << track.size() << " keyframes" << std::endl;
+    std::cout << "Positions: " << statistics.trackSize << " B -> "
+              << statistics.decimatedSize << " B ("
+              << double(statistics.trackSize) / std::max<size_t>(statistics.decimatedSize, 1)
+              << "x)" << std::endl;
+    std::cout << "Max position error: " << statistics.maxError << std::endl;
+    return 0;
+}
+
+static int findInRegion(const std::string& directory, const Spatial::Box& region)
+{
+    auto fileNames = Corpus::findFiles(directory, ".tck");
+    // deque keeps files in place while they're added to the index
+    std::deque<File> files;
+    std::vector<std::string> indexedNames;
+    TrajectoryIndex index;
+    for(const auto& fileName : fileNames)
+    {
+        Loader loader;
+        ErrorCollector errors;
+        files.emplace_back();
+        if(!loader.loadFile(fileName, files.back(), errors))
+        {
+            std::cerr << "[Warn] Skipping " << fileName << ": " << errors.lastError << std::endl;
+            files.pop_back();
+            continue;
+        }
+        index.add(files.back());
+        indexedNames.push_back(fileName);
+    }
+    index.build();
+    for(uint32_t track : index.findTracksIn(region))
+        std::cout << indexedNames[track] << std::endl;
+    return 0;
+}
+
+static int printStats(const std::string& fileName)
+{
+    Loader loader;
+    ErrorCollector errors;
+    File file;
+    if(!loader.loadFile(fileName, file, errors))
+    {
+        std::cerr << "[Err] " << errors.lastError << std::endl;
+        return 1;
+    }
+    const LoadStats& stats = loader.getStats();
+    Json::printLoadStats(std::cout, fileName, stats, COUNT_OF_SECTIONS,
+                         [](size_t i) { return std::string(getSectionName(Section(i))); });
+    std::cout << "\n}" << std::endl;
+    return 0;
+}
+
+static int loadStdin()
+{
+    // the file is decoded as it comes, only the current block is buffered
+    DumpVisitor dumpVisitor;
+    PushParser parser(dumpVisitor, "<stdin>", false);
+    std::vector<char> fragment(64 * 1024);
+    while(std::cin.read(fragment.data(), fragment.size()) || std::cin.gcount() > 0)
+    {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(fragment.data());
+        if(!parser.feed(data, std::cin.gcount()))
+            return 1;
+    }
+    return parser.finish() ? 0 : 1;
+}
+
 int main(int argc, char** argv)
 {
     Loader loader;
     if(argc < 2)
     {
-	    std::cerr << "USAGE: pathToRecordFile.rec" << std::endl;
+	    std::cerr << "USAGE: pathToTrackFile.tck" << std::endl;
+	    std::cerr << "       --dir pathToDirectory [countOfThreads]" << std::endl;
+	    std::cerr << "       --compact inputFile outputFile" << std::endl;
+	    std::cerr << "       --resample inputFile outputFile milisecondsPerFrame" << std::endl;
+	    std::cerr << "       --decimate inputFile maxPositionError" << std::endl;
+	    std::cerr << "       --stats pathToTrackFile.tck" << std::endl;
+	    std::cerr << "       --region pathToDirectory minX minY minZ maxX maxY maxZ" << std::endl;
+	    std::cerr << "       --stdin < pathToTrackFile.tck" << std::endl;
 	    return 0;
     }
-    auto rep = loader.loadFile(argv[1]);
+    if(std::string(argv[1]) == "--dir" && argc > 2)
+    {
+        size_t countOfThreads = argc > 3 ? std::atoi(argv[3]) : std::thread::hardware_concurrency();
+        return processDirectory(argv[2], countOfThreads);
+    }
+    if(std::string(argv[1]) == "--compact" && argc > 3)
+        return compactFile(argv[2], argv[3]);
+    if(std::string(argv[1]) == "--resample" && argc > 4)
+        return resampleFile(argv[2], argv[3], std::atoi(argv[4]));
+    if(std::string(argv[1]) == "--decimate" && argc > 3)
+        return decimateFile(argv[2], std::atof(argv[3]));
+    if(std::string(argv[1]) == "--region" && argc > 8)
+    {
+        Spatial::Box region;
+        for(size_t c = 0; c < 3; c++)
+        {
+            region.min[c] = std::atof(argv[3 + c]);
+            region.max[c] = std::atof(argv[6 + c]);
+        }
+        return findInRegion(argv[2], region);
+    }
+    if(std::string(argv[1]) == "--stats" && argc > 2)
+        return printStats(argv[2]);
+    if(std::string(argv[1]) == "--stdin")
+        return loadStdin();
+    DumpVisitor dumpVisitor;
+    auto rep = loader.loadFile(argv[1], dumpVisitor);
 }
@@ -0,0 +1,150 @@
+#pragma once
+/*
+ * .tck push parser
+ * Author: Roman Romop5 Dobias
+ * Purpose: decode .tck received in fragments (pipes, decompressors, archives)
+ */
+
+#include "records.hpp"
+#include "tck.hpp"
+
+namespace TckFile {
+
+/* \brief Resumable parser, which is fed with arbitrary fragments of .tck
+ *
+ * Keeps at most a single incomplete record (the header or a position block)
+ * and never seeks. Visitor receives the same calls as from Loader::loadFile().
+ * Unless keepContent is false, the content is gathered into File (getFile()),
+ * which is then the same as the one of Loader.
+ *
+ * Bytes after the last position block are trailing data, thus the file ends
+ * only with finish().
+ */
+class PushParser
+{
+private:
+  enum State
+  {
+    STATE_HEADER,
+    STATE_LEADING_BLOCK,
+    STATE_POSITIONS,
+    STATE_TRAILING,
+    STATE_FAILED
+  };
+
+  Visitor& visitor;
+  bool keepContent;
+  std::string sourceName;
+  Records::RecordReader reader;
+  State state;
+  File currentFile;
+  size_t streamPosition;
+  size_t blockIndex;
+
+  void readRecord(const unsigned char* record)
+  {
+    switch (state) {
+      case STATE_HEADER:
+        memcpy(&currentFile.header, record, sizeof(Header));
+        visitor.onHeader(currentFile.header);
+        if (currentFile.header.magicByte != magicByteConstant) {
+          visitor.onError("Invalid magic byte ...\n");
+          state = STATE_FAILED;
+        } else if (currentFile.header.countOfPositionBlocks == 0) {
+          currentFile.hasLeadingBlock = false;
+          state = STATE_TRAILING;
+        } else {
+          state = STATE_LEADING_BLOCK;
+          reader.expect(sizeof(PositionBlock));
+        }
+        break;
+      case STATE_LEADING_BLOCK:
+        // ignored as Loader does, it contains zeros
+        memcpy(&currentFile.leadingBlock, record, sizeof(PositionBlock));
+        blockIndex = 1;
+        state = blockIndex < currentFile.header.countOfPositionBlocks
+                  ? STATE_POSITIONS
+                  : STATE_TRAILING;
+        break;
+      case STATE_POSITIONS: {
+        PositionBlock block;
+        memcpy(&block, record, sizeof(block));
+        if (keepContent)
+          currentFile.positionBlocks.push_back(block);
+        visitor.onPosition(blockIndex, block);
+        if (++blockIndex == currentFile.header.countOfPositionBlocks)
+          state = STATE_TRAILING;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+public:
+  explicit PushParser(Visitor& fileVisitor,
+                      const std::string& name = "<stream>",
+                      bool shouldKeepContent = true)
+    : visitor(fileVisitor)
+    , keepContent(shouldKeepContent)
+  {
+    reset(name);
+  }
+
+  /// Starts parsing of another file, name is passed to Visitor::onBeginFile()
+  void reset(const std::string& name)
+  {
+    sourceName = name;
+    currentFile = File();
+    streamPosition = 0;
+    blockIndex = 0;
+    state = STATE_HEADER;
+    reader.expect(sizeof(Header));
+    visitor.onBeginFile(sourceName);
+  }
+
+  /* \brief Decodes fragment, which follows the previously fed ones
+   *
+   * Returns false (and reports an error) if the file is invalid, further
+   * fragments are ignored then.
+   */
+  bool feed(const uint8_t* data, size_t size)
+  {
+    const unsigned char* fragment = data;
+    while (size > 0 && state != STATE_FAILED) {
+      if (state == STATE_TRAILING) {
+        if (keepContent)
+          currentFile.trailingData.insert(currentFile.trailingData.end(),
+                                          fragment, fragment + size);
+        streamPosition += size;
+        break;
+      }
+      const unsigned char* record = reader.next(fragment, size);
+      if (!record)
+        break;
+      streamPosition += reader.getLength();
+      readRecord(record);
+    }
+    return state != STATE_FAILED;
+  }
+
+  /// Call after the last fragment, reports files ending inside of blocks
+  bool finish()
+  {
+    if (state == STATE_TRAILING)
+      return true;
+    if (state != STATE_FAILED) {
+      visitor.onError("Unexpected end of file " + sourceName);
+      state = STATE_FAILED;
+    }
+    return false;
+  }
+
+  bool hasFailed() const { return state == STATE_FAILED; }
+  /// Count of decoded bytes (without the incomplete record)
+  size_t getPosition() const { return streamPosition; }
+  /// Content parsed so far, complete once finish() succeeds
+  File& getFile() { return currentFile; }
+};
+
+} // namespace TckFile
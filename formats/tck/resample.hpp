@@ -0,0 +1,125 @@
+#pragma once
+/*
+ * .tck resampling
+ * Author: Roman Romop5 Dobias
+ * Purpose: convert tracks to a different frame rate
+ */
+
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "tck.hpp"
+
+namespace TckFile {
+
+/* \brief Converts tracks of given length and frame rate to another rate
+ *
+ * Source indices and weights of all target frames are computed once in the
+ * constructor, thus a Resampler can be reused for all tracks with the same
+ * length and rate. apply() is then a branch-free pass over target frames,
+ * which lerps each frame as a single SSE vector: xyz plus the x of the
+ * following frame, read unaligned straight from the packed source, thus no
+ * gather into separate buffers is needed. Frames at the end, where the
+ * fourth float would run past the source or the target, are scalar.
+ *
+ * The track keeps its covered time span: frame i of source is at
+ * i * sourceFrameTime, the target has floor(span / targetFrameTime) + 1
+ * frames. Frames are lerped.
+ */
+class Resampler
+{
+private:
+  std::vector<uint32_t> firstIndices;
+  std::vector<float> weights; // of the frame after the first one
+  size_t countOfSourceFrames;
+  /// Target frames, which can be lerped 4 floats at once (see apply())
+  size_t countOfWideFrames = 0;
+
+public:
+  Resampler(size_t countOfFrames,
+            uint32_t sourceFrameTime,
+            uint32_t targetFrameTime)
+    : countOfSourceFrames(countOfFrames)
+  {
+    if (countOfFrames == 0)
+      return;
+    sourceFrameTime = std::max<uint32_t>(sourceFrameTime, 1);
+    targetFrameTime = std::max<uint32_t>(targetFrameTime, 1);
+    uint64_t span = uint64_t(countOfFrames - 1) * sourceFrameTime;
+    size_t countOfTargetFrames = size_t(span / targetFrameTime) + 1;
+    firstIndices.resize(countOfTargetFrames);
+    weights.resize(countOfTargetFrames);
+    // exact integer arithmetic, float would drift for long tracks
+    for (size_t i = 0; i < countOfTargetFrames; i++) {
+      uint64_t time = uint64_t(i) * targetFrameTime;
+      uint64_t index = time / sourceFrameTime;
+      float weight = float(time % sourceFrameTime) / sourceFrameTime;
+      // the last frame is lerped with itself
+      if (index + 1 >= countOfFrames) {
+        index = countOfFrames > 1 ? countOfFrames - 2 : 0;
+        weight = countOfFrames > 1 ? 1.0f : 0.0f;
+      }
+      firstIndices[i] = uint32_t(index);
+      weights[i] = weight;
+    }
+    // 4 floats read at both source frames and written at the target one
+    // mustn't run past the last frame
+    while (countOfWideFrames + 1 < countOfTargetFrames &&
+           firstIndices[countOfWideFrames] + 2 < countOfFrames)
+      countOfWideFrames++;
+  }
+
+  size_t getCountOfSourceFrames() const { return countOfSourceFrames; }
+  size_t getCountOfTargetFrames() const { return firstIndices.size(); }
+
+  /// Resamples source (getCountOfSourceFrames()) into target
+  void apply(const PositionBlock* source, PositionBlock* target) const
+  {
+    if (firstIndices.empty())
+      return;
+    const float* input = source[0].position;
+    float* output = target[0].position;
+    size_t next = countOfSourceFrames > 1 ? 3 : 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // xyz and x of the following frame, which is overwritten by the next
+    // target frame
+    for (; i < countOfWideFrames; i++) {
+      const float* a = input + size_t(firstIndices[i]) * 3;
+      __m128 va = _mm_loadu_ps(a);
+      __m128 delta = _mm_sub_ps(_mm_loadu_ps(a + next), va);
+      __m128 result =
+        _mm_add_ps(va, _mm_mul_ps(delta, _mm_set1_ps(weights[i])));
+      _mm_storeu_ps(output + i * 3, result);
+    }
+#endif
+    for (; i < firstIndices.size(); i++) {
+      const float* a = input + size_t(firstIndices[i]) * 3;
+      const float* b = a + next;
+      float weight = weights[i];
+      output[i * 3 + 0] = a[0] + (b[0] - a[0]) * weight;
+      output[i * 3 + 1] = a[1] + (b[1] - a[1]) * weight;
+      output[i * 3 + 2] = a[2] + (b[2] - a[2]) * weight;
+    }
+  }
+};
+
+/// Returns copy of file with frames resampled to newMilisecondsPerFrame
+inline File resample(const File& file, uint32_t newMilisecondsPerFrame)
+{
+  File result = file;
+  const auto& blocks = file.getPositionBlocks();
+  Resampler resampler(blocks.size(), file.getMilisecondsPerFrame(),
+                      newMilisecondsPerFrame);
+  std::vector<PositionBlock> resampled(resampler.getCountOfTargetFrames());
+  if (!blocks.empty())
+    resampler.apply(blocks.data(), resampled.data());
+  result.setPositionBlocks(std::move(resampled),
+                           std::max<uint32_t>(newMilisecondsPerFrame, 1));
+  return result;
+}
+
+} // namespace TckFile
@@ -4,14 +4,19 @@
  * Purpose: print outs content of .rep file
  * Credits: djbozkosz for RE the .tck format
  */
+#pragma once
 
+#include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <string.h>
 #include <string>
 #include <vector>
 
+#include "allocations.hpp"
+
 /* \brief Stores cutscene directives
  *
  * .tck files store position of animated object for each animation frame
@@ -40,20 +45,157 @@ struct PositionBlock
 #pragma pack(pop)
 
 class Loader;
+class Compact;
+class Generator;
+class PushParser;
 
 class File
 {
     friend Loader;
-    Header header;
+    friend Compact;
+    friend Generator;
+    friend PushParser;
+    Header header = Header();
+    PositionBlock leadingBlock = PositionBlock(); // the first (ignored) block
+    bool hasLeadingBlock = true; // false for files with zero position blocks
     std::vector<PositionBlock> positionBlocks;
+    std::vector<unsigned char> trailingData; // bytes after the last block
+public:
+    const Header& getHeader() const { return header; }
+    uint32_t getMilisecondsPerFrame() const { return header.milisecondsPerFrame; }
+    /// Frames without the leading block, i-th frame is at i * milisecondsPerFrame
+    const std::vector<PositionBlock>& getPositionBlocks() const { return positionBlocks; }
+    size_t getCountOfFrames() const { return positionBlocks.size(); }
+    const PositionBlock& getLeadingBlock() const { return leadingBlock; }
+    /// Files without any block (countOfPositionBlocks == 0) are stored as such
+    bool getHasLeadingBlock() const { return hasLeadingBlock || !positionBlocks.empty(); }
+    const std::vector<unsigned char>& getTrailingData() const { return trailingData; }
+
+    /// Replaces frames, updates frame rate and length of animation in header
+    void setPositionBlocks(std::vector<PositionBlock> blocks, uint32_t milisecondsPerFrame)
+    {
+        positionBlocks = std::move(blocks);
+        hasLeadingBlock = true;
+        header.milisecondsPerFrame = milisecondsPerFrame;
+        header.countOfPositionBlocks = uint32_t(positionBlocks.size() + 1);
+        header.lengthOfAnimation = uint32_t(positionBlocks.size() * milisecondsPerFrame);
+    }
+
+    /* \brief Returns position at given time in O(1)
+     *
+     * Frames are lerped, the first / last frame is held outside of the track.
+     */
+    PositionBlock positionAt(uint32_t timeMs) const
+    {
+        PositionBlock result = PositionBlock();
+        if (positionBlocks.empty())
+            return result;
+        uint32_t frameTime = header.milisecondsPerFrame > 0 ? header.milisecondsPerFrame : 1;
+        size_t frame = timeMs / frameTime;
+        if (frame + 1 >= positionBlocks.size())
+            return positionBlocks.back();
+        float alpha = float(timeMs % frameTime) / frameTime;
+        const PositionBlock& a = positionBlocks[frame];
+        const PositionBlock& b = positionBlocks[frame + 1];
+        for (size_t c = 0; c < 3; c++)
+            result.position[c] = a.position[c] + (b.position[c] - a.position[c]) * alpha;
+        return result;
+    }
+};
+
+enum Section
+{
+  SECTION_HEADER = 0,
+  SECTION_POSITIONS,
+  SECTION_TRAILING,
+  COUNT_OF_SECTIONS
+};
+
+inline const char* getSectionName(Section section)
+{
+  static const char* names[COUNT_OF_SECTIONS] = { "header", "positions",
+                                                   "trailing" };
+  return section < COUNT_OF_SECTIONS ? names[section] : "unknown";
+}
+
+/* \brief Cost of a single section of the last load
+ */
+struct SectionStats
+{
+  double seconds;
+  uint64_t bytes;
+  uint64_t countOfChunks; // position blocks (including the leading one)
+  uint64_t countOfAllocations;
+};
+
+/* \brief Where the time of the last Loader::loadFile() went
+ *
+ * Times come from std::chrono::steady_clock. Allocations are counted only in
+ * executables using COUNT_ALLOCATIONS(), otherwise they stay 0.
+ */
+struct LoadStats
+{
+  SectionStats sections[COUNT_OF_SECTIONS];
+  uint64_t fileSize;
+  double seconds; // whole load, including opening the file
+  uint64_t countOfAllocations;
+};
+
+/* \brief Receives content of .tck file while it's being parsed
+ *
+ * All methods do nothing by default (only errors go to std::cerr), thus
+ * parsing without a visitor costs no formatting.
+ */
+class Visitor
+{
+public:
+  virtual ~Visitor() {}
+  virtual void onBeginFile(const std::string& /*fileName*/) {}
+  virtual void onError(const std::string& message)
+  {
+    std::cerr << "[Err] " << message << std::endl;
+  }
+  virtual void onHeader(const Header& /*header*/) {}
+  virtual void onPosition(size_t /*index*/, const PositionBlock& /*block*/) {}
+};
+
+/* \brief Keeps the last error instead of printing it
+ */
+class ErrorCollector : public Visitor
+{
 public:
+  std::string lastError;
+  void onError(const std::string& message) override { lastError = message; }
 };
 
-#define GETPOS(stream)                                                         \
-  {                                                                            \
-    std::cerr << "Stream position at: 0x" << std::hex << stream.tellg()          \
-              << std::dec << std::endl;                                        \
+/* \brief Prints out content of .tck file (as tckloader does)
+ */
+class DumpVisitor : public Visitor
+{
+public:
+  void onBeginFile(const std::string& fileName) override
+  {
+    std::cerr << "[TckParser] Parsing file: " << fileName << std::endl;
+  }
+
+  void onHeader(const Header& fileHeader) override
+  {
+    std::cout << "Magic byte: " << std::hex << fileHeader.magicByte << std::dec << std::endl;
+    std::cout << "Start pos: " << " [" << fileHeader.startPosition[0] << ", " << fileHeader.startPosition[1] 
+        << ", " <<fileHeader.startPosition[2] << "] " <<  std::endl;
+    std::cout << "End pos: " << " [" << fileHeader.endPosition[0] << ", " << fileHeader.endPosition[1] 
+        << ", " <<fileHeader.endPosition[2] << "] " <<  std::endl;
+    std::cout << "Duration: " << fileHeader.lengthOfAnimation << std::endl;
+    std::cout << "Miliseconds per frame: " << fileHeader.milisecondsPerFrame << std::endl;
+    std::cout << "Count of position blocks: " << fileHeader.countOfPositionBlocks << std::endl;
+  }
+
+  void onPosition(size_t /*index*/, const PositionBlock& block) override
+  {
+    std::cerr << "Position: " << block.position[0] << ", " << block.position[1] << ", " << block.position[2] << std::endl;
   }
+};
+
 #define READ(var)                                                              \
   read(reinterpret_cast<char*>(&var), sizeof(var) / sizeof(char))
 class Loader
@@ -61,52 +203,154 @@ class Loader
 private:
   Header fileHeader;
   File currentFile;
+  Visitor* visitor;
+  LoadStats stats;
+  std::chrono::steady_clock::time_point sectionStart;
+  uint64_t sectionStartAllocations;
 
-  bool readPositionBlocks(std::ifstream& inputFile)
+  void beginSection()
   {
-    PositionBlock block;
-    for(size_t i = 0; i < fileHeader.countOfPositionBlocks; i++)
-    {
-        inputFile.READ(block);
-        // Note: ignore first position block as it contains zeros and according to the duration of anim
-        // it shouldn't be used
-        if(i == 0)
-            continue;
-        std::cerr << "Position: " << block.position[0] << ", " << block.position[1] << ", " << block.position[2] << std::endl;
-        currentFile.positionBlocks.push_back(block);
-    }
+    sectionStart = std::chrono::steady_clock::now();
+    sectionStartAllocations = Allocations::getCount();
+  }
+
+  void endSection(Section section, size_t bytes, size_t countOfChunks)
+  {
+    SectionStats& result = stats.sections[section];
+    result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - sectionStart)
+                       .count();
+    result.bytes = bytes;
+    result.countOfChunks = countOfChunks;
+    result.countOfAllocations =
+      Allocations::getCount() - sectionStartAllocations;
+  }
+
+  bool readPositionBlocks(std::ifstream& inputFile, size_t remainingSize)
+  {
+    currentFile.hasLeadingBlock = fileHeader.countOfPositionBlocks > 0;
+    if (fileHeader.countOfPositionBlocks == 0)
+      return true;
+    if (fileHeader.countOfPositionBlocks > remainingSize / sizeof(PositionBlock))
+      return false;
+    // Note: ignore first position block as it contains zeros and according to the duration of anim
+    // it shouldn't be used
+    if (!inputFile.READ(currentFile.leadingBlock))
+      return false;
+    // the rest of stream is read at once
+    auto& blocks = currentFile.positionBlocks;
+    blocks.resize(fileHeader.countOfPositionBlocks - 1);
+    if (!inputFile.read(reinterpret_cast<char*>(blocks.data()),
+                        blocks.size() * sizeof(PositionBlock)))
+      return false;
+    for (size_t i = 0; i < blocks.size(); i++)
+      visitor->onPosition(i + 1, blocks[i]);
     return true;
   }
 public:
   File loadFile(std::string fileName)
   {
-    std::cerr << "[TckParser] Parsing file: " << fileName << std::endl;
+    Visitor silentVisitor;
+    return loadFile(fileName, silentVisitor);
+  }
+
+  File loadFile(std::string fileName, Visitor& fileVisitor)
+  {
+    File file;
+    loadFile(fileName, file, fileVisitor);
+    return file;
+  }
+
+  /// Statistics of the last loadFile() (partial if it failed)
+  const LoadStats& getStats() const { return stats; }
+
+  /// Parses file into file, returns false (and reports an error) on failure
+  bool loadFile(const std::string& fileName, File& file, Visitor& fileVisitor)
+  {
+    auto loadStart = std::chrono::steady_clock::now();
+    uint64_t loadStartAllocations = Allocations::getCount();
+    stats = LoadStats();
+    visitor = &fileVisitor;
+    currentFile = File();
+    visitor->onBeginFile(fileName);
     std::ifstream inputFile;
-    inputFile.open(fileName, std::ifstream::binary);
-    if (inputFile.is_open()) {
-      inputFile.READ(fileHeader);
-      std::cout << "Magic byte: " << std::hex << fileHeader.magicByte << std::dec << std::endl;
-      std::cout << "Start pos: " << " [" << fileHeader.startPosition[0] << ", " << fileHeader.startPosition[1] 
-          << ", " <<fileHeader.startPosition[2] << "] " <<  std::endl;
-      std::cout << "End pos: " << " [" << fileHeader.endPosition[0] << ", " << fileHeader.endPosition[1] 
-          << ", " <<fileHeader.endPosition[2] << "] " <<  std::endl;
-      std::cout << "Duration: " << fileHeader.lengthOfAnimation << std::endl;
-      std::cout << "Miliseconds per frame: " << fileHeader.milisecondsPerFrame << std::endl;
-      std::cout << "Count of position blocks: " << fileHeader.countOfPositionBlocks << std::endl;
-      if (fileHeader.magicByte != magicByteConstant) {
-        std::cerr << "[Err] Invalid magic byte ...\n" << std::endl;
-        return File();
-      }
-      readPositionBlocks(inputFile);
-      inputFile.close();
-    } else {
-      std::cerr << "[Err] Failed to open file " << fileName << std::endl;
+    inputFile.open(fileName, std::ifstream::binary | std::ifstream::ate);
+    if (!inputFile.is_open()) {
+      visitor->onError("Failed to open file " + fileName);
+      return false;
+    }
+    size_t fileSize = static_cast<size_t>(inputFile.tellg());
+    stats.fileSize = fileSize;
+    inputFile.seekg(0);
+    beginSection();
+    inputFile.READ(fileHeader);
+    if (!inputFile) {
+      visitor->onError("Unexpected end of file " + fileName);
+      return false;
     }
-    return currentFile;
+    endSection(SECTION_HEADER, sizeof(Header), 0);
+    visitor->onHeader(fileHeader);
+    if (fileHeader.magicByte != magicByteConstant) {
+      visitor->onError("Invalid magic byte ...\n");
+      return false;
+    }
+    currentFile.header = fileHeader;
+    beginSection();
+    if (!readPositionBlocks(inputFile, fileSize - sizeof(Header))) {
+      visitor->onError("Unexpected end of file " + fileName);
+      return false;
+    }
+    size_t countOfBlocks = fileHeader.countOfPositionBlocks;
+    endSection(SECTION_POSITIONS, countOfBlocks * sizeof(PositionBlock),
+               countOfBlocks);
+    beginSection();
+    currentFile.trailingData.assign(std::istreambuf_iterator<char>(inputFile),
+                                    std::istreambuf_iterator<char>());
+    endSection(SECTION_TRAILING, currentFile.trailingData.size(), 0);
+    file = std::move(currentFile);
+    stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - loadStart)
+                      .count();
+    stats.countOfAllocations = Allocations::getCount() - loadStartAllocations;
+    return true;
   }
-  bool storeFile(File file, std::string fileName)
+  /// Serializes file into buffer, which is allocated exactly once
+  static void storeToBuffer(const File& file, std::vector<char>& buffer)
   {
+    Header header = file.header;
+    header.magicByte = magicByteConstant;
+    bool hasLeadingBlock = file.getHasLeadingBlock();
+    header.countOfPositionBlocks =
+      hasLeadingBlock ? uint32_t(file.positionBlocks.size() + 1) : 0;
+    size_t size = sizeof(Header) + header.countOfPositionBlocks * sizeof(PositionBlock) +
+                  file.trailingData.size();
+    buffer.clear();
+    buffer.reserve(size);
+    auto write = [&buffer](const void* data, size_t length) {
+      const char* bytes = static_cast<const char*>(data);
+      buffer.insert(buffer.end(), bytes, bytes + length);
+    };
+    write(&header, sizeof(Header));
+    if (hasLeadingBlock)
+      write(&file.leadingBlock, sizeof(PositionBlock));
+    write(file.positionBlocks.data(), file.positionBlocks.size() * sizeof(PositionBlock));
+    write(file.trailingData.data(), file.trailingData.size());
+  }
+
+  /// Stores file, the whole content is written with a single write
+  bool storeFile(const File& file, std::string fileName)
+  {
+    std::vector<char> buffer;
+    storeToBuffer(file, buffer);
+    std::ofstream outputFile;
+    outputFile.open(fileName, std::ofstream::binary | std::ofstream::trunc);
+    if (!outputFile.is_open()) {
+      std::cerr << "[Err] Failed to open file " << fileName << std::endl;
       return false;
+    }
+    outputFile.write(buffer.data(), buffer.size());
+    outputFile.close();
+    return static_cast<bool>(outputFile);
   }
 };
 } // namespace TckFile
@@ -0,0 +1,48 @@
+/*
+ * Synthetic .tck generator
+ * Author: Roman Romop5 Dobias
+ * Purpose: writes valid tracks of arbitrary length for benchmarking
+ */
+#include <cstdlib>
+
+#include "generator.hpp"
+using namespace TckFile;
+
+static void printUsage()
+{
+  std::cerr << "USAGE: tckgen output.tck [options]" << std::endl
+            << "  --frames N        count of animation frames" << std::endl
+            << "  --frame-time MS   miliseconds per frame" << std::endl
+            << "  --seed N          random seed" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    printUsage();
+    return 1;
+  }
+  GeneratorSettings settings;
+  for (int i = 2; i < argc; i++) {
+    std::string option = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "[Err] Missing value of " << option << std::endl;
+      return 1;
+    }
+    unsigned long value = std::strtoul(argv[++i], nullptr, 10);
+    if (option == "--frames")
+      settings.countOfFrames = value;
+    else if (option == "--frame-time")
+      settings.milisecondsPerFrame = uint32_t(value);
+    else if (option == "--seed")
+      settings.seed = uint32_t(value);
+    else {
+      std::cerr << "[Err] Unknown option " << option << std::endl;
+      printUsage();
+      return 1;
+    }
+  }
+  File file = Generator(settings).generate();
+  Loader loader;
+  return loader.storeFile(file, argv[1]) ? 0 : 1;
+}
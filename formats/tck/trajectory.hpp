@@ -0,0 +1,154 @@
+#pragma once
+/*
+ * .tck trajectory index
+ * Author: Roman Romop5 Dobias
+ * Purpose: spatial queries over tracks of a corpus
+ */
+
+#include "spatial.hpp"
+#include "tck.hpp"
+
+namespace TckFile {
+
+/* \brief Track found by TrajectoryIndex
+ */
+struct TrackHit
+{
+  uint32_t track; // as returned by TrajectoryIndex::add()
+  PositionBlock position; // at the queried time (findTracksNear() only)
+  float distance;
+};
+
+/* \brief Spatial index over .tck tracks
+ *
+ * Each track is cut into segments of framesPerSegment frames, a segment
+ * covers the time from its first frame to its last one, which is also the
+ * first frame of the next segment. Frames are lerped (File::positionAt()),
+ * thus positions lie within the box of frames, the first / last frame is
+ * held before / after the track. Segments go into Spatial::Bvh, candidates
+ * are then checked exactly:
+ *  - findTracksNear() samples the position at the queried time
+ *  - findTracksIn() tests lines between frames against the region
+ *
+ * Header::startPosition / endPosition aren't used, their meaning isn't known
+ * for sure. Files are referred to, thus they must outlive the index. Call
+ * build() after add() and before queries.
+ */
+class TrajectoryIndex
+{
+private:
+  size_t framesPerSegment;
+  std::vector<const File*> files;
+  Spatial::Bvh bvh;
+
+  void addSegments(uint32_t trackIndex,
+                   const File& file,
+                   std::vector<Spatial::Item>& items) const
+  {
+    const auto& frames = file.getPositionBlocks();
+    uint32_t frameTime = std::max<uint32_t>(file.getMilisecondsPerFrame(), 1);
+    for (size_t first = 0; first < frames.size(); first += framesPerSegment) {
+      size_t last = std::min(first + framesPerSegment, frames.size() - 1);
+      Spatial::Item item;
+      item.box = Spatial::Box::createEmpty();
+      for (size_t frame = first; frame <= last; frame++)
+        item.box.extend(frames[frame].position);
+      item.startTime =
+        uint32_t(std::min<uint64_t>(uint64_t(first) * frameTime, UINT32_MAX));
+      item.endTime =
+        last + 1 == frames.size()
+          ? UINT32_MAX
+          : uint32_t(std::min<uint64_t>(uint64_t(last) * frameTime, UINT32_MAX));
+      item.group = trackIndex;
+      item.object = 0;
+      item.firstKey = uint32_t(first);
+      item.lastKey = uint32_t(last);
+      items.push_back(item);
+      if (last + 1 == frames.size())
+        break;
+    }
+  }
+
+  bool passesThrough(const Spatial::Item& item, const Spatial::Box& region) const
+  {
+    const auto& frames = files[item.group]->getPositionBlocks();
+    if (item.firstKey == item.lastKey)
+      return region.contains(frames[item.firstKey].position);
+    for (size_t frame = item.firstKey; frame < item.lastKey; frame++) {
+      if (Spatial::intersectsSegment(region, frames[frame].position,
+                                     frames[frame + 1].position))
+        return true;
+    }
+    return false;
+  }
+
+public:
+  explicit TrajectoryIndex(size_t countOfFramesPerSegment = 32)
+    : framesPerSegment(std::max<size_t>(countOfFramesPerSegment, 1))
+  {}
+
+  /// Returns index of track, which is reported by queries
+  uint32_t add(const File& file)
+  {
+    files.push_back(&file);
+    return uint32_t(files.size() - 1);
+  }
+
+  void build()
+  {
+    std::vector<Spatial::Item> items;
+    for (size_t i = 0; i < files.size(); i++)
+      addSegments(uint32_t(i), *files[i], items);
+    bvh = Spatial::Bvh(std::move(items));
+  }
+
+  size_t getCountOfTracks() const { return files.size(); }
+  const Spatial::Bvh& getBvh() const { return bvh; }
+
+  /// Tracks within radius of point at given time, sorted by track
+  std::vector<TrackHit> findTracksNear(const PositionBlock& point,
+                                       float radius,
+                                       uint32_t timeMs) const
+  {
+    std::vector<TrackHit> hits;
+    float radiusSquared = radius * radius;
+    Spatial::Box region = Spatial::Box::createAround(point.position, radius);
+    bvh.query(region, timeMs, timeMs, [&](const Spatial::Item& item) {
+      if (item.box.getDistanceSquared(point.position) > radiusSquared)
+        return;
+      PositionBlock position = files[item.group]->positionAt(timeMs);
+      float distanceSquared = 0.0f;
+      for (size_t c = 0; c < 3; c++) {
+        float delta = position.position[c] - point.position[c];
+        distanceSquared += delta * delta;
+      }
+      if (distanceSquared <= radiusSquared)
+        hits.push_back(
+          TrackHit{ item.group, position, std::sqrt(distanceSquared) });
+    });
+    std::sort(hits.begin(), hits.end(), [](const TrackHit& a, const TrackHit& b) {
+      return a.track < b.track;
+    });
+    hits.erase(std::unique(hits.begin(), hits.end(),
+                           [](const TrackHit& a, const TrackHit& b) {
+                             return a.track == b.track;
+                           }),
+               hits.end());
+    return hits;
+  }
+
+  /// Tracks, which pass through region at any time, sorted
+  std::vector<uint32_t> findTracksIn(const Spatial::Box& region) const
+  {
+    std::vector<uint32_t> result;
+    bvh.query(region, 0, UINT32_MAX, [&](const Spatial::Item& item) {
+      if (passesThrough(item, region))
+        result.push_back(item.group);
+    });
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+  }
+};
+
+} // namespace TckFile